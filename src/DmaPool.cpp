@@ -0,0 +1,295 @@
+//=================================================================================================
+// DmaPool.cpp - Implements an allocator of pinned, physically addressed host memory for DMA
+//
+// The pool is one anonymous mapping, backed by huge pages when asked, that is locked into RAM
+// so the kernel can't move or swap it out from under the device.   The physical address of
+// every page is looked up once, when the pool is created.   Chunks are carved off the front
+// of the pool in order, and are guaranteed to be physically contiguous, so that a descriptor
+// ring or data buffer can be handed to the FPGA as a single address.
+//
+// A physical address is only the address the device should put on the bus when no IOMMU
+// translates the device's DMA.   requireDirectDma() checks that before a pool is handed to a
+// device.   Pools of ordinary 4K pages are for testing: mlock() keeps a page in RAM, but the
+// kernel may still migrate it to a different frame (during compaction, for instance), so only
+// huge pages are safe for a real transfer.
+//=================================================================================================
+#include <unistd.h>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include "DmaPool.h"
+#include "Utility.h"
+using namespace std;
+
+//=================================================================================================
+// alignUp() - Rounds a value up to a multiple of a power of 2
+//=================================================================================================
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// virtToPhys() - Returns the physical address of a user-space address
+//
+// Each 8-byte entry of /proc/self/pagemap describes one (base-size) page of our address space:
+// bit 63 is set if the page is present, and bits 0-54 are its page frame number.   Without
+// CAP_SYS_ADMIN, the kernel reports every frame number as 0.
+//
+// Can throw std::runtime_error
+//=================================================================================================
+uint64_t DmaPool::virtToPhys(const void* virtAddr)
+{
+    const uint64_t PAGE_PRESENT = 1ULL << 63;
+    const uint64_t PFN_MASK     = (1ULL << 55) - 1;
+
+    uint64_t address  = (uint64_t)virtAddr;
+    size_t   pageSize = getpagesize();
+    uint64_t entry    = 0;
+
+    // Open the page map of our own process
+    int fd = ::open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) throwRuntime("Can't open /proc/self/pagemap");
+
+    // Read the entry for the page that contains this address
+    ssize_t count = pread(fd, &entry, sizeof entry, (address / pageSize) * sizeof entry);
+    ::close(fd);
+    if (count != sizeof entry) throwRuntime("Can't read /proc/self/pagemap");
+
+    // If the page isn't in RAM, it doesn't have a physical address
+    if ((entry & PAGE_PRESENT) == 0) throwRuntime("Address %p isn't resident in memory", virtAddr);
+
+    // If the kernel won't tell us the frame number, we can't do DMA
+    if ((entry & PFN_MASK) == 0) throwRuntime("Can't resolve physical addresses (must run as root)");
+
+    // Hand the caller the physical address
+    return (entry & PFN_MASK) * pageSize + address % pageSize;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// requireDirectDma() - Makes sure that a device's DMA addresses are physical addresses
+//
+// Passed: deviceDir = the sysfs directory of the device
+//         iommuDir  = the directory where the kernel lists the IOMMUs it has enabled
+//
+// If the kernel has enabled any IOMMU, the device's IOMMU group has to be in "identity"
+// (pass-through) mode, such as after booting with iommu=pt.   In any other mode, the device
+// would see the physical addresses of the pool as I/O virtual addresses that nothing maps,
+// and DMA to them would fault or, worse, land somewhere else.
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void DmaPool::requireDirectDma(string deviceDir, string iommuDir)
+{
+    error_code ec;
+    string     type;
+
+    // If the kernel didn't enable an IOMMU, nothing translates DMA addresses
+    if (!filesystem::is_directory(iommuDir, ec) || filesystem::is_empty(iommuDir, ec)) return;
+
+    // Find out how the device's IOMMU group translates addresses
+    ifstream file(deviceDir + "/iommu_group/type");
+    getline(file, type);
+    while (!type.empty() && isspace((unsigned char)type.back())) type.pop_back();
+
+    // Only an identity mapping passes physical addresses through untouched
+    if (type == "identity") return;
+
+    // Otherwise, we can't DMA to the pool
+    if (type.empty())
+    {
+        throwRuntime("An IOMMU is enabled, and %s/iommu_group/type can't be read, so DMA to physical"
+                     " addresses isn't safe.  Boot with iommu=pt, or disable the IOMMU", c(deviceDir));
+    }
+    throwRuntime("An IOMMU translates DMA for %s (group type \"%s\"), so it can't use physical"
+                 " addresses.  Boot with iommu=pt, or set the group type to identity", c(deviceDir), c(type));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// create() - Reserves and pins the memory of the pool, and looks up its physical addresses
+//
+// Passed: size     = the size of the pool in bytes.  It's rounded up to a whole page
+//         pageSize = the size of the pages that back the pool
+//
+// Huge pages come from the kernel's reserved pool (see /proc/sys/vm/nr_hugepages, or
+// /sys/kernel/mm/hugepages for 1 GB pages), so this fails if too few have been reserved.
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void DmaPool::create(size_t size, pagesize_t pageSize)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+
+    // If we already have a pool, get rid of it
+    destroy();
+
+    // Determine the page size, and ask for huge pages of that size if we need them
+    if      (pageSize == PAGE_2M) {pageBytes_ = 2 << 20; flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);}
+    else if (pageSize == PAGE_1G) {pageBytes_ = 1 << 30; flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);}
+    else                           pageBytes_ = getpagesize();
+
+    // The pool is always a whole number of pages
+    size = alignUp(size, pageBytes_);
+    if (size == 0) throwRuntime("Can't create an empty DMA pool");
+
+    // Reserve the memory
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        throwRuntime("Can't allocate %zu KB of %zu KB pages for DMA: %s", size >> 10, pageBytes_ >> 10, strerror(errno));
+    }
+    base_ = (uint8_t*)ptr;
+    size_ = size;
+
+    // Lock the pool into RAM so that its physical addresses can't change
+    if (mlock(base_, size_) < 0)
+    {
+        int error = errno;
+        destroy();
+        throwRuntime("Can't lock %zu KB of DMA memory: %s", size >> 10, strerror(error));
+    }
+
+    // Make sure every page really has its own frame, then look up its physical address
+    try
+    {
+        for (size_t offset = 0; offset < size_; offset += pageBytes_)
+        {
+            *(volatile uint8_t*)(base_ + offset) = 0;
+            pagePhys_.push_back(virtToPhys(base_ + offset));
+        }
+    }
+    catch(const std::runtime_error&)
+    {
+        destroy();
+        throw;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// destroy() - Releases the memory of the pool
+//=================================================================================================
+void DmaPool::destroy()
+{
+    if (base_) munmap(base_, size_);
+    base_ = nullptr;
+    size_ = 0;
+    used_ = 0;
+    pagePhys_.clear();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isContiguous() - Returns true if the pages that hold a range of the pool are physically
+//                  contiguous
+//=================================================================================================
+bool DmaPool::isContiguous(size_t offset, size_t length) const
+{
+    size_t first = offset / pageBytes_;
+    size_t last  = (offset + length - 1) / pageBytes_;
+
+    for (size_t page = first; page < last; ++page)
+    {
+        if (pagePhys_[page + 1] != pagePhys_[page] + pageBytes_) return false;
+    }
+
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// alloc() - Carves a chunk out of the pool
+//
+// Passed: size       = the size of the chunk in bytes
+//         alignment  = the alignment of the chunk, a power of 2
+//         contiguous = true if the chunk must be physically contiguous
+//
+// Returns: the user-space and physical addresses of the chunk
+//
+// If a contiguous chunk won't fit in the next free space because it straddles two pages that
+// aren't physically adjacent, the chunk starts at the next page instead, and the space that
+// was skipped is wasted.   Chunks that don't need to be contiguous (i.e., buffers that are
+// described to the device by a list of descriptors) never waste space that way
+//
+// Can throw std::runtime_error
+//=================================================================================================
+DmaPool::chunk_t DmaPool::alloc(size_t size, size_t alignment, bool contiguous)
+{
+    // Make sure the caller's request makes sense
+    if (size == 0) throwRuntime("Can't allocate an empty DMA chunk");
+    if (alignment == 0 || (alignment & (alignment - 1))) throwRuntime("DMA alignment %zu isn't a power of 2", alignment);
+
+    // Find the first properly aligned spot where the chunk is physically contiguous
+    size_t offset = alignUp(used_, alignment);
+    while (contiguous && offset + size <= size_ && !isContiguous(offset, size))
+    {
+        offset = alignUp((offset / pageBytes_ + 1) * pageBytes_, alignment);
+    }
+
+    // If there's no such spot, complain
+    if (offset + size > size_)
+    {
+        throwRuntime("DMA pool has no room for a%s %zu byte chunk (%zu of %zu bytes used)",
+                     contiguous ? " contiguous" : "", size, used_, size_);
+    }
+
+    // Take the chunk off the front of the free space
+    used_ = offset + size;
+
+    // Hand the caller the chunk
+    return {base_ + offset, pagePhys_[offset / pageBytes_] + offset % pageBytes_, size};
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// physAddr() - Returns the physical address of a location inside the pool
+//
+// Can throw std::runtime_error
+//=================================================================================================
+uint64_t DmaPool::physAddr(const void* virtAddr) const
+{
+    size_t offset = (const uint8_t*)virtAddr - base_;
+
+    // Make sure the address is inside the pool
+    if ((const uint8_t*)virtAddr < base_ || offset >= size_) throwRuntime("Address %p isn't in the DMA pool", virtAddr);
+
+    // Look up the physical address of its page
+    return pagePhys_[offset / pageBytes_] + offset % pageBytes_;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// virtAddr() - Returns the user-space address of a physical address inside the pool
+//
+// Returns: the user-space address, or nullptr if the physical address isn't in the pool
+//=================================================================================================
+uint8_t* DmaPool::virtAddr(uint64_t physAddr) const
+{
+    for (size_t page = 0; page < pagePhys_.size(); ++page)
+    {
+        if (physAddr >= pagePhys_[page] && physAddr - pagePhys_[page] < pageBytes_)
+        {
+            return base_ + page * pageBytes_ + (physAddr - pagePhys_[page]);
+        }
+    }
+
+    // If we get here, the address isn't one of ours
+    return nullptr;
+}
+//=================================================================================================
@@ -0,0 +1,102 @@
+//=================================================================================================
+// DmaPool.h - Defines an allocator of pinned, physically addressed host memory for DMA
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class DmaPool
+{
+public:
+
+    // The page sizes the pool can be built from
+    enum pagesize_t
+    {
+        PAGE_4K,                        // Ordinary pages.  For testing only: the kernel may
+                                        // still migrate them while they're locked
+        PAGE_2M,                        // 2 MB huge pages
+        PAGE_1G                         // 1 GB huge pages
+    };
+
+    // A piece of the pool
+    struct chunk_t
+    {
+        uint8_t*    virtAddr;           // The user-space address of the chunk
+        uint64_t    physAddr;           // The physical address of the start of the chunk
+        size_t      size;               // The size of the chunk in bytes
+    };
+
+    // Default constructor - the pool is empty until create() is called
+    DmaPool() {}
+
+    // Constructor that creates a pool of the specified size
+    DmaPool(size_t size, pagesize_t pageSize = PAGE_2M) {create(size, pageSize);}
+
+    // Destructor
+    ~DmaPool() {destroy();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    DmaPool (const DmaPool&) = delete;
+    DmaPool& operator= (const DmaPool&) = delete;
+
+    // Reserves and pins "size" bytes (rounded up to a whole page) and looks up the physical
+    // address of each page.  Throws std::runtime_error
+    void        create(size_t size, pagesize_t pageSize = PAGE_2M);
+
+    // Releases the memory.  Every chunk that was allocated from the pool becomes invalid
+    void        destroy();
+
+    // Carves a chunk out of the pool.  "alignment" must be a power of 2.  Unless "contiguous"
+    // is false, the chunk is physically contiguous.  Throws std::runtime_error if the pool
+    // doesn't have room for it
+    chunk_t     alloc(size_t size, size_t alignment = 64, bool contiguous = true);
+
+    // Returns every chunk to the pool at once
+    void        reset() {used_ = 0;}
+
+    // Returns the physical address of a location inside the pool.  Throws std::runtime_error
+    uint64_t    physAddr(const void* virtAddr) const;
+
+    // Returns the user-space address of a physical address inside the pool, or nullptr
+    uint8_t*    virtAddr(uint64_t physAddr) const;
+
+    // The user-space address and size of the pool, and the size of its pages in bytes
+    uint8_t*    baseAddr()  const {return base_;}
+    size_t      size()      const {return size_;}
+    size_t      pageBytes() const {return pageBytes_;}
+
+    // How many bytes have been allocated, and how many are left
+    size_t      used()      const {return used_;}
+    size_t      available() const {return size_ - used_;}
+
+    // Returns the physical address of any resident, locked user-space address by consulting
+    // /proc/self/pagemap.  Requires CAP_SYS_ADMIN.  Throws std::runtime_error
+    static uint64_t virtToPhys(const void* virtAddr);
+
+    // Throws std::runtime_error unless the device in "deviceDir" sees physical addresses as
+    // they are, i.e., no IOMMU is translating its DMA.  Physical addresses from the pool are
+    // only usable as bus addresses when this passes
+    static void requireDirectDma(std::string deviceDir, std::string iommuDir = "/sys/class/iommu");
+
+protected:
+
+    // Returns true if the pages that hold [offset, offset + length) are physically contiguous
+    bool        isContiguous(size_t offset, size_t length) const;
+
+    // The user-space address of the pool
+    uint8_t*    base_ = nullptr;
+
+    // The size of the pool in bytes
+    size_t      size_ = 0;
+
+    // The size of each page in bytes
+    size_t      pageBytes_ = 0;
+
+    // The number of bytes that have been carved off the front of the pool
+    size_t      used_ = 0;
+
+    // The physical address of each page of the pool
+    std::vector<uint64_t> pagePhys_;
+};
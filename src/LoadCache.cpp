@@ -0,0 +1,163 @@
+//=================================================================================================
+// LoadCache.cpp - Implements a record of which bitstream was last loaded into each FPGA
+//
+// The cache file contains one line per board:
+//    <key> <sha256_of_bitstream> <fingerprint>
+//
+// The key identifies the board (we use the JTAG hardware-server address and the PCI address of
+// the FPGA), and the fingerprint is a value read back from the device after the load.  A board
+// whose fingerprint couldn't be read after the load has no entry at all.
+// The file is locked with flock() while it's being read or modified, so concurrent instances
+// of load_bitstream don't corrupt it.
+//=================================================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sstream>
+#include <mutex>
+#include "LoadCache.h"
+using namespace std;
+
+// flock() doesn't serialize threads that share a file description, so we use this too
+static mutex cacheMutex;
+
+//=================================================================================================
+// read() - Reads the contents of the cache file into a map
+//=================================================================================================
+map<string, LoadCache::entry_t> LoadCache::read(int fd)
+{
+    map<string, entry_t> result;
+    string               text, key;
+    char                 buffer[4096];
+    ssize_t              length;
+
+    // Read the entire file
+    lseek(fd, 0, SEEK_SET);
+    while ((length = ::read(fd, buffer, sizeof buffer)) > 0) text.append(buffer, length);
+
+    // Parse each line into an entry
+    istringstream lines(text);
+    string line;
+    while (getline(lines, line))
+    {
+        entry_t entry;
+        istringstream fields(line);
+        if (fields >> key >> entry.hash >> entry.fingerprint) result[key] = entry;
+    }
+
+    // Hand the caller the cache entries
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// write() - Replaces the contents of the cache file with the specified entries
+//=================================================================================================
+void LoadCache::write(int fd, const map<string, entry_t>& entries)
+{
+    string text;
+
+    // Build the text of the file
+    for (auto& it : entries)
+    {
+        text += it.first + " " + it.second.hash + " " + it.second.fingerprint + "\n";
+    }
+
+    // And write it out
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, text.c_str(), text.size(), 0) == (ssize_t)text.size()) fsync(fd);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isLoaded() - Returns true if the board is known to hold the bitstream with the specified hash
+//
+// Passed: key         = identifies the board
+//         hash        = the SHA-256 of the bitstream file
+//         fingerprint = the fingerprint currently read from the board
+//
+// The board's current fingerprint must match the one recorded after the last load.  This
+// catches boards that were power-cycled or reprogrammed by someone else.
+//=================================================================================================
+bool LoadCache::isLoaded(string key, string hash, string fingerprint)
+{
+    lock_guard<mutex> lock(cacheMutex);
+
+    // Open the cache file.  If it doesn't exist, nothing is known to be loaded
+    int fd = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    // Read the cache file while holding a shared lock on it
+    flock(fd, LOCK_SH);
+    auto entries = read(fd);
+    ::close(fd);
+
+    // If we know nothing about this board, it needs to be loaded
+    auto it = entries.find(key);
+    if (it == entries.end()) return false;
+
+    // If a different bitstream was loaded last time, this one needs to be loaded
+    if (it->second.hash != hash) return false;
+
+    // The board must still have the fingerprint it had after the last load
+    if (it->second.fingerprint != fingerprint) return false;
+
+    // If we get here, the board already holds this bitstream
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// update() - Locks the cache file and replaces (or erases) the entry for a board
+//=================================================================================================
+void LoadCache::update(string key, string hash, string fingerprint)
+{
+    lock_guard<mutex> lock(cacheMutex);
+
+    // Open (or create) the cache file
+    int fd = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    // If we can't, the cache just won't be used
+    if (fd < 0) return;
+
+    // Hold an exclusive lock while we modify the file
+    flock(fd, LOCK_EX);
+
+    // Fetch the current entries
+    auto entries = read(fd);
+
+    // Replace or erase the entry for this board
+    if (hash.empty())
+        entries.erase(key);
+    else
+        entries[key] = {hash, fingerprint};
+
+    // Write the entries back out
+    write(fd, entries);
+
+    // Closing the file releases the lock
+    ::close(fd);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// record() - Records that a bitstream was successfully loaded into a board
+//=================================================================================================
+void LoadCache::record(string key, string hash, string fingerprint)
+{
+    update(key, hash, fingerprint);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// forget() - Forgets whatever we knew about a board
+//=================================================================================================
+void LoadCache::forget(string key)
+{
+    update(key, "", "");
+}
+//=================================================================================================
@@ -0,0 +1,38 @@
+//=================================================================================================
+// LoadCache.h - Defines a record of which bitstream was last loaded into each FPGA
+//=================================================================================================
+#pragma once
+#include <string>
+#include <map>
+
+class LoadCache
+{
+public:
+
+    // Each entry records what was loaded into a board, and the board's fingerprint afterwards
+    struct entry_t {std::string hash; std::string fingerprint;};
+
+    // Constructor
+    LoadCache(std::string filename) : filename_(filename) {}
+
+    // Returns true if the board is known to hold the bitstream with the specified hash
+    bool    isLoaded(std::string key, std::string hash, std::string fingerprint);
+
+    // Records that a bitstream was successfully loaded into a board
+    void    record(std::string key, std::string hash, std::string fingerprint);
+
+    // Forgets whatever we knew about a board
+    void    forget(std::string key);
+
+protected:
+
+    // Reads the cache file into a map, or writes the map to the cache file
+    std::map<std::string, entry_t> read(int fd);
+    void    write(int fd, const std::map<std::string, entry_t>& entries);
+
+    // Locks the cache file and replaces (or erases, if hash is empty) the entry for a board
+    void    update(std::string key, std::string hash, std::string fingerprint);
+
+    // The name of the file where the cache is kept
+    std::string filename_;
+};
@@ -0,0 +1,344 @@
+//=================================================================================================
+// LoadDaemon.cpp - Implements a server that keeps Vivado running and loads bitstreams on request
+//
+// Starting Vivado and connecting to a hardware-server takes far longer than actually loading a
+// bitstream.   The daemon pays that cost once, then accepts requests on a UNIX socket.
+//
+// The protocol is a single line in each direction:
+//    Request:  "load <ip_address> <bitstream_filename>"
+//    Reply:    "OK" or "ERROR <message>"
+//=================================================================================================
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <cstdio>
+#include <stdexcept>
+#include "LoadDaemon.h"
+#include "Utility.h"
+using namespace std;
+
+// How long a client that has connected has to send its request
+static const int REQUEST_TIMEOUT_SECS = 5;
+
+//=================================================================================================
+// readLine() - Reads a linefeed-terminated line from a socket
+//
+// Returns: false if the connection was closed (or the socket's receive timeout expired) before
+//          a complete line arrived
+//=================================================================================================
+static bool readLine(int fd, string& line)
+{
+    char ch;
+
+    // We haven't read anything yet
+    line.clear();
+
+    // Read one character at a time until we see a linefeed
+    while (read(fd, &ch, 1) == 1)
+    {
+        if (ch == '\n') return true;
+        if (ch != '\r') line += ch;
+
+        // Don't let a misbehaving client feed us an infinitely long line
+        if (line.size() > 4096) return false;
+    }
+
+    // If we get here, the connection closed or the other end went quiet
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeLine() - Writes a string followed by a linefeed to a socket
+//=================================================================================================
+static bool writeLine(int fd, string line)
+{
+    line += '\n';
+    return write(fd, c(line), line.size()) == (ssize_t)line.size();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// firstError() - Returns the first line of Vivado output that reports an error
+//=================================================================================================
+static string firstError(const vector<string>& output)
+{
+    for (auto& s : output)
+    {
+        if (classifyLine(s) == LC_ERROR) return "Vivado reports '" + s + "'";
+    }
+    return "Vivado reports failure";
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runScript() - Performs macro substitutions on a script, then has Vivado execute it
+//
+// Passed: script    = the lines of the Tcl script
+//         bitstream = the value of the %file% macro
+//         ipAddress = the value of the %ip_address% macro
+//         output    = receives the output of the script
+//
+// Returns: true if the script ran without error
+//=================================================================================================
+bool LoadDaemon::runScript(const vector<string>& script, string bitstream, string ipAddress,
+                           vector<string>& output)
+{
+    // Make a copy of the script with all of the macros replaced
+    vector<string> v = script;
+    for (auto& line : v)
+    {
+        replace(line, "\%file\%", bitstream);
+        replace(line, "\%ip_address\%", ipAddress);
+    }
+
+    // This is the name of the file where we'll store the script
+    string tclFilename = config_.tmpDir + "/" + tmpName_ + ".tcl";
+
+    // Write the script to disk
+    if (!writeStrVecToFile(v, tclFilename))
+    {
+        output = {"ERROR: Can't write " + tclFilename};
+        return false;
+    }
+
+    // Have Vivado run it.  Once it has, we don't need the file any more
+    bool ok = vivado_.source(tclFilename, output);
+    unlink(c(tclFilename));
+    return ok;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// startVivado() - Starts the Vivado interpreter and runs the startup script
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void LoadDaemon::startVivado()
+{
+    vector<string> output;
+
+    // A freshly started Vivado isn't connected to any hardware servers
+    connected_.clear();
+
+    // Launch the Vivado Tcl interpreter.  Each request gets the same amount of time
+    vivado_.setTimeout(config_.timeout);
+    vivado_.start(config_.vivado);
+
+    // Our temporary files are named after our process ID, so that two daemons don't collide
+    tmpName_ = "load_bitstream_daemon." + to_string(getpid());
+
+    // Run the startup script (typically "open_hw_manager")
+    if (!runScript(config_.startupScript, "", "", output)) throwRuntime("%s", c(firstError(output)));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// load() - Loads a bitstream into an FPGA
+//
+// Passed: bitstream = the name of the bitstream file
+//         ipAddress = the IP address and port of the hardware-server
+//
+// Returns: An empty string on success, otherwise an error message
+//=================================================================================================
+string LoadDaemon::load(string bitstream, string ipAddress)
+{
+    vector<string> output;
+
+    // If Vivado has died since the last request, restart it
+    if (!vivado_.isRunning())
+    {
+        try
+        {
+            startVivado();
+        }
+        catch(const std::runtime_error& e)
+        {
+            return e.what();
+        }
+    }
+
+    // Vivado's output goes here for later inspection.  Requests are served one at a time, and
+    // each one overwrites the last one's output
+    string resultFilename = config_.tmpDir + "/" + tmpName_ + ".result";
+
+    // If we're not yet connected to this hardware server, connect to it
+    if (connected_.count(ipAddress) == 0)
+    {
+        if (!runScript(config_.connectScript, bitstream, ipAddress, output))
+        {
+            writeStrVecToFile(output, resultFilename);
+            return firstError(output);
+        }
+        connected_.insert(ipAddress);
+    }
+
+    // Load the bitstream
+    bool ok = runScript(config_.programmingScript, bitstream, ipAddress, output);
+
+    // Write the Vivado output to a file for later inspection
+    writeStrVecToFile(output, resultFilename);
+
+    // If that worked, tell the caller that all is well
+    if (ok) return "";
+
+    // On failure, drop the connection so that the next request starts with a fresh one
+    vector<string> ignored;
+    vivado_.execute("disconnect_hw_server " + ipAddress, ignored);
+    connected_.erase(ipAddress);
+
+    // And tell the caller what went wrong
+    return firstError(output);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Listens on the UNIX socket and services load requests.   Never returns
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void LoadDaemon::run()
+{
+    sockaddr_un addr;
+    string      line;
+
+    // A client that disconnects early shouldn't kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    // Make sure the socket name fits in a UNIX socket address
+    if (config_.socketName.size() >= sizeof(addr.sun_path))
+    {
+        throwRuntime("Socket name too long: %s", c(config_.socketName));
+    }
+
+    // Start Vivado and open the hardware manager.  This is the slow part we only do once
+    startVivado();
+
+    // Create the socket
+    int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd < 0) throwRuntime("Can't create socket");
+
+    // Fill in the address of the socket
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, c(config_.socketName));
+
+    // Remove any stale socket left behind by a previous daemon
+    unlink(c(config_.socketName));
+
+    // Bind the socket to its name.  Only the owner of the daemon may ask it to load bitstreams,
+    // so the socket is created without group or other permissions: changing them after the
+    // bind would leave a window in which anyone could connect
+    mode_t oldMask = umask(077);
+    int    status  = bind(sd, (sockaddr*)&addr, sizeof addr);
+    umask(oldMask);
+    if (status < 0) throwRuntime("Can't bind %s", c(config_.socketName));
+
+    // Start listening for connections
+    if (listen(sd, 16) < 0) throwRuntime("Can't listen on %s", c(config_.socketName));
+
+    printf("load_bitstream daemon listening on %s\n", c(config_.socketName));
+    fflush(stdout);
+
+    // Service requests forever
+    while (true)
+    {
+        // Wait for a client to connect
+        int client = accept(sd, nullptr, nullptr);
+        if (client < 0) continue;
+
+        // Requests are served one at a time, so a client that connects and then says nothing
+        // mustn't be allowed to hold up everyone else
+        timeval timeout = {REQUEST_TIMEOUT_SECS, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+        // Fetch the request from the client
+        if (!readLine(client, line))
+        {
+            ::close(client);
+            continue;
+        }
+
+        // Parse the request into its verb, IP address, and filename
+        size_t p1 = line.find(' ');
+        size_t p2 = (p1 == string::npos) ? string::npos : line.find(' ', p1+1);
+
+        // If the request is malformed, complain
+        if (p2 == string::npos || line.substr(0, p1) != "load")
+        {
+            writeLine(client, "ERROR Malformed request '" + line + "'");
+            ::close(client);
+            continue;
+        }
+
+        // Extract the IP address and bitstream filename
+        string ipAddress = line.substr(p1+1, p2-p1-1);
+        string bitstream = line.substr(p2+1);
+
+        // Load the bitstream
+        string error = load(bitstream, ipAddress);
+
+        // And tell the client how it went
+        writeLine(client, error.empty() ? "OK" : "ERROR " + error);
+        ::close(client);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// request() - Asks a running daemon to load a bitstream
+//
+// Passed: socketName = the name of the UNIX socket the daemon is listening on
+//         bitstream  = the name of the bitstream file
+//         ipAddress  = the IP address and port of the hardware-server
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void LoadDaemon::request(string socketName, string bitstream, string ipAddress)
+{
+    sockaddr_un addr;
+    string      reply;
+
+    // Make sure the socket name fits in a UNIX socket address
+    if (socketName.size() >= sizeof(addr.sun_path)) throwRuntime("Socket name too long: %s", c(socketName));
+
+    // Create the socket
+    int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd < 0) throwRuntime("Can't create socket");
+
+    // Fill in the address of the daemon
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, c(socketName));
+
+    // Connect to the daemon
+    if (connect(sd, (sockaddr*)&addr, sizeof addr) < 0)
+    {
+        ::close(sd);
+        throwRuntime("Can't connect to daemon at %s", c(socketName));
+    }
+
+    // Send the request and wait for the reply
+    bool ok = writeLine(sd, "load " + ipAddress + " " + bitstream) && readLine(sd, reply);
+
+    // We're done with the socket
+    ::close(sd);
+
+    // If the daemon went away, complain
+    if (!ok) throwRuntime("No reply from daemon at %s", c(socketName));
+
+    // If the daemon reported an error, pass it along
+    if (reply != "OK") throwRuntime("%s", c(reply.substr(reply.find(' ') + 1)));
+}
+//=================================================================================================
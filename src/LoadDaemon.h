@@ -0,0 +1,62 @@
+//=================================================================================================
+// LoadDaemon.h - Defines a server that keeps Vivado running and loads bitstreams on request
+//=================================================================================================
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include "VivadoSession.h"
+
+class LoadDaemon
+{
+public:
+
+    // These are the settings that control the daemon
+    struct config_t
+    {
+        std::string              vivado;
+        std::string              tmpDir;
+        std::string              socketName;
+        double                   timeout;
+        std::vector<std::string> startupScript;
+        std::vector<std::string> connectScript;
+        std::vector<std::string> programmingScript;
+    };
+
+    // Constructor
+    LoadDaemon(const config_t& config) : config_(config) {}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    LoadDaemon (const LoadDaemon&) = delete;
+    LoadDaemon& operator= (const LoadDaemon&) = delete;
+
+    // Listens on the UNIX socket and services load requests.  Never returns
+    void    run();
+
+    // Asks a running daemon to load a bitstream.  Throws std::runtime_error on failure
+    static void request(std::string socketName, std::string bitstream, std::string ipAddress);
+
+protected:
+
+    // Starts (or restarts) the Vivado interpreter and runs the startup script
+    void    startVivado();
+
+    // Loads a bitstream.  Returns an empty string on success, otherwise an error message
+    std::string load(std::string bitstream, std::string ipAddress);
+
+    // Has Vivado run a script after performing macro substitutions on it
+    bool    runScript(const std::vector<std::string>& script, std::string bitstream,
+                      std::string ipAddress, std::vector<std::string>& output);
+
+    // Our configuration settings
+    config_t      config_;
+
+    // The long-lived Vivado interpreter
+    VivadoSession vivado_;
+
+    // The set of hardware-servers (i.e., IP addresses) that Vivado is connected to
+    std::set<std::string> connected_;
+
+    // The base name of our temporary files in tmpDir
+    std::string   tmpName_;
+};
@@ -0,0 +1,418 @@
+//=================================================================================================
+// Mmio.cpp - Implements typed access to the registers and memory of a memory-mapped PCI BAR
+//
+// Single registers are accessed through volatile pointers of the register's width.   Bulk
+// transfers are broken into a short run of 32-bit accesses that brings the device address to
+// a vector boundary, a run of the widest accesses the CPU supports (AVX2, SSE2, or 64-bit
+// integer), and a trailing run of 32-bit accesses.   Wide accesses turn into fewer, larger
+// PCIe transactions, which is what lets a bulk transfer approach the bandwidth of the link.
+//
+// Large writes use non-temporal stores, which bypass the cache and go out through the
+// write-combining buffers.  Every bulk write ends with a store fence so that the data has
+// been pushed toward the device by the time writeBlock() returns.   Single writes to a
+// write-combining BAR are fenced too, since without a fence they can sit in a write-combining
+// buffer, or reach the device out of order with the writes around them.
+//=================================================================================================
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "Mmio.h"
+#include "Utility.h"
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MMIO_X86
+#endif
+
+//=================================================================================================
+// detectSimd() - Returns the widest instruction set this CPU supports for block transfers
+//=================================================================================================
+static Mmio::simd_t detectSimd()
+{
+#ifdef MMIO_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Mmio::SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return Mmio::SIMD_SSE2;
+#endif
+    return Mmio::SIMD_NONE;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// currentSimd() - Returns a reference to the instruction set in use for block transfers
+//=================================================================================================
+static Mmio::simd_t& currentSimd()
+{
+    static Mmio::simd_t level = detectSimd();
+    return level;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// copyWords() - Copies a run of 32-bit or 64-bit words, one volatile access per word
+//
+// Passed: dst      = where to write the words
+//         src      = where to read the words
+//         count    = the number of words
+//         toDevice = true if "dst" is the device, false if "src" is
+//
+// The source and destination don't need to be aligned beyond 4 bytes
+//=================================================================================================
+template <class T> static void copyWords(uint8_t* dst, const uint8_t* src, size_t count, bool toDevice)
+{
+    T value;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (toDevice)
+        {
+            memcpy(&value, src + i*sizeof(T), sizeof(T));
+            *(volatile T*)(dst + i*sizeof(T)) = value;
+        }
+        else
+        {
+            value = *(volatile T*)(src + i*sizeof(T));
+            memcpy(dst + i*sizeof(T), &value, sizeof(T));
+        }
+    }
+}
+//=================================================================================================
+
+
+#ifdef MMIO_X86
+//=================================================================================================
+// writeSse2/writeAvx2() - Write a run of 16-byte or 32-byte vectors to the device
+//
+// Passed: dst       = the destination on the device, aligned to the vector width
+//         src       = the source data, with no alignment requirement
+//         count     = the number of vectors
+//         streaming = true to use non-temporal stores
+//=================================================================================================
+__attribute__((target("sse2")))
+static void writeSse2(uint8_t* dst, const uint8_t* src, size_t count, bool streaming)
+{
+    __m128i* d = (__m128i*)dst;
+    const __m128i* s = (const __m128i*)src;
+
+    if (streaming)
+        for (size_t i = 0; i < count; ++i) _mm_stream_si128(d + i, _mm_loadu_si128(s + i));
+    else
+        for (size_t i = 0; i < count; ++i) _mm_store_si128(d + i, _mm_loadu_si128(s + i));
+}
+
+__attribute__((target("avx2")))
+static void writeAvx2(uint8_t* dst, const uint8_t* src, size_t count, bool streaming)
+{
+    __m256i* d = (__m256i*)dst;
+    const __m256i* s = (const __m256i*)src;
+
+    if (streaming)
+        for (size_t i = 0; i < count; ++i) _mm256_stream_si256(d + i, _mm256_loadu_si256(s + i));
+    else
+        for (size_t i = 0; i < count; ++i) _mm256_store_si256(d + i, _mm256_loadu_si256(s + i));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readSse2/readAvx2() - Read a run of 16-byte or 32-byte vectors from the device
+//
+// Passed: dst   = the destination buffer, with no alignment requirement
+//         src   = the source on the device, aligned to the vector width
+//         count = the number of vectors
+//=================================================================================================
+__attribute__((target("sse2")))
+static void readSse2(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    __m128i* d = (__m128i*)dst;
+    const __m128i* s = (const __m128i*)src;
+    for (size_t i = 0; i < count; ++i) _mm_storeu_si128(d + i, _mm_load_si128(s + i));
+}
+
+__attribute__((target("avx2")))
+static void readAvx2(uint8_t* dst, const uint8_t* src, size_t count)
+{
+    __m256i* d = (__m256i*)dst;
+    const __m256i* s = (const __m256i*)src;
+    for (size_t i = 0; i < count; ++i) _mm256_storeu_si256(d + i, _mm256_load_si256(s + i));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// fillSse2/fillAvx2() - Fill a run of 16-byte or 32-byte vectors with a repeating 32-bit value
+//=================================================================================================
+__attribute__((target("sse2")))
+static void fillSse2(uint8_t* dst, uint32_t value, size_t count, bool streaming)
+{
+    __m128i* d = (__m128i*)dst;
+    __m128i  v = _mm_set1_epi32(value);
+
+    if (streaming)
+        for (size_t i = 0; i < count; ++i) _mm_stream_si128(d + i, v);
+    else
+        for (size_t i = 0; i < count; ++i) _mm_store_si128(d + i, v);
+}
+
+__attribute__((target("avx2")))
+static void fillAvx2(uint8_t* dst, uint32_t value, size_t count, bool streaming)
+{
+    __m256i* d = (__m256i*)dst;
+    __m256i  v = _mm256_set1_epi32(value);
+
+    if (streaming)
+        for (size_t i = 0; i < count; ++i) _mm256_stream_si256(d + i, v);
+    else
+        for (size_t i = 0; i < count; ++i) _mm256_store_si256(d + i, v);
+}
+//=================================================================================================
+#endif
+
+
+//=================================================================================================
+// vectorWidth() - Returns the number of bytes moved per access by an instruction set
+//=================================================================================================
+static size_t vectorWidth(Mmio::simd_t level)
+{
+    if (level == Mmio::SIMD_AVX2) return 32;
+    if (level == Mmio::SIMD_SSE2) return 16;
+    return 8;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// simdLevel() - Returns the instruction set the block transfers use
+//=================================================================================================
+Mmio::simd_t Mmio::simdLevel()
+{
+    return currentSimd();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setSimdLevel() - Selects the instruction set the block transfers use
+//
+// Asking for an instruction set the CPU doesn't support selects the best one it does support
+//=================================================================================================
+void Mmio::setSimdLevel(simd_t level)
+{
+    static const simd_t supported = detectSimd();
+    currentSimd() = min(level, supported);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// simdName() - Returns the name of an instruction set, for display
+//=================================================================================================
+const char* Mmio::simdName(simd_t level)
+{
+    if (level == SIMD_AVX2) return "avx2";
+    if (level == SIMD_SSE2) return "sse2";
+    return "none";
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// attach() - Attaches to a BAR of a PCI device, mapping it if it isn't already mapped
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void Mmio::attach(PciDevice& device, int bar)
+{
+    base_ = device.mapBar(bar);
+    size_ = device.findBar(bar)->size;
+    bar_  = bar;
+    wc_   = device.findBar(bar)->cache == PciDevice::CACHE_WC;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// outOfBounds() - Throws the exception for an access that falls outside of the region
+//=================================================================================================
+void Mmio::outOfBounds(size_t offset, size_t length) const
+{
+    char buffer[128];
+    sprintf(buffer, "MMIO access of %zu bytes at 0x%zx is outside of a %zu byte region", length, offset, size_);
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// checkBlock() - Makes sure that a block transfer is in bounds and suitably aligned
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void Mmio::checkBlock(size_t offset, size_t length) const
+{
+    // In debug builds, make sure the transfer lies within the region
+    check(offset, length);
+
+    // Devices are only guaranteed to handle whole 32-bit words
+    if ((offset | length) & 3) throwRuntime("MMIO block transfer at 0x%zx of %zu bytes isn't 32-bit aligned", offset, length);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeBlock() - Copies a block of data to the device
+//
+// Passed: offset = the byte offset in the region to start writing at
+//         src    = the data to write
+//         length = the number of bytes to write
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void Mmio::writeBlock(size_t offset, const void* src, size_t length) const
+{
+    // Make sure the transfer is legal
+    checkBlock(offset, length);
+
+    #ifdef MMIO_TRACE
+    MmioTrace::record(bar_, offset, 4, length, MmioTrace::OP_WRITE_BLOCK);
+    #endif
+
+    // Find out which instruction set we're using and how wide its accesses are
+    simd_t level = simdLevel();
+    size_t width = vectorWidth(level);
+
+    // Get pointers to the source and destination
+    uint8_t*       d = base_ + offset;
+    const uint8_t* s = (const uint8_t*)src;
+
+    // Large writes bypass the cache
+    bool streaming = (length >= ntThreshold_);
+
+    // Write 32-bit words until the destination is aligned to the vector width
+    size_t head = min(length, (width - ((uintptr_t)d & (width - 1))) & (width - 1));
+    copyWords<uint32_t>(d, s, head / 4, true);
+    d += head; s += head; length -= head;
+
+    // Write as many full-width vectors as we can
+    size_t count = length / width;
+    switch (level)
+    {
+#ifdef MMIO_X86
+        case SIMD_AVX2: writeAvx2(d, s, count, streaming); break;
+        case SIMD_SSE2: writeSse2(d, s, count, streaming); break;
+#endif
+        default:        copyWords<uint64_t>(d, s, count, true);
+    }
+    d += count * width; s += count * width; length -= count * width;
+
+    // Write whatever is left over as 32-bit words
+    copyWords<uint32_t>(d, s, length / 4, true);
+
+    // Make sure that write-combined and non-temporal stores have been pushed out
+    storeFence();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readBlock() - Copies a block of data from the device
+//
+// Passed: offset = the byte offset in the region to start reading from
+//         dst    = where to store the data
+//         length = the number of bytes to read
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void Mmio::readBlock(size_t offset, void* dst, size_t length) const
+{
+    // Make sure the transfer is legal
+    checkBlock(offset, length);
+
+    #ifdef MMIO_TRACE
+    MmioTrace::record(bar_, offset, 4, length, MmioTrace::OP_READ_BLOCK);
+    #endif
+
+    // Find out which instruction set we're using and how wide its accesses are
+    simd_t level = simdLevel();
+    size_t width = vectorWidth(level);
+
+    // Get pointers to the source and destination
+    const uint8_t* s = base_ + offset;
+    uint8_t*       d = (uint8_t*)dst;
+
+    // Read 32-bit words until the source is aligned to the vector width
+    size_t head = min(length, (width - ((uintptr_t)s & (width - 1))) & (width - 1));
+    copyWords<uint32_t>(d, s, head / 4, false);
+    d += head; s += head; length -= head;
+
+    // Read as many full-width vectors as we can
+    size_t count = length / width;
+    switch (level)
+    {
+#ifdef MMIO_X86
+        case SIMD_AVX2: readAvx2(d, s, count); break;
+        case SIMD_SSE2: readSse2(d, s, count); break;
+#endif
+        default:        copyWords<uint64_t>(d, s, count, false);
+    }
+    d += count * width; s += count * width; length -= count * width;
+
+    // Read whatever is left over as 32-bit words
+    copyWords<uint32_t>(d, s, length / 4, false);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// fill() - Fills a range of the device with a repeating 32-bit value
+//
+// Passed: offset = the byte offset in the region to start writing at
+//         value  = the value to write to every 32-bit word
+//         length = the number of bytes to fill
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void Mmio::fill(size_t offset, uint32_t value, size_t length) const
+{
+    // Make sure the transfer is legal
+    checkBlock(offset, length);
+
+    #ifdef MMIO_TRACE
+    MmioTrace::record(bar_, offset, 4, (uint64_t)length << 32 | value, MmioTrace::OP_FILL);
+    #endif
+
+    // Find out which instruction set we're using and how wide its accesses are
+    simd_t level = simdLevel();
+    size_t width = vectorWidth(level);
+
+    // Get a pointer to the destination
+    uint8_t* d = base_ + offset;
+
+    // Large writes bypass the cache
+    bool streaming = (length >= ntThreshold_);
+
+    // Write 32-bit words until the destination is aligned to the vector width
+    for (; length && ((uintptr_t)d & (width - 1)); d += 4, length -= 4) *(volatile uint32_t*)d = value;
+
+    // Write as many full-width vectors as we can
+    size_t count = length / width;
+    switch (level)
+    {
+#ifdef MMIO_X86
+        case SIMD_AVX2: fillAvx2(d, value, count, streaming); break;
+        case SIMD_SSE2: fillSse2(d, value, count, streaming); break;
+#endif
+        default:
+            for (size_t i = 0; i < count; ++i) ((volatile uint64_t*)d)[i] = ((uint64_t)value << 32) | value;
+    }
+    d += count * width; length -= count * width;
+
+    // Write whatever is left over as 32-bit words
+    for (; length; d += 4, length -= 4) *(volatile uint32_t*)d = value;
+
+    // Make sure that write-combined and non-temporal stores have been pushed out
+    storeFence();
+}
+//=================================================================================================
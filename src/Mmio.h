@@ -0,0 +1,127 @@
+//=================================================================================================
+// Mmio.h - Defines typed access to the registers and memory of a memory-mapped PCI BAR
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include "PciDevice.h"
+#include "MmioTrace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+class Mmio
+{
+public:
+
+    // The instruction sets that the block transfers can use
+    enum simd_t {SIMD_NONE, SIMD_SSE2, SIMD_AVX2};
+
+    // Default constructor - not attached to any memory
+    Mmio() {}
+
+    // Constructor that attaches to an already mapped region of memory
+    Mmio(uint8_t* baseAddr, size_t size) {attach(baseAddr, size);}
+
+    // Constructor that attaches to a BAR of a PCI device, mapping it if it isn't already
+    Mmio(PciDevice& device, int bar) {attach(device, bar);}
+
+    // Attaches to a region of memory
+    void        attach(uint8_t* baseAddr, size_t size) {base_ = baseAddr; size_ = size; bar_ = -1; wc_ = false;}
+
+    // Attaches to a BAR of a PCI device.  Throws std::runtime_error if the BAR can't be mapped
+    void        attach(PciDevice& device, int bar);
+
+    // Reads a register of any width
+    template <class T> T read(size_t offset) const
+    {
+        check(offset, sizeof(T));
+        T value = *(volatile T*)(base_ + offset);
+        #ifdef MMIO_TRACE
+        MmioTrace::record(bar_, offset, sizeof(T), value, MmioTrace::OP_READ);
+        #endif
+        return value;
+    }
+
+    // Writes a register of any width.  On a write-combining BAR, the write is fenced so that
+    // it reaches the device promptly and in order
+    template <class T> void write(size_t offset, T value) const
+    {
+        check(offset, sizeof(T));
+        *(volatile T*)(base_ + offset) = value;
+        if (wc_) storeFence();
+        #ifdef MMIO_TRACE
+        MmioTrace::record(bar_, offset, sizeof(T), value, MmioTrace::OP_WRITE);
+        #endif
+    }
+
+    // Shorthand for the common register widths
+    uint32_t    read32 (size_t offset) const {return read<uint32_t>(offset);}
+    uint64_t    read64 (size_t offset) const {return read<uint64_t>(offset);}
+    void        write32(size_t offset, uint32_t value) const {write<uint32_t>(offset, value);}
+    void        write64(size_t offset, uint64_t value) const {write<uint64_t>(offset, value);}
+
+    // Bulk transfers.  Offset and length must be multiples of 4.  Throws std::runtime_error
+    void        writeBlock(size_t offset, const void* src, size_t length) const;
+    void        readBlock (size_t offset, void* dst, size_t length) const;
+
+    // Fills a range with a repeating 32-bit value.  Offset and length must be multiples of 4
+    void        fill(size_t offset, uint32_t value, size_t length) const;
+
+    // Writes of at least this many bytes use non-temporal stores
+    void        setStreamingThreshold(size_t bytes) {ntThreshold_ = bytes;}
+
+    // The user-space address and size of the region
+    uint8_t*    baseAddr() const {return base_;}
+    size_t      size()     const {return size_;}
+
+    // The instruction set the block transfers use.  It's detected from the CPU at startup,
+    // and can be lowered (i.e., for benchmarking) but not raised beyond what the CPU supports
+    static simd_t      simdLevel();
+    static void        setSimdLevel(simd_t level);
+    static const char* simdName(simd_t level);
+
+protected:
+
+    // Makes sure that all prior stores have been pushed out of the CPU
+    static void storeFence()
+    {
+        #if defined(__x86_64__) || defined(__i386__)
+        _mm_sfence();
+        #else
+        __sync_synchronize();
+        #endif
+    }
+
+    // In debug builds, makes sure an access lies entirely within the region
+    void        check(size_t offset, size_t length) const
+    {
+        #ifndef NDEBUG
+        if (offset > size_ || length > size_ - offset) outOfBounds(offset, length);
+        #endif
+    }
+
+    // Throws the exception for an out-of-bounds access
+    [[noreturn]] void outOfBounds(size_t offset, size_t length) const;
+
+    // Makes sure a block transfer is in bounds and suitably aligned
+    void        checkBlock(size_t offset, size_t length) const;
+
+    // The user-space address of the region
+    uint8_t*    base_ = nullptr;
+
+    // The size of the region in bytes
+    size_t      size_ = 0;
+
+    // The BAR the region belongs to, or -1 if it isn't a BAR.  Only used for tracing
+    int         bar_ = -1;
+
+    // True if the region is mapped write-combining
+    bool        wc_ = false;
+
+    // Writes at least this long are performed with non-temporal stores
+    size_t      ntThreshold_ = 64 * 1024;
+};
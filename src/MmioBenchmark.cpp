@@ -0,0 +1,328 @@
+//=================================================================================================
+// MmioBenchmark.cpp - Implements a latency and bandwidth benchmark for a memory-mapped PCI BAR
+//
+// A register read is a non-posted PCIe transaction: the CPU stalls until the completion comes
+// back, so timing individual reads measures the round-trip latency to the device.   Writes
+// are posted, so a run of writes is timed as a whole and ended with a read, which can't
+// complete until every earlier write has reached the device.
+//
+// Writing to a BAR can do anything the design behind it likes, so the benchmark is read-only
+// unless it's explicitly given a region that it may overwrite.
+//=================================================================================================
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include "MmioBenchmark.h"
+#include "Utility.h"
+using namespace std;
+
+// The clock we use for all measurements
+using Clock = chrono::steady_clock;
+
+//=================================================================================================
+// nsSince() - Returns the number of nanoseconds that have elapsed since a point in time
+//=================================================================================================
+static double nsSince(Clock::time_point start)
+{
+    return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// megabytesPerSec() - Converts a byte count and an elapsed time to megabytes per second
+//=================================================================================================
+static double megabytesPerSec(double bytes, double ns)
+{
+    return (ns > 0) ? bytes / ns * 1e9 / 1e6 : 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// measureLatency() - Measures the round-trip latency of register reads
+//=================================================================================================
+static MmioBenchmark::latency_t measureLatency(const Mmio& io, const MmioBenchmark::options_t& opts)
+{
+    MmioBenchmark::latency_t result;
+    vector<double> sample(max(opts.latencySamples, 1));
+
+    // Time each read individually
+    for (auto& ns : sample)
+    {
+        auto start = Clock::now();
+        io.read32(opts.offset);
+        ns = nsSince(start);
+    }
+
+    // Build a histogram with power-of-2 buckets
+    result.histogram.assign(32, 0);
+    for (double ns : sample)
+    {
+        int bucket = 0;
+        for (uint64_t n = (uint64_t)ns; n > 1 && bucket < 31; n >>= 1) ++bucket;
+        ++result.histogram[bucket];
+    }
+
+    // Trim empty buckets off the end of the histogram
+    while (result.histogram.size() > 1 && result.histogram.back() == 0) result.histogram.pop_back();
+
+    // Compute the statistics
+    sort(sample.begin(), sample.end());
+    double total = 0;
+    for (double ns : sample) total += ns;
+    result.samples  = sample.size();
+    result.minNs    = sample.front();
+    result.maxNs    = sample.back();
+    result.meanNs   = total / sample.size();
+    result.medianNs = sample[sample.size() / 2];
+    result.p99Ns    = sample[min(sample.size() - 1, sample.size() * 99 / 100)];
+
+    // Hand the caller the latency statistics
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// measureBlock() - Measures the bandwidth of block transfers at one access width
+//
+// Passed: io     = the region being benchmarked
+//         buffer = host memory of opts.blockBytes bytes
+//         method = "u32", "u64", "sse2" or "avx2"
+//         opts   = the benchmark settings
+//=================================================================================================
+static MmioBenchmark::bandwidth_t measureBlock(const Mmio& io, vector<uint8_t>& buffer, string method,
+                                               const MmioBenchmark::options_t& opts)
+{
+    MmioBenchmark::bandwidth_t result = {method, 4, 0, 0};
+    size_t length = buffer.size();
+    size_t base   = opts.offset;
+
+    // Select the instruction set for this access width
+    Mmio::simd_t level = Mmio::SIMD_NONE;
+    if (method == "u64" ) {level = Mmio::SIMD_NONE; result.width = 8; }
+    if (method == "sse2") {level = Mmio::SIMD_SSE2; result.width = 16;}
+    if (method == "avx2") {level = Mmio::SIMD_AVX2; result.width = 32;}
+    Mmio::setSimdLevel(level);
+
+    // If we're allowed to, time the writes.  The final read makes sure the posted writes have
+    // all landed
+    if (opts.writes)
+    {
+        auto start = Clock::now();
+        for (int i = 0; i < opts.blockRepeats; ++i)
+        {
+            if (method == "u32")
+                for (size_t offset = 0; offset < length; offset += 4) io.write32(base + offset, 0);
+            else
+                io.writeBlock(base, buffer.data(), length);
+        }
+        io.read32(base);
+        result.writeMBps = megabytesPerSec((double)length * opts.blockRepeats, nsSince(start));
+    }
+
+    // Time the reads
+    auto start = Clock::now();
+    for (int i = 0; i < opts.blockRepeats; ++i)
+    {
+        if (method == "u32")
+            for (size_t offset = 0; offset < length; offset += 4) io.read32(base + offset);
+        else
+            io.readBlock(base, buffer.data(), length);
+    }
+    result.readMBps = megabytesPerSec((double)length * opts.blockRepeats, nsSince(start));
+
+    // Hand the caller the bandwidth at this access width
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// regionLength() - Returns the number of bytes of the region that the benchmark may touch
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static size_t regionLength(const Mmio& io, const MmioBenchmark::options_t& opts)
+{
+    // The region has to start on a register inside the BAR
+    if ((opts.offset & 3) || opts.offset + 4 > io.size())
+    {
+        throwRuntime("Benchmark offset 0x%zx isn't a 32-bit register in a %zu byte region", opts.offset, io.size());
+    }
+
+    // And it can't run past the end of the BAR
+    size_t available = io.size() - opts.offset;
+    if (opts.length > available)
+    {
+        throwRuntime("Benchmark region of %zu bytes at 0x%zx runs past the end of a %zu byte region",
+                     opts.length, opts.offset, io.size());
+    }
+
+    // No length means "the rest of the BAR"
+    return opts.length ? opts.length : available;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// bytesWritten() - Returns the number of bytes at opts.offset that run() would write to, or 0 if
+//                  the benchmark is read-only
+//
+// Can throw std::runtime_error
+//=================================================================================================
+size_t MmioBenchmark::bytesWritten(const Mmio& io, const options_t& opts)
+{
+    if (!opts.writes) return 0;
+    return max(min(opts.blockBytes, regionLength(io, opts)) & ~(size_t)31, (size_t)4);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Runs the benchmark against a mapped region
+//
+// Passed: io     = the region to benchmark
+//         target = a description of the region, for the report
+//         opts   = the benchmark settings
+//
+// Only the region that starts at opts.offset is touched, and it's only written to when
+// opts.writes is true.  The caller should say what will be overwritten (see bytesWritten())
+// before calling this
+//
+// Can throw std::runtime_error
+//=================================================================================================
+MmioBenchmark::result_t MmioBenchmark::run(const Mmio& io, string target, const options_t& opts)
+{
+    result_t result;
+
+    // Find out how much of the region we may touch
+    size_t length = regionLength(io, opts);
+
+    // Describe what we're benchmarking
+    result.target     = target;
+    result.regionSize = io.size();
+    result.offset     = opts.offset;
+    result.length     = length;
+    result.writes     = opts.writes;
+
+    // Measure the round-trip latency of register reads
+    result.readLatency = measureLatency(io, opts);
+
+    // If we're allowed to, measure the rate of posted register writes
+    result.postedWritesPerSec = result.postedWriteMBps = 0;
+    if (opts.writes)
+    {
+        int  count = max(opts.postedWrites, 1);
+        auto start = Clock::now();
+        for (int i = 0; i < count; ++i) io.write32(opts.offset, i);
+        io.read32(opts.offset);
+        double ns = nsSince(start);
+        result.postedWritesPerSec = (ns > 0) ? count / ns * 1e9 : 0;
+        result.postedWriteMBps    = megabytesPerSec(4.0 * count, ns);
+    }
+
+    // The block transfers use a buffer no larger than the region
+    vector<uint8_t> buffer(min(opts.blockBytes, length) & ~(size_t)31);
+    for (size_t i = 0; i < buffer.size(); ++i) buffer[i] = i;
+
+    // Measure the block transfer bandwidth at each access width this CPU supports
+    Mmio::simd_t original = Mmio::simdLevel();
+    result.bandwidth.push_back(measureBlock(io, buffer, "u32", opts));
+    result.bandwidth.push_back(measureBlock(io, buffer, "u64", opts));
+    if (original >= Mmio::SIMD_SSE2) result.bandwidth.push_back(measureBlock(io, buffer, "sse2", opts));
+    if (original >= Mmio::SIMD_AVX2) result.bandwidth.push_back(measureBlock(io, buffer, "avx2", opts));
+    Mmio::setSimdLevel(original);
+
+    // Hand the caller the results
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// print() - Writes the result in human readable form
+//=================================================================================================
+void MmioBenchmark::print(const result_t& result, FILE* ofile)
+{
+    auto& lat = result.readLatency;
+
+    fprintf(ofile, "Benchmark of %s (%zu bytes), %zu bytes at 0x%zx, %s\n", result.target.c_str(), result.regionSize,
+            result.length, result.offset, result.writes ? "read/write" : "read-only");
+
+    // Display the read latency statistics
+    fprintf(ofile, "\nRead latency (%d samples): min %.0f  mean %.0f  median %.0f  p99 %.0f  max %.0f ns\n",
+            lat.samples, lat.minNs, lat.meanNs, lat.medianNs, lat.p99Ns, lat.maxNs);
+
+    // Display the non-empty buckets of the histogram
+    for (size_t i = 0; i < lat.histogram.size(); ++i)
+    {
+        if (lat.histogram[i] == 0) continue;
+        fprintf(ofile, "  %8llu - %8llu ns : %llu\n", 1ULL << i, (2ULL << i) - 1, (unsigned long long)lat.histogram[i]);
+    }
+
+    // Display the posted write rate
+    if (result.writes)
+        fprintf(ofile, "\nPosted writes: %.0f per second (%.1f MB/s)\n", result.postedWritesPerSec, result.postedWriteMBps);
+    else
+        fprintf(ofile, "\nPosted writes: not measured (read-only)\n");
+
+    // Display the block transfer bandwidth at each access width
+    fprintf(ofile, "\nBlock transfers:\n");
+    for (auto& bw : result.bandwidth)
+    {
+        if (result.writes)
+            fprintf(ofile, "  %-5s %2d bytes : write %9.1f MB/s   read %9.1f MB/s\n", bw.method.c_str(), bw.width, bw.writeMBps, bw.readMBps);
+        else
+            fprintf(ofile, "  %-5s %2d bytes : read %9.1f MB/s\n", bw.method.c_str(), bw.width, bw.readMBps);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// toJson() - Returns the result as a JSON object
+//=================================================================================================
+string MmioBenchmark::toJson(const result_t& result)
+{
+    char   buffer[512];
+    string json;
+    auto&  lat = result.readLatency;
+
+    // The target and the latency statistics
+    sprintf(buffer, "{\"target\": \"%s\", \"region_size\": %zu, \"offset\": %zu, \"length\": %zu, \"writes\": %s, \"read_latency_ns\": "
+                    "{\"samples\": %d, \"min\": %.1f, \"mean\": %.1f, \"median\": %.1f, \"p99\": %.1f, \"max\": %.1f, \"histogram_log2\": [",
+            result.target.c_str(), result.regionSize, result.offset, result.length, result.writes ? "true" : "false",
+            lat.samples, lat.minNs, lat.meanNs, lat.medianNs, lat.p99Ns, lat.maxNs);
+    json = buffer;
+
+    // The latency histogram
+    for (size_t i = 0; i < lat.histogram.size(); ++i)
+    {
+        json += (i ? ", " : "") + to_string(lat.histogram[i]);
+    }
+
+    // The posted write rate, which is null if writes weren't measured
+    if (result.writes)
+        sprintf(buffer, "]}, \"posted_writes\": {\"per_sec\": %.0f, \"mb_per_sec\": %.1f}, \"block\": [",
+                result.postedWritesPerSec, result.postedWriteMBps);
+    else
+        sprintf(buffer, "]}, \"posted_writes\": null, \"block\": [");
+    json += buffer;
+
+    // The block transfer bandwidth at each access width
+    for (size_t i = 0; i < result.bandwidth.size(); ++i)
+    {
+        auto& bw = result.bandwidth[i];
+        char   write[32] = "null";
+        if (result.writes) sprintf(write, "%.1f", bw.writeMBps);
+        sprintf(buffer, "%s{\"method\": \"%s\", \"width\": %d, \"write_mb_per_sec\": %s, \"read_mb_per_sec\": %.1f}",
+                i ? ", " : "", bw.method.c_str(), bw.width, write, bw.readMBps);
+        json += buffer;
+    }
+
+    // Close out the JSON object
+    return json + "]}";
+}
+//=================================================================================================
@@ -0,0 +1,72 @@
+//=================================================================================================
+// MmioBenchmark.h - Defines a latency and bandwidth benchmark for a memory-mapped PCI BAR
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Mmio.h"
+
+class MmioBenchmark
+{
+public:
+
+    // Settings that control the benchmark
+    struct options_t
+    {
+        size_t  offset         = 0;         // The start of the region the benchmark may touch.
+                                            // Latency is measured by reading the register here
+        size_t  length         = 0;         // The length of the region.  0 = to the end of the BAR
+        bool    writes         = false;     // If false, the region is only ever read
+        int     latencySamples = 10000;     // The number of timed register reads
+        int     postedWrites   = 100000;    // The number of register writes in the throughput test
+        size_t  blockBytes     = 1 << 20;   // The size of each block transfer (clamped to the BAR)
+        int     blockRepeats   = 16;        // The number of times each block transfer is repeated
+    };
+
+    // Read round-trip latency statistics, in nanoseconds
+    struct latency_t
+    {
+        int     samples;
+        double  minNs, meanNs, medianNs, p99Ns, maxNs;
+
+        // histogram[i] = the number of samples that took between 2^i and 2^(i+1) - 1 ns
+        std::vector<uint64_t> histogram;
+    };
+
+    // The bandwidth of a block transfer at one access width
+    struct bandwidth_t
+    {
+        std::string method;                 // "u32", "u64", "sse2" or "avx2"
+        int         width;                  // Bytes per access
+        double      writeMBps;              // 0 if writes weren't measured
+        double      readMBps;
+    };
+
+    // The outcome of a benchmark run
+    struct result_t
+    {
+        std::string target;                 // What was benchmarked, i.e. "0000:3b:00.0 BAR 0"
+        size_t      regionSize;             // The size of the BAR
+        size_t      offset;                 // The region that was benchmarked
+        size_t      length;
+        bool        writes;                 // False if write performance wasn't measured
+        latency_t   readLatency;            // Register read round-trip latency
+        double      postedWritesPerSec;     // Register writes per second
+        double      postedWriteMBps;        // The same, in megabytes per second
+        std::vector<bandwidth_t> bandwidth; // Block transfer bandwidth at each access width
+    };
+
+    // Runs the benchmark against a mapped region.  Throws std::runtime_error
+    static result_t run(const Mmio& io, std::string target, const options_t& opts);
+
+    // The number of bytes run() would write, or 0 if it's read-only
+    static size_t   bytesWritten(const Mmio& io, const options_t& opts);
+
+    // Writes the result in human readable form
+    static void     print(const result_t& result, FILE* ofile = stdout);
+
+    // Returns the result as a JSON object
+    static std::string toJson(const result_t& result);
+};
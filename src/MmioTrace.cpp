@@ -0,0 +1,203 @@
+//=================================================================================================
+// MmioTrace.cpp - Implements a record of every register access, kept in a ring buffer per thread
+//
+// The hot path is MmioTrace::record() in the header: a thread-local pointer, one clock read, and
+// one store into a ring that no other thread writes.   There are no locks or atomic
+// read-modify-writes; the only lock is taken once per thread, when its ring is created.   Rings
+// outlive their threads, so a dump taken after a batch of worker threads has finished still
+// shows what they did.
+//
+// The file written by dump() is a header followed by every record, merged from all threads and
+// sorted by time.
+//=================================================================================================
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include "MmioTrace.h"
+#include "Utility.h"
+using namespace std;
+
+// Identifies a trace file
+static const char MAGIC[8] = {'M', 'M', 'I', 'O', 'T', 'R', 'C', '1'};
+
+// The header at the front of a trace file
+struct header_t
+{
+    char        magic[8];
+    uint32_t    recordSize;             // sizeof(record_t), as a sanity check
+    uint32_t    threads;                // The number of threads that made accesses
+    uint64_t    count;                  // The number of records that follow
+    uint64_t    originTicks;            // The clock when the first ring was created
+    double      ticksPerNs;             // The rate at which the clock ticks
+};
+
+// The rings, and when the trace began
+thread_local MmioTrace::ring_t*          MmioTrace::ring_ = nullptr;
+vector<unique_ptr<MmioTrace::ring_t>>    MmioTrace::rings_;
+mutex                                    MmioTrace::ringsLock_;
+uint64_t                                 MmioTrace::originTicks_ = 0;
+chrono::steady_clock::time_point         MmioTrace::originTime_;
+
+//=================================================================================================
+// attachThread() - Creates a ring for the calling thread
+//
+// Returns: the new ring, which is also cached in ring_
+//=================================================================================================
+MmioTrace::ring_t* MmioTrace::attachThread()
+{
+    lock_guard<mutex> lock(ringsLock_);
+
+    // The first ring to be created marks the start of the trace
+    if (rings_.empty())
+    {
+        originTicks_ = now();
+        originTime_  = chrono::steady_clock::now();
+    }
+
+    // Create the ring and add it to the list
+    auto ring = make_unique<ring_t>();
+    ring->thread = rings_.size();
+    ring->records.resize(RING_RECORDS);
+    rings_.push_back(move(ring));
+
+    // Cache it for this thread and hand it to the caller
+    return ring_ = rings_.back().get();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// dump() - Writes the records of every thread to a binary file, oldest first
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void MmioTrace::dump(string filename)
+{
+    header_t         header;
+    vector<record_t> all;
+
+    // Tracing has to have been compiled in
+    if (!compiledIn()) throwRuntime("MMIO tracing isn't compiled in.  Build with cmake -DMMIO_TRACE=ON");
+
+    // Gather the surviving records from every ring
+    lock_guard<mutex> lock(ringsLock_);
+    for (auto& ring : rings_)
+    {
+        uint64_t head  = ring->head.load(memory_order_acquire);
+        uint64_t first = (head > RING_RECORDS) ? head - RING_RECORDS : 0;
+        for (uint64_t i = first; i < head; ++i) all.push_back(ring->records[i % RING_RECORDS]);
+    }
+
+    // Put them in the order they happened
+    stable_sort(all.begin(), all.end(), [](const record_t& a, const record_t& b) {return a.ticks < b.ticks;});
+
+    // Work out how fast the clock ticks from how far it has moved since the trace began
+    double elapsedNs = chrono::duration<double, nano>(chrono::steady_clock::now() - originTime_).count();
+    double ticksPerNs = rings_.empty() || elapsedNs <= 0 ? 1.0 : (now() - originTicks_) / elapsedNs;
+
+    // Fill in the header
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.recordSize  = sizeof(record_t);
+    header.threads     = rings_.size();
+    header.count       = all.size();
+    header.originTicks = originTicks_;
+    header.ticksPerNs  = ticksPerNs;
+
+    // Write the header and the records
+    FILE* ofile = fopen(c(filename), "wb");
+    if (ofile == nullptr) throwRuntime("Can't create %s", c(filename));
+    bool ok = fwrite(&header, sizeof(header), 1, ofile) == 1;
+    if (ok && !all.empty()) ok = fwrite(all.data(), sizeof(record_t), all.size(), ofile) == all.size();
+    if (fclose(ofile) != 0) ok = false;
+
+    // Complain if we couldn't write it
+    if (!ok) throwRuntime("Can't write %s", c(filename));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// opName() - Returns a printable name for an access
+//=================================================================================================
+static string opName(const MmioTrace::record_t& r)
+{
+    switch (r.op)
+    {
+        case MmioTrace::OP_READ:        return "read"  + to_string(r.width * 8);
+        case MmioTrace::OP_WRITE:       return "write" + to_string(r.width * 8);
+        case MmioTrace::OP_READ_BLOCK:  return "readblock";
+        case MmioTrace::OP_WRITE_BLOCK: return "writeblock";
+        case MmioTrace::OP_FILL:        return "fill";
+        case MmioTrace::OP_POLL:        return "poll";
+    }
+    return "op" + to_string(r.op);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// decode() - Reads a file written by dump(), and prints it as text
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void MmioTrace::decode(string filename)
+{
+    header_t header;
+    record_t r;
+    char     bar[8];
+
+    // Open the file
+    FILE* ifile = fopen(c(filename), "rb");
+    if (ifile == nullptr) throwRuntime("Can't open %s", c(filename));
+
+    // Make sure it's a trace file that we understand
+    if (fread(&header, sizeof(header), 1, ifile) != 1 || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        fclose(ifile);
+        throwRuntime("%s isn't an MMIO trace file", c(filename));
+    }
+    if (header.recordSize != sizeof(record_t))
+    {
+        fclose(ifile);
+        throwRuntime("%s has %u-byte records, expected %zu", c(filename), header.recordSize, sizeof(record_t));
+    }
+
+    // Print the summary and the column headings
+    printf("%s: %llu accesses by %u thread%s\n", c(filename), (unsigned long long)header.count,
+           header.threads, header.threads == 1 ? "" : "s");
+    printf("%14s  %3s  %3s  %-10s  %-10s  %s\n", "time (us)", "thr", "bar", "access", "offset", "value");
+
+    // Print each record
+    for (uint64_t i = 0; i < header.count; ++i)
+    {
+        if (fread(&r, sizeof(r), 1, ifile) != 1)
+        {
+            fclose(ifile);
+            throwRuntime("%s is truncated after %llu records", c(filename), (unsigned long long)i);
+        }
+
+        // Times are relative to the start of the trace
+        double us = ((int64_t)(r.ticks - header.originTicks)) / header.ticksPerNs / 1000.0;
+
+        // Memory that isn't a BAR is shown as "-"
+        if (r.bar < 0) strcpy(bar, "-"); else sprintf(bar, "%d", r.bar);
+
+        // Print the columns that every access has
+        printf("%14.3f  %3u  %3s  %-10s  0x%08llX  ", us, r.thread, bar, c(opName(r)), (unsigned long long)r.offset);
+
+        // And the value, which means something different for each kind of access
+        if (r.op == OP_READ_BLOCK || r.op == OP_WRITE_BLOCK)
+            printf("%llu bytes\n", (unsigned long long)r.value);
+        else if (r.op == OP_FILL)
+            printf("0x%08X x %llu bytes\n", (uint32_t)r.value, (unsigned long long)(r.value >> 32));
+        else if (r.width == 8)
+            printf("0x%016llX\n", (unsigned long long)r.value);
+        else
+            printf("0x%0*llX\n", r.width * 2, (unsigned long long)r.value);
+    }
+
+    // We're done with the file
+    fclose(ifile);
+}
+//=================================================================================================
@@ -0,0 +1,119 @@
+//=================================================================================================
+// MmioTrace.h - Defines a record of every register access, kept in a ring buffer per thread
+//
+// Tracing is compiled in only when MMIO_TRACE is defined (cmake -DMMIO_TRACE=ON).   Otherwise
+// record() doesn't exist, and the accessors that call it compile to exactly what they were.
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef MMIO_TRACE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+class MmioTrace
+{
+public:
+
+    // The kinds of access that are recorded
+    enum op_t : uint8_t
+    {
+        OP_READ,                        // A register read.   "value" is the value read
+        OP_WRITE,                       // A register write.  "value" is the value written
+        OP_READ_BLOCK,                  // A block read.      "value" is the length in bytes
+        OP_WRITE_BLOCK,                 // A block write.     "value" is the length in bytes
+        OP_FILL,                        // A fill.  "value" is the length << 32 | the fill pattern
+        OP_POLL                         // A waitFor().  "value" is the last value read
+    };
+
+    // One recorded access
+    struct record_t
+    {
+        uint64_t    ticks;              // When the access happened, in clock ticks
+        uint64_t    value;              // Depends on "op"
+        uint64_t    offset;             // The byte offset within the BAR
+        uint32_t    thread;             // The order in which the thread first made an access
+        int8_t      bar;                // The BAR number, or -1 for memory that isn't a BAR
+        uint8_t     op;                 // An op_t
+        uint8_t     width;              // The width of the access in bytes
+        uint8_t     reserved;           // Always 0
+    };
+
+    // The number of records each thread keeps.  Older ones are overwritten
+    static const size_t RING_RECORDS = 65536;
+
+    // True if tracing was compiled in
+    static constexpr bool compiledIn()
+    {
+        #ifdef MMIO_TRACE
+        return true;
+        #else
+        return false;
+        #endif
+    }
+
+    #ifdef MMIO_TRACE
+    // Records an access in the calling thread's ring
+    static void record(int bar, size_t offset, int width, uint64_t value, op_t op)
+    {
+        ring_t*  ring = ring_ ? ring_ : attachThread();
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        ring->records[head % RING_RECORDS] = {now(), value, offset, ring->thread, (int8_t)bar, op, (uint8_t)width, 0};
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+    #endif
+
+    // Writes the records of every thread to a binary file, oldest first.  Threads should be idle
+    // while this runs.  Throws std::runtime_error
+    static void dump(std::string filename);
+
+    // Reads a file written by dump(), and prints it as text.  Throws std::runtime_error
+    static void decode(std::string filename);
+
+protected:
+
+    // One thread's ring of records.  Only the owning thread writes to it
+    struct ring_t
+    {
+        std::atomic<uint64_t>   head{0};    // The total number of records ever written
+        uint32_t                thread;     // The thread number stamped on each record
+        std::vector<record_t>   records;
+    };
+
+    // Reads the clock.  On x86, it's the time-stamp counter
+    static uint64_t now()
+    {
+        #ifdef MMIO_TRACE
+        #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+        #else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+        #endif
+        #else
+        return 0;
+        #endif
+    }
+
+    // Creates a ring for the calling thread
+    static ring_t* attachThread();
+
+    // The calling thread's ring, or nullptr if it hasn't made an access yet
+    static thread_local ring_t* ring_;
+
+    // Every ring that has been created, and the lock that protects the list
+    static std::vector<std::unique_ptr<ring_t>> rings_;
+    static std::mutex                           ringsLock_;
+
+    // The clock and the time when the first ring was created
+    static uint64_t                             originTicks_;
+    static std::chrono::steady_clock::time_point originTime_;
+};
@@ -0,0 +1,330 @@
+//=================================================================================================
+// PciBus.cpp - Implements a native (sysfs based) enumerator of the devices on the PCI bus
+//
+// The kernel exposes one entry per PCI function in /sys/bus/pci/devices.  Each entry is a
+// symlink into the device hierarchy (i.e., /sys/devices/pci0000:00/0000:00:03.0/0000:3b:00.0),
+// so the parent directory of the link target is the upstream bridge.   A fake tree with the
+// same layout can be substituted for testing by passing a different root directory.
+//=================================================================================================
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "PciBus.h"
+#include "PciConfig.h"
+using namespace std;
+
+// A convenient shortcut to std::filesystem
+namespace fs = std::filesystem;
+
+//=================================================================================================
+// getIntegerFromFile() - Opens the specified file, reads the first line, expects to find an
+//                        integer encoded as an ASCII string, and returns the value of that string
+//=================================================================================================
+static int getIntegerFromFile(string filename)
+{
+    string line;
+
+    // Open the specified file.  It will contain a line of ASCII data
+    ifstream file(filename);
+
+    // If we couldn't open the file, hand the caller an invalid value
+    if (!file.is_open()) return -1;
+
+    // Fetch the first line of the file
+    getline(file, line);
+
+    // And hand the caller that line, decoded as an integer
+    return strtol(line.c_str(), nullptr, 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isBDF() - Returns true if the string looks like a PCI "Domain:Bus:Device.Function"
+//=================================================================================================
+static bool isBDF(const string& s)
+{
+    unsigned domain, bus, device, function;
+    char     extra;
+    return sscanf(s.c_str(), "%x:%x:%x.%x%c", &domain, &bus, &device, &function, &extra) == 4;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Constructor - Saves the name of the directory where device entries are found
+//=================================================================================================
+PciBus::PciBus(string sysfsRoot)
+{
+    root_ = sysfsRoot.empty() ? "/sys/bus/pci/devices" : sysfsRoot;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// busDir() - Returns the name of the directory that contains the bus-wide "rescan" file
+//=================================================================================================
+string PciBus::busDir()
+{
+    return fs::path(root_).parent_path().string();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// parseDeviceID() - Splits a "vendorID:deviceID" string into its two parts
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void PciBus::parseDeviceID(string vendorDevice, int* pVendorID, int* pDeviceID)
+{
+    // Get a const char* to the name of the device
+    const char* device = vendorDevice.c_str();
+
+    // Extract the Vendor ID from the device string
+    *pVendorID = strtoul(device, nullptr, 16);
+
+    // Extract the Device ID from the device string
+    const char* p = strchr(device, ':');
+    if (p == nullptr) throw runtime_error("Malformed device ID " + vendorDevice);
+    *pDeviceID = strtoul(p+1, nullptr, 16);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// scan() - Reads the list of devices from sysfs and builds the vendor:device index
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void PciBus::scan()
+{
+    error_code ec;
+
+    // Throw away the results of any previous scan
+    devices_.clear();
+    index_.clear();
+
+    // Make sure the device directory exists
+    if (!fs::is_directory(root_, ec)) throw runtime_error("Can't find " + root_);
+
+    // Loop through the entry for each device in the device directory...
+    for (auto const& entry : fs::directory_iterator(root_, ec))
+    {
+        device_t device;
+
+        // The name of each entry is the BDF of the device
+        device.bdf = entry.path().filename().string();
+        device.dir = entry.path().string();
+
+        // Ignore anything that isn't a device
+        if (!isBDF(device.bdf) || !fs::is_directory(entry.path(), ec)) continue;
+
+        // Fetch the vendor ID and device ID of this device
+        device.vendorID = getIntegerFromFile(device.dir + "/vendor");
+        device.deviceID = getIntegerFromFile(device.dir + "/device");
+
+        // Fetch the NUMA node the device is attached to.  The file is absent on non-NUMA kernels
+        device.numaNode = getIntegerFromFile(device.dir + "/numa_node");
+
+        // The device's parent in the device hierarchy is the bridge it's attached to
+        string parent = fs::canonical(entry.path(), ec).parent_path().filename().string();
+        if (!ec && isBDF(parent)) device.port = parent;
+
+        // Add this device to our list
+        devices_.push_back(device);
+    }
+
+    // Keep the devices in BDF order so that enumeration order is predictable
+    sort(devices_.begin(), devices_.end(), [](const device_t& a, const device_t& b) {return a.bdf < b.bdf;});
+
+    // Build the vendor:device index
+    for (size_t i = 0; i < devices_.size(); ++i)
+    {
+        uint32_t key = ((uint32_t)devices_[i].vendorID << 16) | (devices_[i].deviceID & 0xFFFF);
+        index_.insert({key, i});
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// find() - Returns every device that matches the specified vendorID and deviceID
+//=================================================================================================
+vector<PciBus::device_t> PciBus::find(int vendorID, int deviceID)
+{
+    vector<device_t> result;
+
+    // Look up the devices in the index
+    uint32_t key = ((uint32_t)vendorID << 16) | (deviceID & 0xFFFF);
+    auto range = index_.equal_range(key);
+
+    // Collect the matching devices.  The index preserves insertion (i.e., BDF) order
+    for (auto it = range.first; it != range.second; ++it) result.push_back(devices_[it->second]);
+
+    // Hand the caller the matching devices
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// find() - Returns every device that matches the specified "vendorID:deviceID" string
+//
+// Can throw std::runtime_error
+//=================================================================================================
+vector<PciBus::device_t> PciBus::find(string vendorDevice)
+{
+    int vendorID, deviceID;
+    parseDeviceID(vendorDevice, &vendorID, &deviceID);
+    return find(vendorID, deviceID);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findBDF() - Returns the device with the specified BDF, or nullptr if there isn't one
+//=================================================================================================
+const PciBus::device_t* PciBus::findBDF(string bdf)
+{
+    for (auto& device : devices_) if (device.bdf == bdf) return &device;
+    return nullptr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readSerial() - Returns the Device Serial Number of a device, or "" if it doesn't have one
+//
+// The serial number is formatted the way "lspci -vv" displays it, most significant byte first
+//=================================================================================================
+string PciBus::readSerial(string deviceDir)
+{
+    char serial[32];
+
+    try
+    {
+        // Find the Device Serial Number capability
+        PciConfig config(deviceDir);
+        int cap = config.findExtCapability(PciConfig::EXT_CAP_ID_DSN);
+
+        // If the device doesn't have one, it doesn't have a serial number
+        if (cap == 0) return "";
+
+        // Fetch the 64-bit serial number
+        uint64_t value = ((uint64_t)config.read32(cap + PciConfig::DSN_SERIAL_HIGH) << 32)
+                       | config.read32(cap + PciConfig::DSN_SERIAL_LOW);
+
+        // Format it as 8 hex bytes separated by dashes
+        char* p = serial;
+        for (int shift = 56; shift >= 0; shift -= 8) p += sprintf(p, shift ? "%02x-" : "%02x", (int)(value >> shift) & 0xFF);
+        return serial;
+    }
+
+    // If we can't read the configuration space, we don't know the serial number
+    catch(const std::runtime_error& e)
+    {
+        return "";
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// normalizeSerial() - Strips the separators out of a serial number and makes it lower-case
+//=================================================================================================
+static string normalizeSerial(string serial)
+{
+    string result;
+    for (char ch : serial) if (isxdigit(ch)) result += tolower(ch);
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// select() - Returns the devices chosen by a device specification
+//
+// Passed: spec = "vendorID:deviceID", optionally followed by "@" and a selector.   The
+//                selector is a comma separated list of items, each of which is a BDF
+//                (i.e., "0000:3b:00.0" or "3b:00.0"), an index into the BDF-ordered list of
+//                matching devices (i.e., "2"), or a serial number.   An item made only of
+//                digits is an index if it's in range, and otherwise a serial number.   A
+//                selector of "*" selects every matching device
+//
+// Returns: the selected devices, in the order they were selected, with serial numbers
+//          filled in.   With no selector, only the first matching device is returned.
+//          If no device matches the vendorID:deviceID, the list is empty
+//
+// Can throw std::runtime_error
+//=================================================================================================
+vector<PciBus::device_t> PciBus::select(string spec)
+{
+    vector<device_t> result;
+
+    // Split the specification into its vendorID:deviceID and the selector
+    size_t at       = spec.find('@');
+    string selector = (at == string::npos) ? "" : spec.substr(at + 1);
+
+    // Find every device with that vendorID:deviceID, in BDF order
+    auto matches = find(spec.substr(0, at));
+
+    // Fill in the serial number of each of them
+    for (auto& device : matches) device.serial = readSerial(device.dir);
+
+    // With no selector, we choose the first device
+    if (selector.empty())
+    {
+        if (!matches.empty()) result.push_back(matches[0]);
+        return result;
+    }
+
+    // A selector of "*" chooses every device
+    if (selector == "*") return matches;
+
+    // Loop through each item in the comma-separated selector
+    stringstream ss(selector);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        const device_t* chosen = nullptr;
+
+        // Is this item an index into the list of matching devices?  An index too large to
+        // convert simply doesn't match anything
+        bool isIndex = !item.empty() && item.find_first_not_of("0123456789") == string::npos;
+        if (isIndex)
+        {
+            errno = 0;
+            unsigned long index = strtoul(item.c_str(), nullptr, 10);
+            if (errno == 0 && index < matches.size()) chosen = &matches[index];
+        }
+
+        // Is this item a BDF, with or without the domain?
+        string bdf = isBDF(item) ? item : "0000:" + item;
+        for (auto& device : matches) if (!isIndex && device.bdf == bdf) chosen = &device;
+
+        // Is this item a serial number?  A serial number in compact form can be all digits, so
+        // an item that isn't an index into the list of devices may still be one
+        for (auto& device : matches)
+        {
+            if (!chosen && !device.serial.empty() && normalizeSerial(device.serial) == normalizeSerial(item)) chosen = &device;
+        }
+
+        // If nothing matched this item, complain
+        if (chosen == nullptr) throw runtime_error("No " + spec.substr(0, at) + " device matches '" + item + "'");
+
+        // Add the device to the result, unless it's already been selected
+        bool duplicate = false;
+        for (auto& device : result) if (device.bdf == chosen->bdf) duplicate = true;
+        if (!duplicate) result.push_back(*chosen);
+    }
+
+    // Hand the caller the list of selected devices
+    return result;
+}
+//=================================================================================================
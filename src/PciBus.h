@@ -0,0 +1,68 @@
+//=================================================================================================
+// PciBus.h - Defines a native (sysfs based) enumerator of the devices on the PCI bus
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+class PciBus
+{
+public:
+
+    // This describes a single PCI function
+    struct device_t
+    {
+        std::string bdf;        // Domain:Bus:Device.Function, i.e. "0000:3b:00.0"
+        int         vendorID;
+        int         deviceID;
+        std::string port;       // BDF of the upstream bridge, or "" if on a root bus
+        std::string dir;        // The sysfs directory of this device
+        int         numaNode;   // The NUMA node the device is attached to, or -1 if unknown
+        std::string serial;     // Device Serial Number, i.e. "00-0a-35-ff-fe-01-02-03", or ""
+    };
+
+    // Constructor.  If sysfsRoot is empty, "/sys/bus/pci/devices" is used
+    PciBus(std::string sysfsRoot = "");
+
+    // Splits a "vendorID:deviceID" string into its two parts.  Throws on a malformed string
+    static void parseDeviceID(std::string vendorDevice, int* pVendorID, int* pDeviceID);
+
+    // Reads the list of devices from sysfs and builds the vendor:device index
+    void    scan();
+
+    // Returns the list of every device that was found by scan()
+    const std::vector<device_t>& devices() {return devices_;}
+
+    // Returns every device matching a vendorID:deviceID, in BDF order
+    std::vector<device_t> find(int vendorID, int deviceID);
+    std::vector<device_t> find(std::string vendorDevice);
+
+    // Returns the device with the specified BDF, or nullptr if there isn't one
+    const device_t* findBDF(std::string bdf);
+
+    // Returns the devices chosen by a "vendorID:deviceID[@selector]" specification, with their
+    // serial numbers filled in.  Throws std::runtime_error if a selector matches nothing
+    std::vector<device_t> select(std::string spec);
+
+    // Returns the Device Serial Number of a device, or "" if it doesn't have one
+    static std::string readSerial(std::string deviceDir);
+
+    // The directory that contains one entry per PCI device
+    std::string devicesDir() {return root_;}
+
+    // The directory that contains the bus-wide "rescan" file
+    std::string busDir();
+
+protected:
+
+    // The directory that contains one entry per PCI device
+    std::string root_;
+
+    // Every device on the bus, sorted by BDF
+    std::vector<device_t> devices_;
+
+    // Maps (vendorID << 16 | deviceID) to indices into devices_
+    std::multimap<uint32_t, size_t> index_;
+};
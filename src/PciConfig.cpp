@@ -0,0 +1,311 @@
+//=================================================================================================
+// PciConfig.cpp - Implements direct access to the configuration space of a PCI function
+//
+// The kernel exposes the configuration space of every PCI function as the file
+// /sys/bus/pci/devices/<bdf>/config.   Reading and writing it with pread()/pwrite() at the
+// register offset does exactly what "setpci" does, without the cost of a process per access.
+// Configuration space is little-endian, as are the hosts we run on.
+//=================================================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include "PciConfig.h"
+#include "Utility.h"
+using namespace std;
+
+//=================================================================================================
+// open() - Opens the configuration space of a device
+//
+// Passed: deviceDir = the sysfs directory of the device.   If this is the name of a regular
+//                     file instead, that file is used as the configuration space
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void PciConfig::open(string deviceDir)
+{
+    // If we already have a configuration space open, close it
+    close();
+
+    // Figure out the name of the configuration space file
+    filename_ = std::filesystem::is_directory(deviceDir) ? deviceDir + "/config" : deviceDir;
+
+    // Open the file for read/write.  If we're not allowed to write, settle for read-only
+    fd_ = ::open(c(filename_), O_RDWR | O_CLOEXEC);
+    if (fd_ < 0) fd_ = ::open(c(filename_), O_RDONLY | O_CLOEXEC);
+
+    // If we can't open it at all, complain
+    if (fd_ < 0) throwRuntime("Can't open %s", c(filename_));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// close() - Closes the configuration space
+//=================================================================================================
+void PciConfig::close()
+{
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readBytes() - Reads bytes from configuration space
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void PciConfig::readBytes(int offset, void* buffer, size_t length)
+{
+    if (pread(fd_, buffer, length, offset) != (ssize_t)length)
+    {
+        throwRuntime("Can't read offset 0x%X of %s", offset, c(filename_));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeBytes() - Writes bytes to configuration space
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void PciConfig::writeBytes(int offset, const void* buffer, size_t length)
+{
+    if (pwrite(fd_, buffer, length, offset) != (ssize_t)length)
+    {
+        throwRuntime("Can't write offset 0x%X of %s", offset, c(filename_));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// read8/16/32() - Read a register from configuration space
+//=================================================================================================
+uint8_t PciConfig::read8(int offset)
+{
+    uint8_t value;
+    readBytes(offset, &value, sizeof value);
+    return value;
+}
+
+uint16_t PciConfig::read16(int offset)
+{
+    uint16_t value;
+    readBytes(offset, &value, sizeof value);
+    return value;
+}
+
+uint32_t PciConfig::read32(int offset)
+{
+    uint32_t value;
+    readBytes(offset, &value, sizeof value);
+    return value;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// write8/16/32() - Write a register in configuration space
+//=================================================================================================
+void PciConfig::write8(int offset, uint8_t value)
+{
+    writeBytes(offset, &value, sizeof value);
+}
+
+void PciConfig::write16(int offset, uint16_t value)
+{
+    writeBytes(offset, &value, sizeof value);
+}
+
+void PciConfig::write32(int offset, uint32_t value)
+{
+    writeBytes(offset, &value, sizeof value);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// modify16/32() - Read-modify-write of a register in configuration space
+//
+// Passed: offset = the offset of the register
+//         value  = the new values of the bits being changed
+//         mask   = the bits that are being changed.  All other bits are left alone
+//
+// This is the equivalent of "setpci <register>=<value>:<mask>"
+//=================================================================================================
+void PciConfig::modify16(int offset, uint16_t value, uint16_t mask)
+{
+    write16(offset, (read16(offset) & ~mask) | (value & mask));
+}
+
+void PciConfig::modify32(int offset, uint32_t value, uint32_t mask)
+{
+    write32(offset, (read32(offset) & ~mask) | (value & mask));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findCapability() - Finds a capability in the standard capability list
+//
+// Passed: capID = the ID of the capability to look for (i.e., CAP_ID_PCIE)
+//
+// Returns: the offset of the capability, or 0 if the device doesn't have it
+//=================================================================================================
+int PciConfig::findCapability(int capID)
+{
+    // If the device doesn't have a capability list, it doesn't have the capability
+    if ((read16(STATUS) & STATUS_CAP_LIST) == 0) return 0;
+
+    // Fetch the offset of the first capability
+    int offset = read8(CAP_PTR) & 0xFC;
+
+    // Walk the list.  The bound on the count protects us from a malformed (circular) list
+    for (int count = 0; offset && count < 48; ++count)
+    {
+        if (read8(offset) == capID) return offset;
+        offset = read8(offset + 1) & 0xFC;
+    }
+
+    // If we get here, the device doesn't have the capability
+    return 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// findExtCapability() - Finds a capability in the PCI Express extended capability list
+//
+// Passed: capID = the ID of the extended capability to look for (i.e., EXT_CAP_ID_DSN)
+//
+// Returns: the offset of the capability, or 0 if the device doesn't have it
+//
+// The extended capability list starts at offset 0x100.   Each header holds the capability ID
+// in bits 15:0 and the offset of the next capability in bits 31:20.   The kernel only lets
+// privileged users read configuration space beyond the first 64 bytes, and only lets anyone
+// read beyond 256 bytes if the device has extended configuration space at all
+//=================================================================================================
+int PciConfig::findExtCapability(int capID)
+{
+    uint32_t header;
+    int      offset = 0x100;
+
+    // Walk the list.  The bound on the count protects us from a malformed (circular) list
+    for (int count = 0; offset >= 0x100 && count < 960; ++count)
+    {
+        // Fetch the header of this capability.  If we can't, there's no extended space
+        if (pread(fd_, &header, sizeof header, offset) != sizeof header) return 0;
+
+        // A header of all 0's or all 1's means there are no extended capabilities
+        if (header == 0 || header == 0xFFFFFFFF) return 0;
+
+        // Is this the capability we're looking for?
+        if ((int)(header & 0xFFFF) == capID) return offset;
+
+        // Move to the next capability in the list
+        offset = (header >> 20) & 0xFFC;
+    }
+
+    // If we get here, the device doesn't have the capability
+    return 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// save() - Saves the software-configured registers of the standard header and PCIe capability
+//
+// Returns: the name, location, and current value of each register
+//
+// These are the registers that a reset returns to their defaults: the command register, the
+// BARs, and the PCI Express device and link control registers, which hold tuned settings such
+// as Max Payload Size, Max Read Request Size, Relaxed Ordering, and Extended Tags
+//=================================================================================================
+PciConfig::snapshot_t PciConfig::save()
+{
+    snapshot_t result;
+
+    // This reads a register and adds it to the snapshot
+    auto add = [&](string name, int offset, int width, bool isBar)
+    {
+        uint32_t value = (width == 1) ? read8(offset) : (width == 2) ? read16(offset) : read32(offset);
+        result.push_back({name, offset, width, value, isBar});
+    };
+
+    // The standard header
+    add("CACHE_LINE_SIZE", CACHE_LINE_SIZE, 1, false);
+    add("LATENCY_TIMER",   LATENCY_TIMER,   1, false);
+    for (int bar = 0; bar < 6; ++bar) add("BAR" + to_string(bar), BAR0 + bar * 4, 4, true);
+    add("ROM_ADDRESS",     ROM_ADDRESS,     4, true);
+    add("INTERRUPT_LINE",  INTERRUPT_LINE,  1, false);
+
+    // The PCI Express capability, if there is one
+    int cap = findCapability(CAP_ID_PCIE);
+    if (cap)
+    {
+        add("DEVCTL",  cap + PCIE_DEVICE_CONTROL,  2, false);
+        add("LNKCTL",  cap + PCIE_LINK_CONTROL,    2, false);
+        add("DEVCTL2", cap + PCIE_DEVICE_CONTROL2, 2, false);
+        add("LNKCTL2", cap + PCIE_LINK_CONTROL2,   2, false);
+    }
+
+    // The command register goes last, so that it's restored last
+    add("COMMAND", COMMAND, 2, false);
+
+    // Hand the caller the snapshot
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// restore() - Writes back the registers of a snapshot
+//
+// Passed: snapshot    = the snapshot taken by save()
+//         includeBars = true to restore the BARs.  That's only correct if the kernel hasn't
+//                       assigned them itself (i.e., the device wasn't removed and rescanned)
+//
+// The registers are written in the order they were saved, so the command register (which
+// enables decoding of the BARs) is written last
+//=================================================================================================
+void PciConfig::restore(const snapshot_t& snapshot, bool includeBars)
+{
+    for (auto& reg : snapshot)
+    {
+        if (reg.isBar && !includeBars) continue;
+        if (reg.width == 1) write8 (reg.offset, reg.value);
+        if (reg.width == 2) write16(reg.offset, reg.value);
+        if (reg.width == 4) write32(reg.offset, reg.value);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// diff() - Describes each register whose value differs between two snapshots
+//
+// Returns: one string per changed register, i.e. "DEVCTL 0x2930 -> 0x2810"
+//=================================================================================================
+vector<string> PciConfig::diff(const snapshot_t& before, const snapshot_t& after)
+{
+    vector<string> result;
+    char           line[128];
+
+    // Compare each register in the first snapshot with the same register in the second
+    for (auto& old : before)
+    {
+        for (auto& now : after)
+        {
+            if (now.offset != old.offset || now.value == old.value) continue;
+            sprintf(line, "%s 0x%0*X -> 0x%0*X", c(old.name), old.width * 2, old.value, now.width * 2, now.value);
+            result.push_back(line);
+        }
+    }
+
+    return result;
+}
+//=================================================================================================
@@ -0,0 +1,158 @@
+//=================================================================================================
+// PciConfig.h - Defines direct access to the configuration space of a PCI function
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class PciConfig
+{
+public:
+
+    // Offsets of the registers in the standard configuration header
+    enum
+    {
+        VENDOR_ID      = 0x00,
+        DEVICE_ID      = 0x02,
+        COMMAND        = 0x04,
+        STATUS         = 0x06,
+        CACHE_LINE_SIZE= 0x0C,
+        LATENCY_TIMER  = 0x0D,
+        HEADER_TYPE    = 0x0E,
+        BAR0           = 0x10,
+        ROM_ADDRESS    = 0x30,
+        CAP_PTR        = 0x34,
+        INTERRUPT_LINE = 0x3C,
+        BRIDGE_CONTROL = 0x3E
+    };
+
+    // Bits in the COMMAND register
+    enum
+    {
+        COMMAND_IO     = 0x0001,
+        COMMAND_MEMORY = 0x0002,
+        COMMAND_MASTER = 0x0004,
+        COMMAND_SERR   = 0x0100
+    };
+
+    // Bits in the STATUS register
+    enum
+    {
+        STATUS_CAP_LIST = 0x0010
+    };
+
+    // Bits in the BRIDGE_CONTROL register
+    enum
+    {
+        BRIDGE_CONTROL_BUS_RESET = 0x0040
+    };
+
+    // Capability IDs
+    enum
+    {
+        CAP_ID_PCIE = 0x10
+    };
+
+    // Extended capability IDs, and the offsets of registers within them
+    enum
+    {
+        EXT_CAP_ID_DSN  = 0x0003,   // Device Serial Number
+        DSN_SERIAL_LOW  = 0x04,
+        DSN_SERIAL_HIGH = 0x08
+    };
+
+    // Offsets of registers within the PCI Express capability
+    enum
+    {
+        PCIE_DEVICE_CAP      = 0x04,
+        PCIE_DEVICE_CONTROL  = 0x08,
+        PCIE_LINK_CAP        = 0x0C,
+        PCIE_LINK_CONTROL    = 0x10,
+        PCIE_LINK_STATUS     = 0x12,
+        PCIE_DEVICE_CONTROL2 = 0x28,
+        PCIE_LINK_CONTROL2   = 0x30
+    };
+
+    // Bits in the PCI Express Link Capabilities, Link Control and Link Status registers
+    enum
+    {
+        LINK_CAP_DLLLA_CAPABLE = 0x00100000,
+        LINK_CONTROL_RETRAIN   = 0x0020,
+        LINK_STATUS_TRAINING   = 0x0800,
+        LINK_STATUS_DLLLA      = 0x2000
+    };
+
+    // One saved register of a configuration-space snapshot
+    struct register_t
+    {
+        std::string name;       // i.e., "COMMAND" or "DEVCTL"
+        int         offset;
+        int         width;      // 1, 2 or 4 bytes
+        uint32_t    value;
+        bool        isBar;      // True for BARs and the expansion ROM address
+    };
+
+    // A snapshot of the registers that software configures
+    typedef std::vector<register_t> snapshot_t;
+
+    // Default constructor
+    PciConfig() {};
+
+    // Constructor that opens the configuration space of a device
+    PciConfig(std::string deviceDir) {open(deviceDir);}
+
+    // Destructor
+    ~PciConfig() {close();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    PciConfig (const PciConfig&) = delete;
+    PciConfig& operator= (const PciConfig&) = delete;
+
+    // Opens "<deviceDir>/config".  deviceDir may also be the name of a regular file
+    void     open(std::string deviceDir);
+
+    // Closes the configuration space
+    void     close();
+
+    // Read registers of various widths
+    uint8_t  read8 (int offset);
+    uint16_t read16(int offset);
+    uint32_t read32(int offset);
+
+    // Write registers of various widths
+    void     write8 (int offset, uint8_t  value);
+    void     write16(int offset, uint16_t value);
+    void     write32(int offset, uint32_t value);
+
+    // Read-modify-write: only the bits that are set in "mask" are changed to those in "value"
+    void     modify16(int offset, uint16_t value, uint16_t mask);
+    void     modify32(int offset, uint32_t value, uint32_t mask);
+
+    // Returns the offset of a capability in the capability list, or 0 if it isn't present
+    int      findCapability(int capID);
+
+    // Returns the offset of a capability in the extended capability list, or 0 if it isn't present
+    int      findExtCapability(int capID);
+
+    // Saves the software-configured registers of the standard header and PCIe capability
+    snapshot_t save();
+
+    // Writes back the registers of a snapshot.  The COMMAND register is written last
+    void     restore(const snapshot_t& snapshot, bool includeBars);
+
+    // Describes each register whose value differs between two snapshots of the same device
+    static std::vector<std::string> diff(const snapshot_t& before, const snapshot_t& after);
+
+protected:
+
+    // Reads or writes bytes of configuration space.  Throws on a short transfer
+    void     readBytes (int offset, void* buffer, size_t length);
+    void     writeBytes(int offset, const void* buffer, size_t length);
+
+    // The name of the configuration space file, for error messages
+    std::string filename_;
+
+    // The file descriptor of the configuration space file
+    int      fd_ = -1;
+};
@@ -5,14 +5,32 @@
 #include <string>
 #include <filesystem>
 #include <fstream>
-#include <stdarg.h>
+#include <chrono>
+#include <algorithm>
+#include <thread>
 #include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #include "PciDevice.h"
+#include "PciBus.h"
+#include "PciConfig.h"
+#include "MmioTrace.h"
+#include "Utility.h"
 using namespace std;
 
-#define c(s) s.c_str()
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpuRelax() _mm_pause()
+#elif defined(__aarch64__)
+#define cpuRelax() asm volatile("yield")
+#else
+#define cpuRelax() asm volatile("" ::: "memory")
+#endif
 
 // A convenient shortcut to std::filesystem
 namespace fs = std::filesystem;
@@ -52,106 +70,212 @@ public:
 
 
 //=================================================================================================
-// throwRuntime() - Throws a runtime exception
+// parseCachePolicy() - Converts "uc", "wc" or "auto" to a cache policy
+//
+// Can throw std::runtime_error
 //=================================================================================================
-static void throwRuntime(const char* fmt, ...)
+PciDevice::cache_t PciDevice::parseCachePolicy(string s)
 {
-    char buffer[1024];
-    va_list ap;
-    va_start(ap, fmt);
-    vsprintf(buffer, fmt, ap);
-    va_end(ap);
+    if (s == "uc"  ) return CACHE_UC;
+    if (s == "wc"  ) return CACHE_WC;
+    if (s == "auto") return CACHE_AUTO;
+    throwRuntime("Unknown cache policy '%s'", c(s));
+    return CACHE_UC;
+}
+//=================================================================================================
 
-    throw runtime_error(buffer);
+
+//=================================================================================================
+// parseResetMethod() - Converts "flr", "bus" or "manual" to a reset method
+//
+// Can throw std::runtime_error
+//=================================================================================================
+PciDevice::resetmethod_t PciDevice::parseResetMethod(string s)
+{
+    if (s == "flr"   ) return RESET_FLR;
+    if (s == "bus"   ) return RESET_BUS;
+    if (s == "manual") return RESET_MANUAL;
+    throwRuntime("Unknown reset method '%s'", c(s));
+    return RESET_MANUAL;
 }
 //=================================================================================================
 
 
 //=================================================================================================
-// run() - Runs a shell command and returns it's output as a vector of lines
+// resetMethodName() - Returns the name of a reset method, as the kernel spells it
 //=================================================================================================
-static vector<string> run(const char* fmt, ...)
+static string resetMethodName(PciDevice::resetmethod_t method)
 {
-    char command[1024];
-    char buffer[1024];
-    vector<string> result;
+    if (method == PciDevice::RESET_FLR) return "flr";
+    if (method == PciDevice::RESET_BUS) return "bus";
+    return "manual";
+}
+//=================================================================================================
 
-    // Format the caller's command into 'cmd'
-    va_list ap;
-    va_start(ap, fmt);
-    vsprintf(command, fmt, ap);
-    va_end(ap);
 
-    // Open the lpsci command as a process
-    FILE* fp = popen(command, "r");
+//=================================================================================================
+// parseCpuList() - Converts a kernel CPU list (i.e., "0-7,16-23") to a list of CPU numbers
+//
+// Can throw std::runtime_error
+//=================================================================================================
+vector<int> PciDevice::parseCpuList(string s)
+{
+    vector<int> cpus;
+    size_t      pos = 0;
 
-    // If we couldn't do that, give up
-    if (fp == nullptr) throwRuntime("Can't run '%s'", command);
+    // Ignore the trailing newline that sysfs files have
+    while (!s.empty() && isspace(s.back())) s.pop_back();
 
-    // Fetch each line of the output
-    while (fgets(buffer, sizeof buffer, fp))
+    // Loop through each comma-separated item
+    while (pos < s.size())
     {
-        // Chop the linefeed off the end
-        char* p = strchr(buffer, 10); if (p) *p = 0;
+        size_t comma = s.find(',', pos);
+        if (comma == string::npos) comma = s.size();
+        string item = s.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        // Each item is either a single CPU or a range of CPUs
+        int first, last;
+        char extra;
+        if (sscanf(item.c_str(), "%d-%d%c", &first, &last, &extra) == 2 && first <= last)
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        else if (sscanf(item.c_str(), "%d%c", &first, &extra) == 1)
+            cpus.push_back(first);
+        else
+            throwRuntime("Malformed CPU list '%s'", c(s));
+    }
 
-        // Append this line to our result
-        result.push_back(buffer);
+    // Hand the caller the list of CPUs
+    return cpus;
+}
+//=================================================================================================
 
-    }
 
-    // We're done with the program, close it's stdout
-    fclose(fp);
+//=================================================================================================
+// reserveAligned() - Reserves a range of virtual address space at a given alignment
+//
+// Passed: size      = the number of bytes to reserve
+//         alignment = the required alignment (a power of 2)
+//
+// Returns: the aligned address of the reservation, or nullptr on failure
+//
+// This over-allocates an inaccessible region, then gives back the parts before and after
+// the aligned range.  The caller maps over the reservation with MAP_FIXED
+//=================================================================================================
+static void* reserveAligned(size_t size, size_t alignment)
+{
+    // Reserve enough address space that an aligned range of "size" bytes must fit in it
+    size_t length = size + alignment;
+    void*  ptr = ::mmap(0, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) return nullptr;
+
+    // Find the aligned address within the reservation
+    uintptr_t start   = (uintptr_t)ptr;
+    uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
 
-    // Return a vector of string (one per line of output) to the caller
-    return result;
+    // Give back the space before and after the aligned range
+    if (aligned > start) munmap(ptr, aligned - start);
+    if (start + length > aligned + size) munmap((void*)(aligned + size), start + length - aligned - size);
+
+    // Hand the caller the aligned range
+    return (void*)aligned;
 }
 //=================================================================================================
 
 
 //=================================================================================================
-// getBDF() - Converts a <vendorID:deviceID> into a PCI BDF
+// mapResource() - Maps a single memory-mappable resource into user-space
+//
+// Passed:   bar = the resource to map.  On exit, "baseAddr" and "cache" are filled in
+//
+// On Entry: mapOpts_ = the mapping method and the cache policy of each BAR
+//
+// Mapping through /dev/mem always results in an uncached mapping, and requires that the
+// kernel allows access to /dev/mem at all.   Mapping through the sysfs "resourceN" file
+// is uncached, and mapping through "resourceN_wc" (which the kernel only provides for
+// prefetchable BARs) is write-combining.
+//
+// Can throw std::runtime_error
 //=================================================================================================
-static string getBDF(string device)
+void PciDevice::mapResource(resource_t& bar)
 {
-    char command[64];
-    char buffer[256];
-    string retval = "0000:";
+    const char* devmem = "/dev/mem";
+    const auto& opts   = mapOpts_;
+    FileDes     fd;
+    off_t       offset;
+    string      filename;
+    void*       hint = nullptr;
+    int         flags = MAP_SHARED;
 
-    // Build the command "lspci -d {device}"
-    sprintf(command, "lspci -d %s", device.c_str());
+    // These are the memory protection flags we'll use when mapping the device into memory
+    const int protection = PROT_READ | PROT_WRITE;
 
-    // Open the lpsci command as a process
-    FILE* fp = popen(command, "r");
+    // Find out which cache policy the caller wants for this BAR
+    cache_t cache = (bar.bar < (int)opts.cache.size()) ? opts.cache[bar.bar] : CACHE_UC;
 
-    // If we couldn't do that, give up
-    if (fp == nullptr) return "";
+    // "Automatic" means write-combining wherever that's allowed
+    if (cache == CACHE_AUTO) cache = (bar.prefetchable && opts.method == MAP_SYSFS) ? CACHE_WC : CACHE_UC;
 
-    // Fetch the first line of the output
-    if (!fgets(buffer, sizeof buffer, fp))
+    // Write-combining is only possible on a prefetchable BAR mapped via sysfs
+    if (cache == CACHE_WC && !bar.prefetchable)
     {
-        fclose(fp);
-        return "";
+        throwRuntime("BAR %d isn't prefetchable and can't be write-combined", bar.bar);
+    }
+    if (cache == CACHE_WC && opts.method == MAP_DEVMEM)
+    {
+        throwRuntime("BAR %d can't be write-combined when mapped through %s", bar.bar, devmem);
     }
 
-    // Find the first space in the line
-    char* p = strchr(buffer, ' ');
-    if (p == nullptr)
+    // If we're mapping through /dev/mem, the offset into it is the physical address
+    if (opts.method == MAP_DEVMEM)
     {
-        fclose(fp);
-        return "";
+        filename = devmem;
+        fd       = ::open(devmem, O_RDWR | O_SYNC | O_CLOEXEC);
+        offset   = bar.physAddr;
     }
 
-    // Terminate the string at the first space. 
-    *p = 0;
+    // Otherwise, we map the sysfs file that represents this BAR
+    else
+    {
+        filename = deviceDir_ + "/resource" + to_string(bar.bar) + (cache == CACHE_WC ? "_wc" : "");
+        fd       = ::open(c(filename), O_RDWR | O_CLOEXEC);
+        offset   = 0;
+    }
+
+    // If that open failed, we're done here
+    if (fd < 0) throwRuntime("Can't open %s", c(filename));
+
+    // If the caller wants the page tables built now rather than on first touch, ask for that
+    if (opts.populate) flags |= MAP_POPULATE;
+
+    // If the caller wants huge-page alignment, reserve a suitably aligned range to map into
+    if (opts.hugeAlign)
+    {
+        size_t alignment = (bar.size >= (1UL << 30)) ? (1UL << 30) : (bar.size >= (1UL << 21)) ? (1UL << 21) : 0;
+        if (alignment) hint = reserveAligned(bar.size, alignment);
+        if (hint) flags |= MAP_FIXED;
+    }
+
+    // Map the resources of this PCI device's BAR into our user-space memory map
+    void* ptr = ::mmap(hint, bar.size, protection, flags, fd, offset);
+
+    // If a mapping error occurs, complain
+    if (ptr == MAP_FAILED) 
+    {
+        if (hint) munmap(hint, bar.size);
+        throwRuntime("mmap failed on BAR %d (0x%lx) for size 0x%lx", bar.bar, bar.physAddr, bar.size);
+    }
     
-    // The PCI BDF of the device is the first token in the buffer
-    return retval + buffer;
+    // Otherwise, save the user-space address that our PCI resource is mapped to
+    bar.baseAddr = (uint8_t*)ptr;
+    bar.cache    = cache;
+
+    // Keep track of how many mappings we've created
+    ++mapCount_;
 }
 //=================================================================================================
 
 
-
-
 //=================================================================================================
 // mapResources() - Maps each memory-mappable resource for this device into user-space
 //
@@ -161,60 +285,154 @@ static string getBDF(string device)
 //=================================================================================================
 void PciDevice::mapResources()
 {
-    const char* filename = "/dev/mem";
-
-    // These are the memory protection flags we'll use when mapping the device into memory
-    const int protection = PROT_READ | PROT_WRITE;
-
-    // Open the /dev/mem device
-    FileDes fd = ::open(filename, O_RDWR| O_SYNC);
-
-    // If that open failed, we're done here
-    if (fd < 0)
-    {
-        close();
-        throwRuntime("Can't open %s", filename);
-    }
-
     // Loop through each entry in the list of memory-mappable resources for this PCI device
     for (auto& bar : resource_)
     {
-        // Map the resources of this PCI device's BAR into our user-space memory map
-        void* ptr = ::mmap(0, bar.size, protection, MAP_SHARED, fd, bar.physAddr);
+        try
+        {
+            if (bar.baseAddr == nullptr) mapResource(bar);
+        }
 
         // If a mapping error occurs, don't continue trying to map resources
-        if (ptr == MAP_FAILED) 
+        catch(const std::runtime_error& e)
         {
             close();
-            throwRuntime("mmap failed on 0x%lx for size 0x%lx", bar.physAddr, bar.size);
+            throw;
         }
-        
-        // Otherwise, save the user-space address that our PCI resource is mapped to
-        bar.baseAddr = (uint8_t*)ptr;
     }
 }
 //=================================================================================================
 
 
 //=================================================================================================
-// getIntegerFromFile() - Opens the specified file, reads the first line, expects to find an 
-//                        integer encoded as an ASCII string, and returns the value of that string
+// mapBar() - Returns the user-space address of a BAR, mapping it on first access
+//
+// Can throw std::runtime_error
 //=================================================================================================
-static int getIntegerFromFile(string filename)
+uint8_t* PciDevice::mapBar(int bar)
 {
-    string line;
-   
-    // Open the specified file.  It will contain a line of ASCII data
-    ifstream file(filename);
+    // Find the resource for this BAR
+    resource_t* resource = findBar(bar);
 
-    // If we couldn't open the file, hand the caller an invalid value   
-    if (!file.is_open()) return -1;
-    
-    // Fetch the first line of the file
-    getline(file, line);
+    // If the device doesn't have this BAR, complain
+    if (resource == nullptr) throwRuntime("BAR %d isn't a memory-mappable resource", bar);
+
+    // If this BAR hasn't been mapped yet, map it now
+    if (resource->baseAddr == nullptr) mapResource(*resource);
 
-    // And hand the caller that line, decoded as an integer
-    return stoi(line, 0, 0);
+    // And hand the caller the user-space address of the BAR
+    return resource->baseAddr;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// mappedBars() - Returns a bitmap of which BARs are currently mapped (bit N = BAR N)
+//=================================================================================================
+uint32_t PciDevice::mappedBars()
+{
+    uint32_t result = 0;
+    for (auto& resource : resource_) if (resource.baseAddr) result |= (1 << resource.bar);
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// msSince() - Returns the number of milliseconds that have elapsed since a point in time
+//=================================================================================================
+static double msSince(chrono::steady_clock::time_point t)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// waitFor() - Waits for some bits of a 32-bit register to reach a value
+//
+// Passed: bar       = the BAR the register is in
+//         offset    = the offset of the register within the BAR
+//         mask      = the bits of the register we care about
+//         value     = the value that (register & mask) should reach
+//         timeoutMs = how long to wait before giving up
+//
+// Ready bits usually come up either almost at once, or a long time later.   For the first few
+// microseconds we read the register back-to-back, so a quick answer is seen quickly.   For the
+// next millisecond we back off with an increasing number of "pause" instructions between reads,
+// which keeps the core busy but frees its resources for a hyper-threaded sibling and keeps us
+// from flooding the link with reads.   After that, we sleep between reads with an increasing
+// interval, so a long wait doesn't pin a core.
+//
+// Returns: whether the register reached the value, how many reads it took, and how long it was
+//
+// Can throw std::runtime_error
+//=================================================================================================
+PciDevice::waitresult_t PciDevice::waitFor(int bar, uint32_t offset, uint32_t mask, uint32_t value, uint32_t timeoutMs)
+{
+    // How long we spin, and how long we back off with "pause" before we start sleeping
+    const double SPIN_MS  = 0.02;
+    const double PAUSE_MS = 1.0;
+
+    // The most "pause" instructions between reads, and the longest sleep between reads
+    const int    MAX_PAUSES   = 1024;
+    const int    MAX_SLEEP_US = 1000;
+
+    waitresult_t result = {false, 0, 0, 0};
+
+    // Find the register
+    uint8_t* base = mapBar(bar);
+    if ((offset & 3) || offset + 4ULL > findBar(bar)->size)
+    {
+        throwRuntime("Can't wait on BAR %d offset 0x%X: not a register in the BAR", bar, offset);
+    }
+    auto reg = (volatile uint32_t*)(base + offset);
+
+    // We're going to keep track of how long we've been waiting
+    auto startTime = chrono::steady_clock::now();
+    int  pauses = 1, sleepUs = 10;
+
+    while (true)
+    {
+        // Read the register.  If it has the value we want, we're done
+        result.value = *reg;
+        ++result.polls;
+        if ((result.value & mask) == value)
+        {
+            result.ready = true;
+            break;
+        }
+
+        // If we're out of time, give up
+        result.waitMs = msSince(startTime);
+        if (result.waitMs >= timeoutMs) break;
+
+        // Early on, just read it again
+        if (result.waitMs < SPIN_MS) continue;
+
+        // A little later, back off for a growing number of "pause" instructions
+        if (result.waitMs < PAUSE_MS)
+        {
+            for (int i = 0; i < pauses; ++i) cpuRelax();
+            pauses = min(pauses * 2, MAX_PAUSES);
+            continue;
+        }
+
+        // After that, sleep for a growing interval, but never past the deadline
+        int remainingUs = (int)((timeoutMs - result.waitMs) * 1000) + 1;
+        struct timespec ts = {0, min(sleepUs, remainingUs) * 1000L};
+        nanosleep(&ts, nullptr);
+        sleepUs = min(sleepUs * 2, MAX_SLEEP_US);
+    }
+
+    // The reads of a wait are recorded as a single access
+    #ifdef MMIO_TRACE
+    MmioTrace::record(bar, offset, 4, result.value, MmioTrace::OP_POLL);
+    #endif
+
+    // Tell the caller how it went
+    result.waitMs = msSince(startTime);
+    return result;
 }
 //=================================================================================================
 
@@ -248,10 +466,15 @@ void PciDevice::close()
 //        Each line contains 3 fields separated one space character:
 //           (1) The physical starting address of the memory mapped resource
 //           (2) The physical ending address of the memory mapped resource
-//           (3) A set of flags that we don't care about    
+//           (3) The kernel's IORESOURCE_xxx flags for the resource
+//
+//        The first six lines are BARs 0 thru 5.   Later lines (expansion ROM, SR-IOV BARs,
+//        bridge windows) aren't BARs of this function and are ignored, as are I/O-port BARs
 //=================================================================================================
 std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string deviceDir)
 {
+    const uint64_t IORESOURCE_MEM      = 0x00000200;
+    const uint64_t IORESOURCE_PREFETCH = 0x00002000;
     string             line;
     vector<resource_t> result;
     
@@ -264,25 +487,23 @@ std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string device
     // If we couldn't open the file, hand the caller an invalid value   
     if (!file.is_open()) throwRuntime("Can't open %s", c(filename));
     
-    // Loop through each line of the file...
-    while (getline(file, line))
+    // Loop through the lines of the file that describe BARs...
+    for (int bar = 0; bar < 6 && getline(file, line); ++bar)
     {
-        // Get pointers to the 1st and 2nd text fields of that line
-        const char* p1 = c(line);
-        const char* p2 = strchr(p1, ' ');
-        
-        // Parse the physical starting and ending address of this memory-mappable resource
-        off_t starting_address = strtoll(p1, 0, 0);
-        off_t ending_address   = strtoll(p2, 0, 0);
+        uint64_t starting_address = 0, ending_address = 0, flags = 0;
+
+        // Parse the physical starting and ending address and the flags of this resource
+        sscanf(c(line), "%lx %lx %lx", &starting_address, &ending_address, &flags);
 
         // A starting address of 0 means "this line doesn't define a memory-mappable resource"
-        if (starting_address == 0) continue;
+        if (starting_address == 0 || (flags & IORESOURCE_MEM) == 0) continue;
 
         // Compute how many bytes long that memory region is
         size_t size = ending_address - starting_address + 1;
 
         // Append the description of this mappable resource into our result vector        
-        result.push_back({0, size, starting_address});
+        bool prefetchable = (flags & IORESOURCE_PREFETCH) != 0;
+        result.push_back({0, size, (off_t)starting_address, bar, prefetchable, CACHE_UC});
     }
 
     // If there are no memory-mappable resources, create an error message
@@ -294,108 +515,130 @@ std::vector<PciDevice::resource_t> PciDevice::getResourceList(std::string device
 //=================================================================================================
 
 
+//=================================================================================================
+// findBar() - Returns the resource for the specified BAR number, or nullptr if there isn't one
+//=================================================================================================
+PciDevice::resource_t* PciDevice::findBar(int bar)
+{
+    for (auto& resource : resource_) if (resource.bar == bar) return &resource;
+    return nullptr;
+}
+//=================================================================================================
+
+
 
 
 //=================================================================================================
-// open() - Opens a connection to the specified PCIe device
+// open() - Opens a connection to the specified PCIe device using the default mapping options
 //
-// Passed: deviceStr = The vendorID:deviceID of the PCIe device we're looking for
+// Passed: deviceStr = The vendorID:deviceID[@selector] of the PCIe device we're looking for
 //         deviceDir = Name of the file-system directory where PCI device information can
 //                     be found.   If empty-string, a sensible default is used
 //=================================================================================================
 void PciDevice::open(string deviceStr, string deviceDir)
 {
-    string  dirName;
-
-    // We have not yet found the device that we're looking for
-    bool found = false;
+    open(deviceStr, mapopts_t(), deviceDir);
+}
+//=================================================================================================
 
-    // Get a const char* to the name of the device
-    const char* device = deviceStr.c_str();    
 
-    // Extract the Vendor ID from the device string
-    int vendorID = strtoul(device, nullptr, 16);
+//=================================================================================================
+// open() - Opens a connection to the specified PCIe device
+//
+// Passed: deviceStr = The vendorID:deviceID of the PCIe device we're looking for, optionally
+//                     followed by "@" and a selector (see PciBus::select()) that picks one
+//                     of several identical devices
+//         opts      = How the BARs should be mapped
+//         deviceDir = Name of the file-system directory where PCI device information can
+//                     be found.   If empty-string, a sensible default is used
+//=================================================================================================
+void PciDevice::open(string deviceStr, const mapopts_t& opts, string deviceDir)
+{
+    int vendorID, deviceID;
 
-    // Extract the Device ID from the device string
-    const char* p = strchr(device, ':');
-    if (p == nullptr) throwRuntime("Malformed device ID %s", device);
-    int deviceID = strtoul(p+1, nullptr, 16);
+    // Extract the Vendor ID and Device ID from the device string
+    PciBus::parseDeviceID(deviceStr, &vendorID, &deviceID);
 
     // If we already have a PCIe device mapped, unmap it
     close();
 
-    // If the caller didn't specify a device-directory, use the default
-    if (deviceDir.empty()) deviceDir = "/sys/bus/pci/devices";
-
-    // Loop through the entry for each device in the specified directory...
-    for (auto const& entry : fs::directory_iterator(deviceDir)) 
-    {
-        // Ignore any directory entry that isn't itself a directory
-        if (!entry.is_directory()) continue;
-
-        // Fetch the name of the directory that we're about to examine
-        dirName = entry.path().string();
-
-        // Fetch the vendor ID and device ID of this device
-        int thisVendorID = getIntegerFromFile(dirName + "/vendor");
-        int thisDeviceID = getIntegerFromFile(dirName + "/device");
-
-        // If this vendor ID and device ID match the caller's, we have found 
-        // the droid we're looking for.
-        if (thisVendorID == vendorID && thisDeviceID == deviceID)
-        {
-            found = true;
-            break;
-        }
-    }
+    // Find the device on the bus that the device string selects
+    PciBus bus(deviceDir);
+    bus.scan();
+    auto matches = bus.select(deviceStr);
 
     // If we couldn't find a device with that vendor ID and device ID, complain
-    if (!found) throwRuntime("No PCI device found for vendor=0x%X, device=0x%X", vendorID, deviceID);
+    if (matches.empty()) throwRuntime("No PCI device found for vendor=0x%X, device=0x%X", vendorID, deviceID);
 
-    // Fetch the physical address and size of each resource (i.e. BAR) that our device supports
-    resource_ = getResourceList(dirName);
+    // If the device string selects more than one device, it's ambiguous
+    if (matches.size() > 1) throwRuntime("%s selects %zu devices, not one", c(deviceStr), matches.size());
 
-    // Memory map each of the PCI device resources into userspace
-    mapResources();
+    // Fetch the physical address and size of each resource (i.e. BAR) that our device supports
+    deviceDir_ = matches[0].dir;
+    mapOpts_   = opts;
+    resource_  = getResourceList(deviceDir_);
+
+    // Find out which NUMA node and CPUs the device is local to
+    numaNode_  = matches[0].numaNode;
+    localCpus_.clear();
+    ifstream cpulist(deviceDir_ + "/local_cpulist");
+    string   line;
+    if (getline(cpulist, line)) localCpus_ = parseCpuList(line);
+
+    // If we've been asked to, move to the device's NUMA node before any BAR is touched
+    if (opts.numaBind) bindToNode();
+
+    // Unless the caller wants them mapped on first access, memory map each of the PCI device
+    // resources into userspace now
+    if (!opts.lazy) mapResources();
 }
 //=================================================================================================
 
 
 //=================================================================================================
-// getPortFromBdf() - Returns the port (i.e, the PCI bridge) that the specied device is 
-//                    attached to.
+// bindToNode() - Pins the calling thread to the CPUs that are local to the device, and makes
+//                it prefer memory from the device's NUMA node
+//
+// Returns: false if the kernel doesn't know which NUMA node the device is attached to
+//
+// Register accesses from a CPU on the other socket cross the inter-socket link, which adds
+// latency to every read.   Binding the thread before the first BAR access keeps the accesses,
+// and any host buffers the thread allocates afterwards, on the device's own socket.
+//
+// Can throw std::runtime_error
 //=================================================================================================
-static string getPortFromBdf(string bdf)
+bool PciDevice::bindToNode()
 {
-    // Construct the file name of the psuedo-file we are interested in
-    string pfs = "/sys/bus/pci/devices/" + bdf;
-
-    // Turn the name of that psuedo-file into a filesystem::path object
-    fs::path pf(pfs);
-   
-    // Make sure the psuedo-file actualy exists
-    if (!filesystem::exists(pf)) throwRuntime("Can't find %s", c(pfs));
-
-    // Make sure that path is a symbolic link
-    if (!fs::is_symlink(pf)) throwRuntime("Not a symlink: %s", c(pfs));
-
-    // Find the target of that symbolic link
-    fs::path target = fs::read_symlink(pf);
+    // Linux's value for the "preferred node" memory policy, from <numaif.h>
+    const int MPOL_PREFERRED = 1;
 
-    // The filename at the end is our BDF.  Throw it away
-    target.remove_filename();
+    // If we don't know which node the device is attached to, there's nothing to do
+    if (numaNode_ < 0) return false;
 
-    // Fetch the target as a string so we can strip the '/' off the end of it.
-    string s = target.string();
-
-    // Remove the '/' at the end of the path
-    target = s.substr(0, s.length() -1 );
+    // Pin the calling thread to the device's local CPUs
+    if (!localCpus_.empty())
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu : localCpus_) if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpuSet);
+        if (sched_setaffinity(0, sizeof cpuSet, &cpuSet) < 0)
+        {
+            throwRuntime("Can't pin thread to the CPUs of NUMA node %d: %s", numaNode_, strerror(errno));
+        }
+    }
 
-    // The filename at the end is the name of the port that our device is attached to
-    string port = target.filename();
+    // Make memory the thread allocates from now on come from the device's node if possible
+    unsigned long nodeMask[16] = {0};
+    const int     bitsPerLong  = 8 * sizeof(unsigned long);
+    if (numaNode_ >= 16 * bitsPerLong) throwRuntime("NUMA node %d is out of range", numaNode_);
+    nodeMask[numaNode_ / bitsPerLong] = 1UL << (numaNode_ % bitsPerLong);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodeMask, 16 * bitsPerLong + 1) < 0)
+    {
+        throwRuntime("Can't set memory policy for NUMA node %d: %s", numaNode_, strerror(errno));
+    }
 
-    // Return the name of the port to the caller
-    return port;
+    // Tell the caller that the thread is now bound to the device's node
+    return true;
 }
 //=================================================================================================
 
@@ -423,52 +666,730 @@ static void writeDeviceFile(string filename, const char* s)
 //=================================================================================================
 
 
+//=================================================================================================
+// pollUntil() - Repeatedly evaluates a condition with exponential backoff until it becomes true
+//
+// Passed: condition = the condition to wait for
+//         opts      = the minimum and maximum polling intervals
+//         timeoutMs = the deadline, in milliseconds from now
+//
+// Returns: true if the condition became true before the deadline
+//=================================================================================================
+template <class F> static bool pollUntil(F condition, const PciDevice::resetopts_t& opts, int timeoutMs)
+{
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+
+    for (int sleepUs = opts.pollMinUs; ; sleepUs = min(sleepUs * 2, opts.pollMaxUs))
+    {
+        // If the condition is satisfied, we're done
+        if (condition()) return true;
+
+        // If we're out of time, give up
+        if (chrono::steady_clock::now() >= deadline) return false;
+
+        // Otherwise, wait a bit before checking again
+        usleep(sleepUs);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// countAssignedBars() - Counts the BARs of a device that the kernel has assigned addresses to
+//
+// Passed: deviceDir = the sysfs directory of the device
+//
+// Returns: the number of assigned BARs, or -1 if any BAR has a size but no address
+//
+// The first six lines of the "resource" file are BARs 0 thru 5.  Each line has a start
+// address, an end address and flags.  A BAR the kernel couldn't place has I/O or memory flags
+// but a start address of 0.
+//=================================================================================================
+static int countAssignedBars(string deviceDir)
+{
+    const uint64_t IORESOURCE_IO  = 0x100;
+    const uint64_t IORESOURCE_MEM = 0x200;
+    string         line;
+    int            count = 0;
+
+    // Open the resource file
+    ifstream file(deviceDir + "/resource");
+    if (!file.is_open()) return -1;
+
+    // Examine each of the six BARs
+    for (int bar = 0; bar < 6 && getline(file, line); ++bar)
+    {
+        uint64_t start = 0, end = 0, flags = 0;
+        sscanf(c(line), "%lx %lx %lx", &start, &end, &flags);
+
+        // If this BAR doesn't exist, ignore it
+        if ((flags & (IORESOURCE_IO | IORESOURCE_MEM)) == 0) continue;
+
+        // If it exists but hasn't been placed, the device isn't fully enumerated
+        if (start == 0) return -1;
+
+        // Otherwise, this BAR is good to go
+        ++count;
+    }
+
+    // Hand the caller the number of BARs that are assigned
+    return count;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readLinkSpeed() - Reads a sysfs link-speed file (i.e., "8.0 GT/s PCIe")
+//
+// Returns: the link speed in GT/s, or 0 if it's unknown
+//=================================================================================================
+static double readLinkSpeed(string filename)
+{
+    string line;
+    ifstream file(filename);
+    if (!file.is_open() || !getline(file, line)) return 0;
+    return strtod(c(line), nullptr);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readLinkWidth() - Reads a sysfs link-width file (i.e., "16")
+//
+// Returns: the number of lanes, or 0 if it's unknown
+//=================================================================================================
+static int readLinkWidth(string filename)
+{
+    string line;
+    ifstream file(filename);
+    if (!file.is_open() || !getline(file, line)) return 0;
+    return strtol(c(line) + (line[0] == 'x'), nullptr, 10);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// verifyLink() - Makes sure a link trained at the expected speed and width
+//
+// Passed: bridge  = the configuration space of the bridge on the upstream end of the link
+//         pcieCap = the offset of the bridge's PCI Express capability, or 0 if it has none
+//         pdf     = the sysfs directory of the bridge
+//         edf     = the sysfs directory of the endpoint
+//         opts    = the target speed and width, and the number of retrain attempts
+//         result  = receives the speed and width of the link, and whether it's degraded
+//
+// Unless the caller specifies otherwise, the expected speed and width are the best that both
+// ends of the link support.   A degraded link is retrained via the "Retrain Link" bit in the
+// bridge's Link Control register
+//=================================================================================================
+static void verifyLink(PciConfig& bridge, int pcieCap, string pdf, string edf,
+                       const PciDevice::resetopts_t& opts, PciDevice::resetresult_t& result)
+{
+    // Figure out what speed and width the link should have trained at
+    double targetSpeed = opts.targetSpeed;
+    int    targetWidth = opts.targetWidth;
+    if (targetSpeed <= 0) targetSpeed = min(readLinkSpeed(edf + "/max_link_speed"), readLinkSpeed(pdf + "/max_link_speed"));
+    if (targetWidth <= 0) targetWidth = min(readLinkWidth(edf + "/max_link_width"), readLinkWidth(pdf + "/max_link_width"));
+    result.targetSpeed = targetSpeed;
+    result.targetWidth = targetWidth;
+
+    // This reads the current speed and width of the link, and checks them against the targets
+    auto linkIsGood = [&]()
+    {
+        result.linkSpeed = readLinkSpeed(edf + "/current_link_speed");
+        result.linkWidth = readLinkWidth(edf + "/current_link_width");
+        return result.linkSpeed >= targetSpeed && result.linkWidth >= targetWidth;
+    };
+
+    // If the kernel doesn't report link speed and width for this device, there's nothing to check
+    if (targetSpeed <= 0 || targetWidth <= 0)
+    {
+        linkIsGood();
+        return;
+    }
+
+    // This tells us whether the link has finished training at full speed and width.  The bridge
+    // may not have raised Link Training yet when we first look, and until it does, the speed and
+    // width are the ones from before the retrain, so we keep looking until the link is good
+    auto retrained = [&]()
+    {
+        if (bridge.read16(pcieCap + PciConfig::PCIE_LINK_STATUS) & PciConfig::LINK_STATUS_TRAINING) return false;
+        return linkIsGood();
+    };
+
+    // Retrain the link until it comes up at full speed and width, or we run out of attempts.  An
+    // attempt only counts as failed if the link is still degraded after opts.linkTimeoutMs
+    bool good = linkIsGood();
+    while (!good && pcieCap && result.retrains < opts.retrainAttempts)
+    {
+        bridge.modify16(pcieCap + PciConfig::PCIE_LINK_CONTROL, PciConfig::LINK_CONTROL_RETRAIN, PciConfig::LINK_CONTROL_RETRAIN);
+        ++result.retrains;
+        good = pollUntil(retrained, opts, opts.linkTimeoutMs);
+    }
+
+    // Tell the caller whether the link is still degraded
+    result.linkDegraded = !good;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// hotReset() - Performs a PCI hot-reset of the specified device using the default settings
+//=================================================================================================
+PciDevice::resetresult_t PciDevice::hotReset(string device, string deviceDir)
+{
+    return hotReset(device, resetopts_t(), deviceDir);
+}
+//=================================================================================================
+
+
 //=================================================================================================
 // hotReset() - Performs a PCI hot-reset of the specified device
 //
-// Passed: device = vendorID:deviceID
+// Passed: device    = vendorID:deviceID[@selector].  This must select exactly one device;
+//                     use hotResetAll() to reset several
+//         opts      = settings that control how the reset is performed
+//         deviceDir = Name of the file-system directory where PCI device information can
+//                     be found.   If empty-string, a sensible default is used
+//
+// Returns: a description of the reset, with timings
 //
 // Can throw std::runtime_error
 //=================================================================================================
-void PciDevice::hotReset(string device)
+PciDevice::resetresult_t PciDevice::hotReset(string device, const resetopts_t& opts, string deviceDir)
 {
+    PciBus bus(deviceDir);
+
     // Force a rescan for PCI-bus endpoints
-    writeDeviceFile("/sys/bus/pci/rescan", "1\n");
+    writeDeviceFile(bus.busDir() + "/rescan", "1\n");
 
-    // Find the BDF that corresponds to this device
-    string bdf = getBDF(device);
+    // Find the devices that correspond to this device specification
+    bus.scan();
+    auto matches = bus.select(device);
 
     // If we didn't find the PCI device we are looking for, complain
-    if (bdf.empty()) throwRuntime("Can't locate device %s", c(device));
+    if (matches.empty()) throwRuntime("Can't locate device %s", c(device));
 
-    // Find out which PCI bridge this device is attached to
-    string port = getPortFromBdf(bdf);
+    // If the device string selects more than one device, it's ambiguous
+    if (matches.size() > 1) throwRuntime("%s selects %zu devices, not one", c(device), matches.size());
+
+    // Reset the device
+    return hotReset(matches, opts, deviceDir)[0];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// hotResetAll() - Performs a PCI hot-reset of every device a specification selects
+//
+// Passed: device    = vendorID:deviceID[@selector].  Use a selector of "*" to reset every
+//                     device with that vendorID:deviceID
+//         opts      = settings that control how the reset is performed
+//         deviceDir = Name of the file-system directory where PCI device information can
+//                     be found.   If empty-string, a sensible default is used
+//
+// Returns: a description of each reset, in the order the devices were selected
+//
+// Can throw std::runtime_error
+//=================================================================================================
+vector<PciDevice::resetresult_t> PciDevice::hotResetAll(string device, const resetopts_t& opts, string deviceDir)
+{
+    PciBus bus(deviceDir);
+
+    // Force a rescan for PCI-bus endpoints
+    writeDeviceFile(bus.busDir() + "/rescan", "1\n");
+
+    // Find the devices that correspond to this device specification
+    bus.scan();
+    auto matches = bus.select(device);
+
+    // If we didn't find the PCI device we are looking for, complain
+    if (matches.empty()) throwRuntime("Can't locate device %s", c(device));
+
+    // Reset the selected devices as a batch
+    return hotReset(matches, opts, deviceDir);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// kernelResetMethods() - Returns the reset methods the kernel offers for a device
+//
+// Passed: deviceDir = the sysfs directory of the device
+//
+// Returns: the names in "<deviceDir>/reset_method" (i.e., "flr" or "bus"), or an empty list
+//          if the kernel is too old to have that file or can't reset the device
+//=================================================================================================
+static vector<string> kernelResetMethods(string deviceDir)
+{
+    vector<string> methods;
+    string         method;
+
+    // The file is a space-separated list of method names
+    ifstream file(deviceDir + "/reset_method");
+    while (file >> method) methods.push_back(method);
+
+    // Hand the caller the list of methods
+    return methods;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// kernelReset() - Asks the kernel to reset a device using a specific method
+//
+// Passed: deviceDir = the sysfs directory of the device
+//         method    = "flr" or "bus"
+//
+// Returns: how long the reset took, in milliseconds
+//
+// The kernel saves and restores the device's configuration space around the reset and waits
+// for the device to become ready again, so the device stays in place.   The device's original
+// list of reset methods is put back afterwards, whether or not the reset worked.
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static double kernelReset(string deviceDir, string method)
+{
+    string original;
+
+    // Fetch the list of methods the kernel normally tries, so we can put it back
+    ifstream file(deviceDir + "/reset_method");
+    getline(file, original);
+
+    // Restrict the kernel to the method we want
+    writeDeviceFile(deviceDir + "/reset_method", (method + "\n").c_str());
+
+    // Reset the device, and time how long it takes
+    auto startTime = chrono::steady_clock::now();
+    try
+    {
+        writeDeviceFile(deviceDir + "/reset", "1\n");
+    }
+    catch(const std::runtime_error&)
+    {
+        writeDeviceFile(deviceDir + "/reset_method", (original + "\n").c_str());
+        throw;
+    }
+    double resetMs = msSince(startTime);
+
+    // Put the original list of methods back
+    writeDeviceFile(deviceDir + "/reset_method", (original + "\n").c_str());
+
+    // Tell the caller how long the reset took
+    return resetMs;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resetgroup_t - The devices behind one bridge, and the state of their reset
+//=================================================================================================
+struct resetgroup_t
+{
+    string                              port;       // The BDF of the bridge
+    vector<size_t>                      index;      // Indices of the targets behind this bridge
+    bool                                canPoll;    // True if the bridge can report link-active
+    int                                 pcieCap;    // Offset of the bridge's PCIe capability
+    string                              error;      // Why the reset failed, or "" on success
+};
+//=================================================================================================
+
+
+//=================================================================================================
+// manualReset() - Removes the target devices behind a bridge, toggles the bridge's "secondary
+//                 bus reset" bit, and waits for the link to come back up
+//
+// Passed: bridge    = the configuration space of the bridge
+//         group     = the bridge and the indices of its targets
+//         targets   = every device in the batch
+//         results   = receives the reset and link-up timings of this bridge's targets
+//         opts      = settings that control how the reset is performed
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static void manualReset(PciConfig& bridge, resetgroup_t& group, const vector<PciBus::device_t>& targets,
+                        vector<PciDevice::resetresult_t>& results, const PciDevice::resetopts_t& opts)
+{
+    int  pcieCap   = group.pcieCap;
+    bool canPoll   = group.canPoll = opts.adaptive && pcieCap && (bridge.read32(pcieCap + PciConfig::PCIE_LINK_CAP) & PciConfig::LINK_CAP_DLLLA_CAPABLE);
+    int  holdMs    = opts.adaptive ? opts.holdMs : 500;
+
+    // Remove our devices from their bridge.  A single bus reset resets all of them
+    auto removeTime = chrono::steady_clock::now();
+    if (opts.removeDevice) for (size_t i : group.index) writeDeviceFile(targets[i].dir + "/remove", "1\n");
+
+    // Perform the PCI hot-reset by toggling "secondary bus reset" in the bridge
+    bridge.modify16(PciConfig::BRIDGE_CONTROL, PciConfig::BRIDGE_CONTROL_BUS_RESET, PciConfig::BRIDGE_CONTROL_BUS_RESET);
+    usleep(holdMs * 1000);
+    bridge.modify16(PciConfig::BRIDGE_CONTROL, 0, PciConfig::BRIDGE_CONTROL_BUS_RESET);
+    auto deassertTime = chrono::steady_clock::now();
+    double resetMs = chrono::duration<double, milli>(deassertTime - removeTime).count();
+    double linkUpMs = -1;
+
+    // If the bridge can report link-active, wait for the link to come up
+    if (canPoll)
+    {
+        auto linkUp = [&]() {return (bridge.read16(pcieCap + PciConfig::PCIE_LINK_STATUS) & PciConfig::LINK_STATUS_DLLLA) != 0;};
+        if (!pollUntil(linkUp, opts, opts.linkTimeoutMs))
+        {
+            throwRuntime("Link to %s didn't come up within %d ms", c(group.port), opts.linkTimeoutMs);
+        }
+        linkUpMs = msSince(deassertTime);
+
+        // PCIe gives the device 100 ms after link-up before it must answer configuration requests
+        usleep(opts.settleMs * 1000);
+    }
+
+    // Otherwise, just give the link plenty of time to train
+    else usleep(500000);
+
+    // Record the timings for each of the devices behind this bridge
+    for (size_t i : group.index)
+    {
+        results[i].method   = "manual";
+        results[i].resetMs  = resetMs;
+        results[i].linkUpMs = linkUpMs;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resetBridge() - Resets the target devices behind a bridge with the cheapest suitable method
+//
+// Passed: bus       = the PCI bus
+//         group     = the bridge and the indices of its targets
+//         targets   = every device in the batch
+//         results   = receives the reset method and timings of this bridge's targets
+//         saved     = receives a snapshot of the configuration registers of this bridge's targets
+//         opts      = settings that control how the reset is performed
+//
+// The methods in opts.methods are tried in order.   A kernel method is suitable if the device
+// isn't being removed and the kernel lists it in every target's "reset_method" file.  If a
+// kernel reset fails, the next method is tried.   The manual method is always suitable.
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static void resetBridge(PciBus& bus, resetgroup_t& group, const vector<PciBus::device_t>& targets,
+                        vector<PciDevice::resetresult_t>& results, vector<PciConfig::snapshot_t>& saved,
+                        const PciDevice::resetopts_t& opts)
+{
+    // This is why the kernel's methods failed, for error reporting
+    string failure;
 
     // Construct the name of the device file that manipulates that port
-    string pdf = "/sys/bus/pci/devices/" + port;
+    string pdf = bus.devicesDir() + "/" + group.port;
 
     // Make sure the port device file actually exists
     if (!fs::exists(pdf)) throwRuntime("Can't find %s", c(pdf));
 
-    // Remove our device from its bridge
-    writeDeviceFile("/sys/bus/pci/devices/"+bdf+"/remove", "1\n");
+    // Find the bridge's PCIe capability, so the link can be checked afterwards
+    PciConfig bridge(pdf);
+    group.pcieCap = bridge.findCapability(PciConfig::CAP_ID_PCIE);
 
-    // Perform the PCI hot-reset
-    run("setpci -s %s BRIDGE_CONTROL=40:40", c(port));
-    usleep(500000);
-    run("setpci -s %s BRIDGE_CONTROL=00:40", c(port));
-    usleep(500000);
+    // Save the configuration registers of our devices so we can restore them afterwards
+    if (opts.restoreConfig) for (size_t i : group.index) saved[i] = PciConfig(targets[i].dir).save();
+
+    // Try each reset method in order of preference
+    for (auto method : opts.methods)
+    {
+        // Toggling secondary-bus-reset ourselves always works
+        if (method == PciDevice::RESET_MANUAL)
+        {
+            manualReset(bridge, group, targets, results, opts);
+            return;
+        }
+
+        // The kernel's methods leave the device in place, so they can't be used when the
+        // device has to be removed and rescanned
+        if (opts.removeDevice) continue;
+
+        // Make sure the kernel offers this method for every device behind the bridge
+        string name = resetMethodName(method);
+        bool   offered = true;
+        for (size_t i : group.index)
+        {
+            auto available = kernelResetMethods(targets[i].dir);
+            if (find(available.begin(), available.end(), name) == available.end()) offered = false;
+        }
+        if (!offered) continue;
+
+        // Ask the kernel to reset each device.  If it can't, fall back to the next method
+        try
+        {
+            for (size_t i : group.index)
+            {
+                results[i].resetMs = kernelReset(targets[i].dir, name);
+                results[i].method  = name;
+            }
+            return;
+        }
+        catch(const std::runtime_error& e)
+        {
+            failure = string(" (") + e.what() + ")";
+        }
+    }
+
+    // If we get here, none of the methods worked
+    throwRuntime("No suitable reset method for the devices behind %s%s", c(group.port), c(failure));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// finishDevice() - Waits for a device to be re-enumerated after a reset, verifies its link,
+//                  and re-enables it
+//
+// Passed: devicesDir = the directory that contains one entry per PCI device
+//         group      = the bridge the device is attached to
+//         target     = the device
+//         saved      = the snapshot of the device's configuration registers, or empty
+//         result     = receives the enumeration timings and the state of the link
+//         opts       = settings that control how the reset is performed
+//         rescanTime = when the bus was rescanned
+//
+// If the global rescan didn't bring the device back, the bridge is rescanned until the device
+// shows up.  Every rescan takes the kernel's global PCI rescan lock, and other bridges are being
+// finished concurrently, so the bridge is rescanned at most once every opts.pollMaxUs
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static void finishDevice(string devicesDir, const resetgroup_t& group, const PciBus::device_t& target,
+                         const PciConfig::snapshot_t& saved, PciDevice::resetresult_t& result,
+                         const PciDevice::resetopts_t& opts, chrono::steady_clock::time_point rescanTime)
+{
+    // We need our own view of the bus, since other devices are being finished concurrently
+    PciBus bus(devicesDir);
+
+    // This is the BDF of our device and the sysfs directory of the bridge it's attached to
+    string bdf = target.bdf;
+    string pdf = devicesDir + "/" + group.port;
 
     // Determine the name of the psuedo-file that is used to rescan our PCI bridge
-    string pf = "/sys/bus/pci/devices/" + port + "/dev_rescan";
-    if (!filesystem::exists(pf)) pf = "/sys/bus/pci/devices/" + port + "/rescan";
+    string pf = pdf + "/dev_rescan";
+    if (!filesystem::exists(pf)) pf = pdf + "/rescan";
+
+    // This is the sysfs directory where our device will reappear
+    string edf = devicesDir + "/" + bdf;
+
+    // We'll keep track of why the device isn't ready yet, for error reporting
+    string notReady;
+
+    // This is when the bus or our bridge was last rescanned
+    auto lastRescan = rescanTime;
+
+    // Wait until the device has been completely re-enumerated: it responds with a valid
+    // vendor ID, its identity matches, and its BARs are assigned
+    auto enumerated = [&]()
+    {
+        // If the device hasn't reappeared in sysfs, rescan the bridge, unless it was rescanned
+        // too recently
+        if (!fs::exists(edf + "/config"))
+        {
+            notReady = "is not present";
+            if (msSince(lastRescan) * 1000 < opts.pollMaxUs) return false;
+            writeDeviceFile(pf, "1\n");
+            lastRescan = chrono::steady_clock::now();
+            if (!fs::exists(edf + "/config")) return false;
+        }
+
+        // Make sure the device is responding to configuration requests
+        if (result.readyMs == 0)
+        {
+            uint16_t vendorID = PciConfig(edf).read16(PciConfig::VENDOR_ID);
+            if (vendorID == 0xFFFF || vendorID == 0x0001)
+            {
+                notReady = "is not responding";
+                return false;
+            }
+            result.readyMs = msSince(rescanTime);
+        }
+
+        // Make sure the device that came back is the device we reset
+        PciBus::device_t* found = nullptr;
+        bus.scan();
+        for (auto& d : bus.find(target.vendorID, target.deviceID)) if (d.bdf == bdf) found = &d;
+        if (found == nullptr)
+        {
+            const PciBus::device_t* other = bus.findBDF(bdf);
+            if (other) throwRuntime("Device %s came back as %04x:%04x", c(bdf), other->vendorID, other->deviceID);
+            notReady = "is not enumerated";
+            return false;
+        }
+        result.vendorID = found->vendorID;
+        result.deviceID = found->deviceID;
+
+        // Make sure the kernel has assigned addresses to all of its BARs
+        result.barCount = countAssignedBars(edf);
+        if (result.barCount < 0)
+        {
+            notReady = "has unassigned BARs";
+            return false;
+        }
+
+        // If we get here, the device is completely enumerated
+        return true;
+    };
+    if (!pollUntil(enumerated, opts, opts.readyTimeoutMs))
+    {
+        throwRuntime("Device %s %s %d ms after reset", c(bdf), c(notReady), opts.readyTimeoutMs);
+    }
+    result.enumeratedMs = msSince(rescanTime);
 
-    // Rescan our PCI bridge for endpoints
-    writeDeviceFile(pf, "1\n");
+    // Make sure the link trained at the expected speed and width, retraining it if it didn't
+    PciConfig bridge(pdf);
+    verifyLink(bridge, group.pcieCap, pdf, edf, opts, result);
+
+    // Open the configuration space of the device
+    PciConfig endpoint(edf);
+
+    // If we have a snapshot of the device's registers, restore them
+    if (!saved.empty())
+    {
+        // If the device was rescanned, the kernel owns the BARs, so we leave them out
+        PciConfig::snapshot_t expected;
+        for (auto& reg : saved) if (!opts.removeDevice || !reg.isBar) expected.push_back(reg);
 
-    // Enable bus-mastering from this PCI device
-    run("setpci -s %s COMMAND=0106", c(bdf));
+        // Find out which registers the reset changed ("<after reset> -> <saved>"), then put
+        // them back
+        result.configChanged = PciConfig::diff(endpoint.save(), expected);
+        endpoint.restore(expected, true);
+
+        // Find out whether any of them didn't take ("<saved> -> <read back>")
+        result.configUnrestored = PciConfig::diff(expected, endpoint.save());
+    }
+
+    // Apply the performance settings to the link
+    result.tuning = PcieTuning::apply(opts.tuning, edf, pdf);
+
+    // Enable memory-space access, bus-mastering, and SERR reporting for this PCI device
+    uint16_t enable = PciConfig::COMMAND_MEMORY | PciConfig::COMMAND_MASTER | PciConfig::COMMAND_SERR;
+    endpoint.modify16(PciConfig::COMMAND, enable, enable);
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// hotReset() - Performs a PCI hot-reset of a batch of devices
+//
+// Passed: devices   = the devices to reset
+//         opts      = settings that control how the reset is performed
+//         deviceDir = Name of the file-system directory where PCI device information can
+//                     be found.   If empty-string, a sensible default is used
+//
+// Returns: a description of each reset, in the same order as "devices"
+//
+// The devices are grouped by the bridge they're attached to.   The bridges are reset
+// concurrently, one thread per bridge, and a single secondary-bus-reset resets every
+// device behind a bridge.   Once every link is back up, the whole bus is rescanned once,
+// then the devices are verified and re-enabled, again concurrently.   Resetting eight cards
+// on eight root ports therefore takes about as long as resetting one.
+//
+// If the devices aren't being removed, the kernel's own reset methods (a Function Level Reset
+// or a bus reset through "<device>/reset") are tried first, in the order given by opts.methods,
+// since they don't require a rescan.   Otherwise we toggle the bridge ourselves.
+//
+// In adaptive mode, secondary-bus-reset is held for opts.holdMs, then we poll the bridge's
+// "Data Link Layer Link Active" bit rather than sleeping a fixed amount of time, then wait
+// opts.settleMs (100 ms, as PCIe requires) before the first configuration request.  If the
+// bridge can't report link-active, we fall back to the traditional fixed delay.
+//
+// Before the reset, the configuration registers of each device are saved, and afterwards they
+// are restored, so that tuned settings (Max Payload Size, Max Read Request Size, Relaxed
+// Ordering, Extended Tags, and so on) survive.   If opts.removeDevice is false, the devices
+// aren't removed and rescanned at all: the BARs are restored from the snapshot too, which
+// saves the time a rescan takes.
+//
+// If any device fails, the others are still brought back before the failure is reported
+//
+// Can throw std::runtime_error
+//=================================================================================================
+vector<PciDevice::resetresult_t> PciDevice::hotReset(const vector<PciBus::device_t>& devices,
+                                                     const resetopts_t& opts, string deviceDir)
+{
+    PciBus                bus(deviceDir);
+    vector<resetgroup_t>  group;
+    vector<resetresult_t> result(devices.size());
+    vector<thread>        worker;
+
+    // This will hold a snapshot of the configuration registers of each device
+    vector<PciConfig::snapshot_t> saved(devices.size());
+
+    // Keep track of how long the reset takes
+    auto startTime = chrono::steady_clock::now();
+
+    // Group the devices by the bridge they're attached to
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+        // If the device isn't behind a bridge, we can't reset it
+        if (devices[i].port.empty()) throwRuntime("Device %s is not attached to a PCI bridge", c(devices[i].bdf));
+
+        // Fill in the identity of the device
+        result[i].bdf      = devices[i].bdf;
+        result[i].port     = devices[i].port;
+        result[i].linkUpMs = -1;
+
+        // Find the group for this device's bridge, creating it if necessary
+        auto it = find_if(group.begin(), group.end(), [&](const resetgroup_t& g) {return g.port == devices[i].port;});
+        if (it == group.end()) it = group.insert(group.end(), {devices[i].port, {}, false, 0, ""});
+        it->index.push_back(i);
+    }
+
+    // Reset each bridge in its own thread
+    for (auto& g : group)
+    {
+        worker.emplace_back([&]()
+        {
+            try
+            {
+                resetBridge(bus, g, devices, result, saved, opts);
+            }
+            catch(const std::runtime_error& e)
+            {
+                g.error = e.what();
+            }
+        });
+    }
+
+    // Wait for every link to come back up
+    for (auto& w : worker) w.join();
+    worker.clear();
+
+    // If we removed the devices, rescan the entire bus once, rather than once per device
+    auto rescanTime = chrono::steady_clock::now();
+    if (opts.removeDevice) writeDeviceFile(bus.busDir() + "/rescan", "1\n");
+
+    // Wait for the devices behind each bridge to be re-enumerated, each bridge in its own thread
+    for (auto& g : group)
+    {
+        if (!g.error.empty()) continue;
+        worker.emplace_back([&]()
+        {
+            try
+            {
+                for (size_t i : g.index)
+                {
+                    finishDevice(bus.devicesDir(), g, devices[i], saved[i], result[i], opts, rescanTime);
+                    result[i].totalMs = msSince(startTime);
+                }
+            }
+            catch(const std::runtime_error& e)
+            {
+                g.error = e.what();
+            }
+        });
+    }
+
+    // Wait for every device to be finished
+    for (auto& w : worker) w.join();
+
+    // If any bridge failed, tell the caller
+    string error;
+    for (auto& g : group) if (!g.error.empty()) error += (error.empty() ? "" : "; ") + g.error;
+    if (!error.empty()) throwRuntime("%s", c(error));
+
+    // Tell the caller how the resets went
+    return result;
+}
+//=================================================================================================
@@ -2,15 +2,123 @@
 // PciDevice.h - Defines a generic class for mapping PCIe devices into user-space
 //=================================================================================================
 #pragma once
+#include <stdint.h>
+#include <sys/types.h>
 #include <string>
 #include <vector>
+#include "PciBus.h"
+#include "PcieTuning.h"
 
 class PciDevice
 {
 public:
-   
-    // Performs a PCI hot-reset of the specified device
-    static void hotReset(std::string device);
+
+    // The ways a device can be reset, cheapest first
+    enum resetmethod_t
+    {
+        RESET_FLR,                      // The kernel performs a Function Level Reset
+        RESET_BUS,                      // The kernel resets the secondary bus of the bridge
+        RESET_MANUAL                    // We toggle "secondary bus reset" in the bridge ourselves
+    };
+
+    // Settings that control how a hot-reset is performed
+    struct resetopts_t
+    {
+        bool    adaptive      = true;   // Poll for readiness instead of sleeping a fixed time
+        int     holdMs        = 2;      // Minimum time secondary-bus-reset is held asserted
+        int     linkTimeoutMs = 1000;   // Deadline for the link to come back up
+        int     settleMs      = 100;    // Time from link-up to the first config request.  PCIe
+                                        // requires at least 100 ms before a device that hasn't
+                                        // been polled for readiness is sent one
+        int     readyTimeoutMs= 1000;   // Deadline for the endpoint to be re-enumerated after a rescan
+        int     pollMinUs     = 50;     // First polling interval
+        int     pollMaxUs     = 20000;  // Polling intervals back off exponentially to this
+        double  targetSpeed   = 0;      // Minimum acceptable link speed in GT/s.  0 = the maximum
+        int     targetWidth   = 0;      // Minimum acceptable link width.  0 = the maximum
+        int     retrainAttempts = 3;    // How many times to retrain a link that comes up degraded
+        bool    restoreConfig = true;   // Restore the endpoint's configuration registers afterwards
+        bool    removeDevice  = true;   // Remove and rescan the device.  If false, the device
+                                        // stays in sysfs, isn't rescanned, and its BARs are
+                                        // restored from the snapshot.  Only correct when the
+                                        // BAR layout doesn't change and no driver is bound
+        PcieTuning::profile_t tuning;   // Performance settings to apply to the link afterwards
+
+        // The reset methods to try, in order of preference.  The kernel's methods ("flr" and
+        // "bus") leave the device in place, so they're only used when removeDevice is false
+        std::vector<resetmethod_t> methods = {RESET_MANUAL};
+    };
+
+    // The outcome of a hot-reset
+    struct resetresult_t
+    {
+        std::string bdf;                // The device that was reset
+        std::string port;               // The bridge it's attached to
+        std::string method;             // The reset method that was used: "flr", "bus" or "manual"
+        int         vendorID;           // The vendor ID the device came back with
+        int         deviceID;           // The device ID the device came back with
+        int         barCount;           // The number of BARs the kernel assigned
+        double      resetMs;            // Time taken by the reset itself
+        double      linkUpMs;           // Time from reset deassert to link-up, or -1 if unmeasured
+        double      readyMs;            // Time from rescan until the endpoint responded
+        double      enumeratedMs;       // Time from rescan until the device was fully enumerated
+        double      totalMs;            // Total time taken by the reset
+        double      linkSpeed;          // The speed the link trained at in GT/s, or 0 if unknown
+        int         linkWidth;          // The width the link trained at, or 0 if unknown
+        double      targetSpeed;        // The speed the link was expected to train at
+        int         targetWidth;        // The width the link was expected to train at
+        int         retrains;           // The number of times the link was retrained
+        bool        linkDegraded;       // True if the link is still slower or narrower than expected
+        std::vector<std::string> configChanged;    // Registers the reset changed: "<after reset> -> <restored>"
+        std::vector<std::string> configUnrestored; // Registers that still differ: "<saved> -> <read back>"
+        PcieTuning::result_t     tuning;           // The performance settings that were changed
+    };
+
+    // How the BARs of a device are memory mapped
+    enum mapmethod_t
+    {
+        MAP_SYSFS,                      // mmap "<deviceDir>/resourceN" (or "resourceN_wc")
+        MAP_DEVMEM                      // mmap /dev/mem at the physical address of the BAR
+    };
+
+    // The cache policy of a mapped BAR
+    enum cache_t
+    {
+        CACHE_UC,                       // Uncached
+        CACHE_WC,                       // Write-combining.  Only prefetchable BARs allow this
+        CACHE_AUTO                      // Write-combining if the BAR is prefetchable, else uncached
+    };
+
+    // Settings that control how the BARs of a device are mapped
+    struct mapopts_t
+    {
+        mapmethod_t          method    = MAP_SYSFS;
+        std::vector<cache_t> cache;             // Indexed by BAR number.  BARs not listed are CACHE_UC
+        bool                 lazy      = true;  // Map each BAR on first access rather than at open()
+        bool                 populate  = false; // Pre-fault the page tables when a BAR is mapped
+        bool                 hugeAlign = false; // Align mappings to 2MB/1GB so huge pages can be used
+        bool                 numaBind  = false; // At open(), bind the calling thread to the device's
+                                                // NUMA node (see bindToNode())
+    };
+
+    // Converts "uc", "wc" or "auto" to a cache policy.  Throws on anything else
+    static cache_t parseCachePolicy(std::string s);
+
+    // Converts "flr", "bus" or "manual" to a reset method.  Throws on anything else
+    static resetmethod_t parseResetMethod(std::string s);
+
+    // Converts a kernel CPU list (i.e., "0-7,16-23") to a list of CPU numbers
+    static std::vector<int> parseCpuList(std::string s);
+
+    // Performs a PCI hot-reset of the one device that a "vendorID:deviceID[@selector]" selects
+    static resetresult_t hotReset(std::string device, std::string deviceDir = "");
+    static resetresult_t hotReset(std::string device, const resetopts_t& opts, std::string deviceDir = "");
+
+    // Performs a PCI hot-reset of every device that a "vendorID:deviceID@selector" selects
+    static std::vector<resetresult_t> hotResetAll(std::string device, const resetopts_t& opts, std::string deviceDir = "");
+
+    // Performs a PCI hot-reset of a batch of devices, concurrently across bridges
+    static std::vector<resetresult_t> hotReset(const std::vector<PciBus::device_t>& devices,
+                                               const resetopts_t& opts, std::string deviceDir = "");
 
     // Default constructor
     PciDevice() {};
@@ -23,13 +131,61 @@ public:
     PciDevice& operator= (const PciDevice&) = delete;
 
     // These each describe a memory mapped resource from a PCI device
-    struct resource_t {uint8_t* baseAddr; size_t size; off_t physAddr;};
+    struct resource_t
+    {
+        uint8_t* baseAddr;              // The user-space address the BAR is mapped to
+        size_t   size;                  // The size of the BAR in bytes
+        off_t    physAddr;              // The physical address of the BAR
+        int      bar;                   // The BAR number, 0 thru 5
+        bool     prefetchable;          // True if the BAR is marked prefetchable
+        cache_t  cache;                 // The cache policy the BAR was mapped with
+    };
 
     // Opens a connection to a PCIe device
     void    open(std::string device, std::string deviceDir = "");
+    void    open(std::string device, const mapopts_t& opts, std::string deviceDir = "");
 
-    // Fetches the list of memory mappable resources
+    // Fetches the list of memory mappable resources.  Unless they've been accessed, entries
+    // created by a lazy open() have a baseAddr of nullptr
     std::vector<resource_t>& resourceList() {return resource_;}
+
+    // Returns the resource for the specified BAR number, or nullptr if the device doesn't have it
+    resource_t* findBar(int bar);
+
+    // Returns the user-space address of a BAR, mapping it on first access
+    uint8_t*    mapBar(int bar);
+
+    // Returns a bitmap of which BARs are currently mapped (bit N = BAR N)
+    uint32_t    mappedBars();
+
+    // The outcome of waitFor()
+    struct waitresult_t
+    {
+        bool        ready;              // True if the register reached the value in time
+        uint32_t    value;              // The last value read from the register
+        uint32_t    polls;              // The number of times the register was read
+        double      waitMs;             // How long we waited
+    };
+
+    // Waits for (32-bit register & mask) == value.  Spins briefly, then backs off with the CPU's
+    // "pause" instruction, then sleeps.  Throws std::runtime_error
+    waitresult_t waitFor(int bar, uint32_t offset, uint32_t mask, uint32_t value, uint32_t timeoutMs);
+
+    // The sysfs directory of the device that's open
+    std::string deviceDir() {return deviceDir_;}
+
+    // The NUMA node the device is attached to, or -1 if unknown
+    int         numaNode() {return numaNode_;}
+
+    // The CPUs that are local to the device, or an empty list if unknown
+    const std::vector<int>& localCpus() {return localCpus_;}
+
+    // Pins the calling thread to the device's local CPUs and makes it prefer memory from the
+    // device's NUMA node.  Returns false if the node is unknown.  Throws std::runtime_error
+    bool        bindToNode();
+
+    // The number of BAR mappings this object has created since it was constructed
+    int         mapCount() {return mapCount_;}
     
     // Stop access to the PCI device
     void    close();
@@ -43,6 +199,24 @@ protected:
     // Memory maps the resources whose definitions are in resource_
     void mapResources();
 
+    // Memory maps a single resource
+    void mapResource(resource_t& bar);
+
+    // The sysfs directory of the device we have open
+    std::string deviceDir_;
+
+    // How BARs are to be mapped
+    mapopts_t   mapOpts_;
+
+    // The number of BAR mappings created
+    int         mapCount_ = 0;
+
+    // The NUMA node the device is attached to, or -1 if unknown
+    int         numaNode_ = -1;
+
+    // The CPUs that are local to the device
+    std::vector<int> localCpus_;
+
     // Contains one entry for each resource (i.e, BAR) that is configured in the PCI device
     std::vector<resource_t> resource_;
 };
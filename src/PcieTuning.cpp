@@ -0,0 +1,330 @@
+//=================================================================================================
+// PcieTuning.cpp - Implements a profile of PCI Express performance settings
+//
+// The settings live in the PCI Express capability of each end of the link:
+//
+//    Device Capabilities:  bits  2:0  = Max Payload Size Supported (128 << n bytes)
+//                          bit   5    = Extended Tag Field Supported
+//    Device Control:       bit   4    = Enable Relaxed Ordering
+//                          bits  7:5  = Max Payload Size (128 << n bytes)
+//                          bit   8    = Extended Tag Field Enable
+//                          bits 14:12 = Max Read Request Size (128 << n bytes)
+//    Link Control:         bits  1:0  = ASPM Control (bit 0 = L0s, bit 1 = L1)
+//
+// Max Payload Size must be the same at both ends of the link, and no larger than either end
+// supports.   A TLP from the endpoint also has to be accepted by every port between the bridge
+// and the root port, and the bridge sends TLPs of its Max Payload Size to every function below
+// it.   We only reprogram the two ends of the link, so, like the kernel's "pcie_bus_safe"
+// policy, Max Payload Size is also limited to the smallest setting of every other function on
+// the path to the root port and of the endpoint's siblings.   If any of them can't be read, Max
+// Payload Size is left alone.   The other settings only concern the endpoint, except for ASPM,
+// which is disabled at both ends.
+//=================================================================================================
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include "PcieTuning.h"
+#include "PciConfig.h"
+#include "Utility.h"
+using namespace std;
+
+// A convenient shortcut to std::filesystem
+namespace fs = std::filesystem;
+
+// Fields of the Device Capabilities, Device Control and Link Control registers
+static const uint32_t DEVCAP_MPS_SUPPORTED = 0x0007;
+static const uint32_t DEVCAP_EXT_TAG       = 0x0020;
+static const uint16_t DEVCTL_RELAXED_ORDER = 0x0010;
+static const uint16_t DEVCTL_MPS           = 0x00E0;
+static const uint16_t DEVCTL_EXT_TAG       = 0x0100;
+static const uint16_t DEVCTL_MRRS          = 0x7000;
+static const uint16_t LNKCTL_ASPM          = 0x0003;
+
+//=================================================================================================
+// sizeCode() - Converts a size in bytes (128 - 4096) to the 3-bit code used in Device Control
+//=================================================================================================
+static int sizeCode(int bytes)
+{
+    int code = 0;
+    while ((128 << code) < bytes) ++code;
+    return code;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Field descriptions - Convert the value of a register field to human readable form
+//=================================================================================================
+static string describeSize(uint16_t field, int shift) {return to_string(128 << (field >> shift));}
+static string describeFlag(uint16_t field) {return field ? "on" : "off";}
+static string describeAspm(uint16_t field)
+{
+    if (field == 0) return "disabled";
+    if (field == 1) return "L0s";
+    if (field == 2) return "L1";
+    return "L0s+L1";
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isFunction() - Returns true if a sysfs directory is a PCI function (as opposed to, say, the
+//                "pci0000:00" directory of a root complex)
+//=================================================================================================
+static bool isFunction(const fs::path& dir)
+{
+    error_code ec;
+    return fs::exists(dir / "config", ec);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// neighbours() - Lists the functions that share traffic with an endpoint but that we don't
+//                reprogram: the ports above the bridge, up to and including the root port, and
+//                the other functions below the bridge
+//
+// Passed: deviceDir = the sysfs directory of the endpoint
+//         bridgeDir = the sysfs directory of the bridge
+//
+// Returns: the sysfs directories of those functions
+//
+// Can throw std::filesystem::filesystem_error
+//=================================================================================================
+static vector<fs::path> neighbours(string deviceDir, string bridgeDir)
+{
+    vector<fs::path> result;
+
+    // Find the real locations of the endpoint and the bridge in the device tree
+    fs::path device = fs::canonical(deviceDir);
+    fs::path bridge = fs::canonical(bridgeDir);
+
+    // Every function above the bridge is a port on the way to the root complex
+    for (fs::path dir = bridge.parent_path(); isFunction(dir); dir = dir.parent_path()) result.push_back(dir);
+
+    // Every other function below the bridge shares the link with the endpoint
+    for (auto& entry : fs::directory_iterator(bridge))
+    {
+        if (entry.path() != device && isFunction(entry.path())) result.push_back(entry.path());
+    }
+
+    // Hand the caller the list
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// safePayload() - Finds the largest Max Payload Size that the endpoint and the bridge can be
+//                 set to without exceeding what the rest of the hierarchy is using
+//
+// Passed: deviceDir = the sysfs directory of the endpoint
+//         bridgeDir = the sysfs directory of the bridge
+//         supported = the largest Max Payload Size that both ends of the link support
+//         limitedBy = receives the BDF of the function that set the limit
+//
+// Returns: the largest safe Max Payload Size in bytes, or 0 if it can't be determined
+//=================================================================================================
+static int safePayload(string deviceDir, string bridgeDir, int supported, string* limitedBy)
+{
+    int safe = supported;
+
+    try
+    {
+        for (auto& dir : neighbours(deviceDir, bridgeDir))
+        {
+            // Find the function's PCI Express capability.  Without one, we can't tell
+            PciConfig config(dir.string());
+            int cap = config.findCapability(PciConfig::CAP_ID_PCIE);
+            if (cap == 0)
+            {
+                *limitedBy = dir.filename().string();
+                return 0;
+            }
+
+            // The function's current Max Payload Size is a limit on ours
+            int mps = 128 << ((config.read16(cap + PciConfig::PCIE_DEVICE_CONTROL) & DEVCTL_MPS) >> 5);
+            if (mps < safe)
+            {
+                safe       = mps;
+                *limitedBy = dir.filename().string();
+            }
+        }
+    }
+
+    // If we couldn't walk the hierarchy or read a function, we can't tell what's safe
+    catch(const exception& e)
+    {
+        *limitedBy = string("the PCI hierarchy (") + e.what() + ")";
+        return 0;
+    }
+
+    // Hand the caller the largest safe Max Payload Size
+    return safe;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// update() - Changes a field of a configuration register, recording the change if there is one
+//
+// Passed: config   = the configuration space of the device
+//         offset   = the offset of the register
+//         mask     = the bits of the field
+//         value    = the new value of the field, already shifted into position
+//         what     = a description of the field, i.e. "endpoint Max Payload Size"
+//         describe = converts the value of the field to human readable form
+//         result   = receives a description of the change
+//=================================================================================================
+static void update(PciConfig& config, int offset, uint16_t mask, uint16_t value, string what,
+                   function<string(uint16_t)> describe, PcieTuning::result_t& result)
+{
+    // Find out what the field holds now
+    uint16_t old = config.read16(offset) & mask;
+
+    // If it already holds the value we want, there's nothing to do
+    if (old == (value & mask)) return;
+
+    // Change the field and record what we did
+    config.modify16(offset, value, mask);
+    result.changes.push_back(what + " " + describe(old) + " -> " + describe(value & mask));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isEmpty() - Returns true if the profile doesn't ask for any changes
+//=================================================================================================
+bool PcieTuning::isEmpty(const profile_t& profile)
+{
+    return profile.maxPayload == 0 && profile.maxReadRequest == 0 && profile.relaxedOrdering < 0
+        && profile.extendedTags < 0 && !profile.disableAspm;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// validate() - Makes sure the values in a profile are legal
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void PcieTuning::validate(const profile_t& profile)
+{
+    // This tells us whether a size is a power of 2 between 128 and 4096
+    auto legal = [](int bytes) {return bytes == 0 || (bytes >= 128 && bytes <= 4096 && (bytes & (bytes - 1)) == 0);};
+
+    if (!legal(profile.maxPayload))     throwRuntime("Illegal max_payload_size %d", profile.maxPayload);
+    if (!legal(profile.maxReadRequest)) throwRuntime("Illegal max_read_request_size %d", profile.maxReadRequest);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// apply() - Applies a profile to an endpoint and the bridge on the upstream end of its link
+//
+// Passed: profile   = the settings to apply
+//         deviceDir = the sysfs directory of the endpoint
+//         bridgeDir = the sysfs directory of the bridge
+//
+// Returns: a description of each setting that was changed, and of each setting that couldn't
+//          be applied as requested
+//
+// Can throw std::runtime_error
+//=================================================================================================
+PcieTuning::result_t PcieTuning::apply(const profile_t& profile, string deviceDir, string bridgeDir)
+{
+    result_t result;
+
+    // If there's nothing to do, don't do anything
+    if (isEmpty(profile)) return result;
+
+    // Find the PCI Express capability at each end of the link
+    PciConfig endpoint(deviceDir), bridge(bridgeDir);
+    int ecap = endpoint.findCapability(PciConfig::CAP_ID_PCIE);
+    int bcap = bridge.findCapability(PciConfig::CAP_ID_PCIE);
+
+    // If either end isn't PCI Express, there's nothing we can tune
+    if (ecap == 0 || bcap == 0)
+    {
+        result.warnings.push_back("link isn't PCI Express, tuning skipped");
+        return result;
+    }
+
+    // Fetch the capabilities of each end of the link
+    uint32_t edevcap = endpoint.read32(ecap + PciConfig::PCIE_DEVICE_CAP);
+    uint32_t bdevcap = bridge.read32(bcap + PciConfig::PCIE_DEVICE_CAP);
+
+    // Registers we'll be changing
+    int edevctl = ecap + PciConfig::PCIE_DEVICE_CONTROL;
+    int bdevctl = bcap + PciConfig::PCIE_DEVICE_CONTROL;
+
+    // Set Max Payload Size at both ends of the link, limited to what both ends support and to
+    // what the rest of the hierarchy is using
+    if (profile.maxPayload)
+    {
+        string limitedBy;
+        int    supported = min(128 << (edevcap & DEVCAP_MPS_SUPPORTED), 128 << (bdevcap & DEVCAP_MPS_SUPPORTED));
+        int    safe      = safePayload(deviceDir, bridgeDir, supported, &limitedBy);
+        int    mps       = min(profile.maxPayload, safe);
+
+        // If we can't tell what's safe, leave it alone
+        if (safe == 0)
+        {
+            result.warnings.push_back("Max Payload Size left unchanged: can't read the setting of " + limitedBy);
+        }
+
+        // Otherwise, say why we aren't using the size that was asked for, then set it
+        else
+        {
+            if (mps < profile.maxPayload && limitedBy.empty())
+            {
+                result.warnings.push_back("Max Payload Size " + to_string(profile.maxPayload) + " isn't supported by the link, using " + to_string(mps));
+            }
+            else if (mps < profile.maxPayload)
+            {
+                result.warnings.push_back("Max Payload Size " + to_string(profile.maxPayload) + " limited to " + to_string(mps) + " by " + limitedBy);
+            }
+            auto describe = [](uint16_t f) {return describeSize(f, 5);};
+            update(bridge,   bdevctl, DEVCTL_MPS, sizeCode(mps) << 5, "bridge Max Payload Size",   describe, result);
+            update(endpoint, edevctl, DEVCTL_MPS, sizeCode(mps) << 5, "endpoint Max Payload Size", describe, result);
+        }
+    }
+
+    // Set Max Read Request Size
+    if (profile.maxReadRequest)
+    {
+        auto describe = [](uint16_t f) {return describeSize(f, 12);};
+        update(endpoint, edevctl, DEVCTL_MRRS, sizeCode(profile.maxReadRequest) << 12, "endpoint Max Read Request Size", describe, result);
+    }
+
+    // Enable or disable relaxed ordering
+    if (profile.relaxedOrdering >= 0)
+    {
+        update(endpoint, edevctl, DEVCTL_RELAXED_ORDER, profile.relaxedOrdering ? DEVCTL_RELAXED_ORDER : 0,
+               "endpoint Relaxed Ordering", describeFlag, result);
+    }
+
+    // Enable or disable extended tags, if the endpoint supports them
+    if (profile.extendedTags == 1 && (edevcap & DEVCAP_EXT_TAG) == 0)
+    {
+        result.warnings.push_back("Extended Tags aren't supported by the endpoint");
+    }
+    else if (profile.extendedTags >= 0)
+    {
+        update(endpoint, edevctl, DEVCTL_EXT_TAG, profile.extendedTags ? DEVCTL_EXT_TAG : 0,
+               "endpoint Extended Tags", describeFlag, result);
+    }
+
+    // Disable ASPM at both ends of the link
+    if (profile.disableAspm)
+    {
+        update(bridge,   bcap + PciConfig::PCIE_LINK_CONTROL, LNKCTL_ASPM, 0, "bridge ASPM",   describeAspm, result);
+        update(endpoint, ecap + PciConfig::PCIE_LINK_CONTROL, LNKCTL_ASPM, 0, "endpoint ASPM", describeAspm, result);
+    }
+
+    // Tell the caller what we did
+    return result;
+}
+//=================================================================================================
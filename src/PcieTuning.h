@@ -0,0 +1,38 @@
+//=================================================================================================
+// PcieTuning.h - Defines a profile of PCI Express performance settings and applies it to a link
+//=================================================================================================
+#pragma once
+#include <string>
+#include <vector>
+
+class PcieTuning
+{
+public:
+
+    // The settings to apply.  Anything left at its default isn't touched
+    struct profile_t
+    {
+        int     maxPayload      = 0;        // Max Payload Size in bytes (128 - 4096)
+        int     maxReadRequest  = 0;        // Max Read Request Size in bytes (128 - 4096)
+        int     relaxedOrdering = -1;       // 1 = enable, 0 = disable
+        int     extendedTags    = -1;       // 1 = enable, 0 = disable
+        bool    disableAspm     = false;    // Disable ASPM on both ends of the link
+    };
+
+    // What applying a profile did
+    struct result_t
+    {
+        std::vector<std::string> changes;   // i.e., "endpoint Max Payload Size 256 -> 512"
+        std::vector<std::string> warnings;  // Settings that couldn't be applied as requested
+    };
+
+    // Returns true if the profile doesn't ask for any changes
+    static bool     isEmpty(const profile_t& profile);
+
+    // Makes sure the values in a profile are legal.  Throws std::runtime_error if they aren't
+    static void     validate(const profile_t& profile);
+
+    // Applies a profile to an endpoint and the bridge on the upstream end of its link.  Max
+    // Payload Size is never raised above what the rest of the hierarchy uses
+    static result_t apply(const profile_t& profile, std::string deviceDir, std::string bridgeDir);
+};
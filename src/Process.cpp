@@ -0,0 +1,384 @@
+//=================================================================================================
+// Process.cpp - Implements a class for running child processes with pipes, timeouts, and
+//               accounting
+//
+// Processes are started with posix_spawnp() from an argv vector, so there is no intermediate
+// /bin/sh and no fixed-size command buffer.   Each child is the leader of its own process group
+// so that it (and anything it launches) can be killed as a unit.   Output is read from a
+// non-blocking pipe via poll(), which lets every read honor the process's deadline.
+//=================================================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdexcept>
+#include "Process.h"
+using namespace std;
+
+// The environment that gets passed to child processes
+extern char** environ;
+
+//=================================================================================================
+// spawn() - Starts a program in its own process group
+//
+// Passed: argv      = the program to run (argv[0], searched for in $PATH) and its arguments
+//         pipeInput = if true, the process's stdin is connected to a pipe we can write to.
+//                     Otherwise stdin is /dev/null
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void Process::spawn(const vector<string>& argv, bool pipeInput)
+{
+    int                        outPipe[2], inPipe[2] = {-1, -1};
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t          attr;
+    sigset_t                   signals;
+    vector<char*>              args;
+
+    // If we're already running a process, get rid of it
+    kill();
+
+    // There has to be something to run!
+    if (argv.empty()) throw runtime_error("Process::spawn: empty command");
+
+    // Create the pipes.  Close-on-exec keeps other children from inheriting them
+    if (pipe2(outPipe, O_CLOEXEC) < 0) throw runtime_error("Can't create pipe");
+    if (pipeInput && pipe2(inPipe, O_CLOEXEC) < 0)
+    {
+        ::close(outPipe[0]);
+        ::close(outPipe[1]);
+        throw runtime_error("Can't create pipe");
+    }
+
+    // In the child, stdout and stderr both go to the output pipe
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, outPipe[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, outPipe[1], 2);
+
+    // And stdin comes from either the input pipe or /dev/null
+    if (pipeInput)
+        posix_spawn_file_actions_adddup2(&actions, inPipe[0], 0);
+    else
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+
+    // The child gets its own process group, no blocked signals, and a default SIGPIPE handler
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+
+    // Build a null-terminated array of arguments
+    for (auto& arg : argv) args.push_back((char*)arg.c_str());
+    args.push_back(nullptr);
+
+    // Start the process
+    startTime_ = clock_t::now();
+    int error = posix_spawnp(&pid_, args[0], &actions, &attr, args.data(), environ);
+
+    // Clean up the spawn attributes, and close the child's ends of the pipes
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    ::close(outPipe[1]);
+    if (pipeInput) ::close(inPipe[0]);
+
+    // If the process couldn't be started, complain
+    if (error)
+    {
+        pid_ = 0;
+        ::close(outPipe[0]);
+        if (pipeInput) ::close(inPipe[1]);
+        throw runtime_error("Can't run " + argv[0]);
+    }
+
+    // Keep track of our ends of the pipes.  The output pipe is non-blocking
+    outFd_ = outPipe[0];
+    inFd_  = inPipe[1];
+    fcntl(outFd_, F_SETFL, fcntl(outFd_, F_GETFL) | O_NONBLOCK);
+
+    // The new process hasn't produced any output and hasn't been killed
+    pending_.clear();
+    eof_         = false;
+    timedOut_    = false;
+    killed_      = false;
+    hasDeadline_ = false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// setTimeout() - Sets the deadline for readLine() and wait()
+//
+// Passed: seconds = how many seconds from now the process has.  0 means "no deadline"
+//=================================================================================================
+void Process::setTimeout(double seconds)
+{
+    hasDeadline_ = (seconds > 0);
+    deadline_    = clock_t::now() + chrono::duration_cast<clock_t::duration>(chrono::duration<double>(seconds));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readLine() - Fetches the next line of output from the process
+//
+// Returns: false at end-of-file, or if the deadline passes before a complete line arrives
+//=================================================================================================
+bool Process::readLine(string& line)
+{
+    char buffer[4096];
+
+    while (true)
+    {
+        // If we have a complete line buffered, hand it to the caller
+        size_t eol = pending_.find('\n');
+        if (eol != string::npos)
+        {
+            line = pending_.substr(0, eol);
+            pending_.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+
+        // At end-of-file, a partial line is still a line
+        if (eof_ || outFd_ < 0)
+        {
+            if (pending_.empty()) return false;
+            line.swap(pending_);
+            pending_.clear();
+            return true;
+        }
+
+        // Figure out how long we can wait for more output
+        int timeoutMs = -1;
+        if (hasDeadline_)
+        {
+            auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline_ - clock_t::now()).count();
+            if (remaining <= 0)
+            {
+                timedOut_ = true;
+                return false;
+            }
+            timeoutMs = (int)min(remaining, (decltype(remaining))1000);
+        }
+
+        // Wait for output to arrive
+        pollfd pfd = {outFd_, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) continue;
+
+        // Read as much output as is available
+        ssize_t length = ::read(outFd_, buffer, sizeof buffer);
+        if (length > 0)
+            pending_.append(buffer, length);
+        else if (length == 0 || (errno != EAGAIN && errno != EINTR))
+            eof_ = true;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// write() - Writes text to the process's stdin
+//
+// Returns: false if the process isn't listening
+//=================================================================================================
+bool Process::write(const string& text)
+{
+    const char* p         = text.c_str();
+    size_t      remaining = text.size();
+
+    // If there's no input pipe, the process can't be listening
+    if (inFd_ < 0) return false;
+
+    // Keep writing until everything has been written
+    while (remaining)
+    {
+        ssize_t length = ::write(inFd_, p, remaining);
+        if (length < 0 && errno == EINTR) continue;
+        if (length <= 0) return false;
+        p         += length;
+        remaining -= length;
+    }
+
+    // Tell the caller that all is well
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// closeInput() - Closes the process's stdin, which usually tells it to exit
+//=================================================================================================
+void Process::closeInput()
+{
+    if (inFd_ >= 0) ::close(inFd_);
+    inFd_ = -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reap() - Collects the exit status and resource usage of the process
+//
+// Passed: block = if true, wait for the process to exit.  Otherwise, only check whether it has
+//
+// Returns: a result with pid_ cleared if the process was reaped, otherwise pid_ is unchanged
+//=================================================================================================
+Process::result_t Process::reap(bool block)
+{
+    int      status = 0;
+    rusage   usage = {};
+    result_t result = {-1, 0, timedOut_, killed_ && !timedOut_, 0, 0, 0, 0, {}};
+
+    // If there's no process, there's nothing to reap
+    if (pid_ <= 0) return result;
+
+    // wait4() reports the resource usage of the child and all of its reaped descendants
+    pid_t pid;
+    do pid = wait4(pid_, &status, block ? 0 : WNOHANG, &usage); while (pid < 0 && errno == EINTR);
+
+    // If the process hasn't exited yet, tell the caller
+    if (pid == 0) return result;
+
+    // The process is gone, so we're done with its pipes
+    pid_ = 0;
+    closeInput();
+    if (outFd_ >= 0) ::close(outFd_);
+    outFd_ = -1;
+
+    // Fill in the exit status and resource usage
+    if (WIFEXITED(status))   result.exitCode = WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) result.signal   = WTERMSIG(status);
+    result.wallSeconds   = chrono::duration<double>(clock_t::now() - startTime_).count();
+    result.userSeconds   = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    result.systemSeconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    result.peakRssKB     = usage.ru_maxrss;
+
+    // And hand the result to the caller
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// wait() - Waits for the process to exit, killing it if the deadline passes
+//=================================================================================================
+Process::result_t Process::wait()
+{
+    string line;
+
+    // Drain any remaining output so the process can't block on a full pipe
+    while (readLine(line));
+
+    // If the deadline has already passed, kill the process
+    if (timedOut_) return kill();
+
+    // Keep checking until the process exits
+    for (int sleepUs = 100; pid_ > 0; sleepUs = min(sleepUs * 2, 10000))
+    {
+        // If the process has exited, we're done
+        result_t result = reap(false);
+        if (pid_ <= 0) return result;
+
+        // If the deadline has passed, kill the process
+        if (hasDeadline_ && clock_t::now() >= deadline_)
+        {
+            timedOut_ = true;
+            return kill();
+        }
+
+        // Otherwise, back off a bit before checking again
+        usleep(sleepUs);
+    }
+
+    // If we get here, there was no process to wait for
+    return reap(false);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// kill() - Kills the entire process group and reaps the process
+//=================================================================================================
+Process::result_t Process::kill()
+{
+    // If there's no process, there's nothing to kill
+    if (pid_ <= 0) return reap(false);
+
+    // Keep track of the fact that we killed this process
+    killed_ = true;
+
+    // Politely ask every process in the group to terminate
+    ::kill(-pid_, SIGTERM);
+
+    // Give the processes a couple of seconds to exit on their own
+    for (int i = 0; i < 200; ++i)
+    {
+        result_t result = reap(false);
+        if (pid_ <= 0) return result;
+        usleep(10000);
+    }
+
+    // If they're still running, kill them outright
+    ::kill(-pid_, SIGKILL);
+    return reap(true);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Runs a program to completion
+//
+// Passed: argv    = the program to run and its arguments
+//         timeout = the maximum number of seconds the program may run.  0 means "no limit"
+//         onLine  = if not null, this is called with each line of output as it arrives.  If it
+//                   returns false, the process group is killed.   If null, the output lines
+//                   are returned in the result
+//
+// Can throw std::runtime_error if the program can't be started
+//=================================================================================================
+Process::result_t Process::run(const vector<string>& argv, double timeout, linehandler_t onLine)
+{
+    Process        process;
+    vector<string> output;
+    string         line;
+    result_t       result;
+    bool           aborted = false;
+
+    // Start the process
+    process.spawn(argv);
+    process.setTimeout(timeout);
+
+    // Fetch each line of output as it arrives
+    while (process.readLine(line))
+    {
+        // If there's no line handler, just collect the output
+        if (!onLine)
+        {
+            output.push_back(line);
+            continue;
+        }
+
+        // If the line handler says to stop, kill the process
+        if (!onLine(line))
+        {
+            result  = process.kill();
+            aborted = true;
+            break;
+        }
+    }
+
+    // Wait for the process to finish (or kill it if it's out of time)
+    if (!aborted) result = process.wait();
+
+    // Hand the caller the result and whatever output we collected
+    result.output.swap(output);
+    return result;
+}
+//=================================================================================================
@@ -0,0 +1,103 @@
+//=================================================================================================
+// Process.h - Defines a class for running child processes with pipes, timeouts, and accounting
+//=================================================================================================
+#pragma once
+#include <sys/types.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+class Process
+{
+public:
+
+    // The outcome of running a process
+    struct result_t
+    {
+        int     exitCode;       // The exit code, or -1 if the process didn't exit normally
+        int     signal;         // The signal that terminated the process, or 0
+        bool    timedOut;       // True if the process was killed because its deadline passed
+        bool    aborted;        // True if the process was killed at the request of the caller
+        double  wallSeconds;    // Elapsed time from spawn to exit
+        double  userSeconds;    // User-mode CPU time of the process and its descendants
+        double  systemSeconds;  // Kernel-mode CPU time of the process and its descendants
+        long    peakRssKB;      // Peak resident set size of the largest process in the tree
+        std::vector<std::string> output;    // Lines of output, when no line-handler is given
+    };
+
+    // A line handler is called with each line of output.  Returning false kills the process
+    typedef std::function<bool(const std::string&)> linehandler_t;
+
+    // Runs a program to completion.  A timeout of 0 means "no timeout"
+    static result_t run(const std::vector<std::string>& argv, double timeout = 0,
+                        linehandler_t onLine = nullptr);
+
+    // Default constructor
+    Process() {};
+
+    // Destructor - kills the process if it's still running
+    ~Process() {kill();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    Process (const Process&) = delete;
+    Process& operator= (const Process&) = delete;
+
+    // Starts a program in its own process group with stdout and stderr on a pipe
+    void    spawn(const std::vector<std::string>& argv, bool pipeInput = false);
+
+    // Returns true if the process has been spawned and not yet reaped
+    bool    isRunning() {return pid_ > 0;}
+
+    // Sets the deadline (in seconds from now) for readLine() and wait().  0 means "none"
+    void    setTimeout(double seconds);
+
+    // Fetches the next line of output.  Returns false on end-of-file or when the deadline passes
+    bool    readLine(std::string& line);
+
+    // Returns true if the deadline passed during readLine() or wait()
+    bool    timedOut() {return timedOut_;}
+
+    // Writes to the process's stdin.  Returns false if the process isn't listening
+    bool    write(const std::string& text);
+
+    // Closes the process's stdin
+    void    closeInput();
+
+    // Waits for the process to exit, killing it if the deadline passes
+    result_t wait();
+
+    // Kills the entire process group and reaps the process
+    result_t kill();
+
+protected:
+
+    typedef std::chrono::steady_clock clock_t;
+
+    // Reaps the process (which must have exited or be about to) and fills in the result
+    result_t reap(bool block);
+
+    // The process ID of the child, which is also its process group ID
+    pid_t   pid_ = 0;
+
+    // Our ends of the child's stdin and stdout pipes
+    int     inFd_ = -1;
+    int     outFd_ = -1;
+
+    // Output that has been read from the pipe but not yet returned as a line
+    std::string pending_;
+
+    // True once the output pipe has reached end-of-file
+    bool    eof_ = false;
+
+    // When the process was started, and when it must be finished by
+    clock_t::time_point startTime_;
+    clock_t::time_point deadline_;
+    bool    hasDeadline_ = false;
+
+    // True if the deadline passed
+    bool    timedOut_ = false;
+
+    // True if the process was killed at our request
+    bool    killed_ = false;
+};
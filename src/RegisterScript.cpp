@@ -0,0 +1,228 @@
+//=================================================================================================
+// RegisterScript.cpp - Implements a compiled script of register accesses to the BARs of a device
+//
+// A script is parsed once, when the config file is read, into a flat array of instructions.
+// Running it is then a tight loop over that array that performs each access directly through
+// the BAR mappings: no parsing, no system calls, and no process start-up per reload.   Writes
+// are performed in script order.   They're posted, so a run of writes streams out to the
+// device back-to-back, and the next read or poll waits for all of them to land.
+//=================================================================================================
+#include <chrono>
+#include <stdlib.h>
+#include <strings.h>
+#include "RegisterScript.h"
+#include "Mmio.h"
+#include "Utility.h"
+using namespace std;
+
+//=================================================================================================
+// parseNumber() - Converts a token such as "0x1000", "4096" or "0xDEAD_BEEF" to a 32-bit value
+//
+// Returns: true if the token is a valid number
+//=================================================================================================
+static bool parseNumber(string token, uint32_t* pValue)
+{
+    char*  end;
+
+    // Underscores are allowed as digit separators
+    string digits;
+    for (char ch : token) if (ch != '_') digits += ch;
+
+    // An empty token isn't a number
+    if (digits.empty()) return false;
+
+    // Convert the digits, making sure they're all used and fit in 32 bits
+    unsigned long long value = strtoull(c(digits), &end, 0);
+    if (*end || value > 0xFFFFFFFFULL) return false;
+
+    // Hand the caller the value
+    *pValue = (uint32_t)value;
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// compile() - Compiles a script into a flat array of instructions
+//
+// Passed: script = the script, as fetched from the config file
+//         name   = the name of the script, for error messages
+//
+// Each line is one instruction:
+//
+//      write <bar> <offset> <value>                    Writes a 32-bit register
+//      read  <bar> <offset> [<expected> [<mask>]]      Reads a register, and optionally checks
+//                                                      that (value & mask) == expected
+//      poll  <bar> <offset> <mask> <value> [<ms>]      Waits until (register & mask) == value.
+//                                                      The timeout defaults to 1000 ms
+//      fill  <bar> <offset> <value> <count>            Writes <value> to <count> consecutive
+//                                                      32-bit registers
+//
+// A <bar> is written as "bar0" thru "bar5", or just as the number
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void RegisterScript::compile(CConfigScript& script, string name)
+{
+    string text;
+    int    tokenCount, line = 0;
+
+    // Start with an empty program
+    name_ = name;
+    code_.clear();
+
+    // Loop through each line of the script
+    script.rewind();
+    while (script.get_next_line(&tokenCount, &text))
+    {
+        instruction_t ins = {OP_WRITE, 0, 0, 0, 0xFFFFFFFF, 0, false, ++line};
+        vector<uint32_t> arg;
+
+        // Ignore blank lines
+        if (tokenCount == 0) continue;
+
+        // Decode the opcode, and find out how many operands it takes
+        string opcode = script.get_next_token(true);
+        int    minArgs, maxArgs;
+        if      (opcode == "write") {ins.op = OP_WRITE; minArgs = 1; maxArgs = 1;}
+        else if (opcode == "read" ) {ins.op = OP_READ;  minArgs = 0; maxArgs = 2;}
+        else if (opcode == "poll" ) {ins.op = OP_POLL;  minArgs = 2; maxArgs = 3;}
+        else if (opcode == "fill" ) {ins.op = OP_FILL;  minArgs = 2; maxArgs = 2;}
+        else throwRuntime("%s line %d: unknown instruction '%s'", c(name_), line, c(opcode));
+
+        // Decode the BAR
+        string bar = script.get_next_token(true);
+        if (strncasecmp(c(bar), "bar", 3) == 0) bar = bar.substr(3);
+        uint32_t barNumber;
+        if (!parseNumber(bar, &barNumber) || barNumber > 5) throwRuntime("%s line %d: bad BAR in '%s'", c(name_), line, c(text));
+        ins.bar = barNumber;
+
+        // Decode the register offset
+        if (!parseNumber(script.get_next_token(), &ins.offset) || (ins.offset & 3))
+        {
+            throwRuntime("%s line %d: bad register offset in '%s'", c(name_), line, c(text));
+        }
+
+        // Decode the remaining operands
+        for (string token = script.get_next_token(); !token.empty(); token = script.get_next_token())
+        {
+            uint32_t value;
+            if (!parseNumber(token, &value)) throwRuntime("%s line %d: bad number '%s'", c(name_), line, c(token));
+            arg.push_back(value);
+        }
+
+        // Make sure there are the right number of them
+        if ((int)arg.size() < minArgs || (int)arg.size() > maxArgs)
+        {
+            throwRuntime("%s line %d: wrong number of operands in '%s'", c(name_), line, c(text));
+        }
+
+        // Fill in the instruction
+        switch (ins.op)
+        {
+            case OP_WRITE:  ins.value = arg[0];
+                            break;
+
+            case OP_READ:   ins.check = !arg.empty();
+                            if (arg.size() > 0) ins.value = arg[0];
+                            if (arg.size() > 1) ins.mask  = arg[1];
+                            break;
+
+            case OP_POLL:   ins.mask  = arg[0];
+                            ins.value = arg[1];
+                            ins.count = (arg.size() > 2) ? arg[2] : 1000;
+                            break;
+
+            case OP_FILL:   ins.value = arg[0];
+                            ins.count = arg[1];
+                            break;
+        }
+
+        // Add it to the program
+        code_.push_back(ins);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Runs the compiled script against the BARs of an open device
+//
+// Returns: how many accesses were made, and how long they took
+//
+// Can throw std::runtime_error
+//=================================================================================================
+RegisterScript::stats_t RegisterScript::run(PciDevice& device) const
+{
+    Mmio    bar[6];
+    stats_t stats;
+
+    // Map every BAR the script uses before we start the clock, and make sure every access
+    // lies inside its BAR
+    for (auto& ins : code_)
+    {
+        if (bar[ins.bar].baseAddr() == nullptr) bar[ins.bar].attach(device, ins.bar);
+        uint64_t end = ins.offset + 4ULL * (ins.op == OP_FILL ? ins.count : 1);
+        if (end > bar[ins.bar].size())
+        {
+            throwRuntime("%s line %d: offset 0x%X is beyond the end of BAR %d", c(name_), ins.line, ins.offset, ins.bar);
+        }
+    }
+
+    // Execute the instructions in order
+    auto startTime = chrono::steady_clock::now();
+    for (auto& ins : code_)
+    {
+        const Mmio& io = bar[ins.bar];
+
+        switch (ins.op)
+        {
+            // Write a register
+            case OP_WRITE:
+                io.write32(ins.offset, ins.value);
+                ++stats.writes;
+                break;
+
+            // Read a register, and check its value if we've been asked to
+            case OP_READ:
+            {
+                uint32_t value = io.read32(ins.offset);
+                ++stats.reads;
+                if (ins.check && (value & ins.mask) != ins.value)
+                {
+                    throwRuntime("%s line %d: BAR %d offset 0x%X is 0x%08X, expected 0x%08X (mask 0x%08X)",
+                                 c(name_), ins.line, ins.bar, ins.offset, value, ins.value, ins.mask);
+                }
+                break;
+            }
+
+            // Wait for some bits of a register to reach a value
+            case OP_POLL:
+            {
+                auto wait = device.waitFor(ins.bar, ins.offset, ins.mask, ins.value, ins.count);
+                ++stats.polls;
+                stats.pollReads  += wait.polls;
+                stats.pollWaitMs += wait.waitMs;
+                if (!wait.ready)
+                {
+                    throwRuntime("%s line %d: timed out after %u ms waiting for BAR %d offset 0x%X to be 0x%08X (mask 0x%08X), last read 0x%08X",
+                                 c(name_), ins.line, ins.count, ins.bar, ins.offset, ins.value, ins.mask, wait.value);
+                }
+                break;
+            }
+
+            // Write the same value to a run of registers, one 32-bit write apiece
+            case OP_FILL:
+                for (uint32_t i = 0; i < ins.count; ++i) io.write32(ins.offset + 4 * i, ins.value);
+                stats.writes += ins.count;
+                break;
+        }
+
+        ++stats.instructions;
+    }
+
+    // Tell the caller how it went
+    stats.elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+    return stats;
+}
+//=================================================================================================
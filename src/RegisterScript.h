@@ -0,0 +1,68 @@
+//=================================================================================================
+// RegisterScript.h - Defines a compiled script of register accesses to the BARs of a PCI device
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "config_file.h"
+#include "PciDevice.h"
+
+class RegisterScript
+{
+public:
+
+    // The operations a script can perform
+    enum opcode_t
+    {
+        OP_WRITE,                       // write <bar> <offset> <value>
+        OP_READ,                        // read  <bar> <offset> [<expected> [<mask>]]
+        OP_POLL,                        // poll  <bar> <offset> <mask> <value> [<timeout_ms>]
+        OP_FILL                         // fill  <bar> <offset> <value> <count>
+    };
+
+    // One compiled instruction
+    struct instruction_t
+    {
+        opcode_t    op;
+        int         bar;
+        uint32_t    offset;
+        uint32_t    value;              // The value to write, expect, or wait for
+        uint32_t    mask;               // The bits of a read or poll that are compared
+        uint32_t    count;              // fill: the number of 32-bit words.  poll: the timeout in ms
+        bool        check;              // read: true if the value read is compared
+        int         line;               // The line of the script, for error messages
+    };
+
+    // What happened when a script was run
+    struct stats_t
+    {
+        int         instructions = 0;
+        int         writes       = 0;   // Including each word of a fill
+        int         reads        = 0;
+        int         polls        = 0;
+        int         pollReads    = 0;   // The number of reads the polls took
+        double      pollWaitMs   = 0;   // The time spent waiting in polls
+        double      elapsedMs    = 0;
+    };
+
+    // Compiles a script.  "name" is used in error messages.  Throws std::runtime_error
+    void        compile(CConfigScript& script, std::string name);
+
+    // True if there's nothing to run
+    bool        empty() const {return code_.empty();}
+
+    // The compiled instructions
+    const std::vector<instruction_t>& code() const {return code_;}
+
+    // Runs the compiled script against the BARs of an open device.  Throws std::runtime_error
+    stats_t     run(PciDevice& device) const;
+
+protected:
+
+    // The name of the script, for error messages
+    std::string name_;
+
+    // The compiled instructions
+    std::vector<instruction_t> code_;
+};
@@ -0,0 +1,186 @@
+//=================================================================================================
+// Sha256.cpp - Implements a SHA-256 message digest (FIPS 180-4)
+//=================================================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "Sha256.h"
+using namespace std;
+
+// The SHA-256 round constants
+static const uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Rotates a 32-bit value right
+static inline uint32_t ror(uint32_t x, int n) {return (x >> n) | (x << (32 - n));}
+
+
+//=================================================================================================
+// reset() - Starts a new digest
+//=================================================================================================
+void Sha256::reset()
+{
+    static const uint32_t initial[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(state_, initial, sizeof state_);
+    bufferLength_ = 0;
+    totalLength_  = 0;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// transform() - Processes one 64-byte block of data
+//=================================================================================================
+void Sha256::transform(const uint8_t* block)
+{
+    uint32_t w[64];
+
+    // The first 16 words of the message schedule are the block itself, big-endian
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (block[i*4] << 24) | (block[i*4+1] << 16) | (block[i*4+2] << 8) | block[i*4+3];
+    }
+
+    // Expand the message schedule
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = ror(w[i-15],  7) ^ ror(w[i-15], 18) ^ (w[i-15] >>  3);
+        uint32_t s1 = ror(w[i- 2], 17) ^ ror(w[i- 2], 19) ^ (w[i- 2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+
+    // Perform the 64 rounds of compression
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t S1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + S1 + ch + K[i] + w[i];
+        uint32_t S0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+        uint32_t mj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = S0 + mj;
+
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    // Add the compressed chunk to the current hash state
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// update() - Adds data to the digest
+//=================================================================================================
+void Sha256::update(const void* data, size_t length)
+{
+    const uint8_t* p = (const uint8_t*)data;
+
+    // Keep track of the total length of the message
+    totalLength_ += length;
+
+    // If we have a partial block buffered, try to complete it
+    if (bufferLength_)
+    {
+        size_t n = min(length, sizeof(buffer_) - bufferLength_);
+        memcpy(buffer_ + bufferLength_, p, n);
+        bufferLength_ += n;
+        p             += n;
+        length        -= n;
+        if (bufferLength_ < sizeof buffer_) return;
+        transform(buffer_);
+        bufferLength_ = 0;
+    }
+
+    // Process as many complete blocks as we can directly from the caller's data
+    while (length >= 64)
+    {
+        transform(p);
+        p      += 64;
+        length -= 64;
+    }
+
+    // Buffer whatever is left over
+    memcpy(buffer_, p, length);
+    bufferLength_ = length;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// finish() - Finishes the digest and returns it as a string of hex digits
+//=================================================================================================
+string Sha256::finish()
+{
+    uint8_t pad[72] = {0x80};
+    char    hex[65];
+
+    // The message length in bits, which gets appended big-endian
+    uint64_t bits = totalLength_ * 8;
+
+    // Pad the message out to 56 bytes mod 64
+    size_t padLength = (bufferLength_ < 56) ? (56 - bufferLength_) : (120 - bufferLength_);
+    for (int i = 0; i < 8; ++i) pad[padLength + i] = bits >> (56 - i*8);
+    update(pad, padLength + 8);
+
+    // Convert the hash state to hex
+    for (int i = 0; i < 8; ++i) sprintf(hex + i*8, "%08x", state_[i]);
+
+    // Get ready for the next digest
+    reset();
+
+    // And hand the caller the digest
+    return hex;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// ofFile() - Returns the SHA-256 digest of a file
+//
+// Can throw std::runtime_error
+//=================================================================================================
+string Sha256::ofFile(string filename)
+{
+    uint8_t buffer[1 << 16];
+    ssize_t length;
+    Sha256  digest;
+
+    // Open the file
+    int fd = ::open(filename.c_str(), O_RDONLY);
+
+    // If we can't, complain
+    if (fd < 0) throw runtime_error("Can't open " + filename);
+
+    // Add the entire contents of the file to the digest
+    while ((length = ::read(fd, buffer, sizeof buffer)) > 0) digest.update(buffer, length);
+
+    // We're done with the file
+    ::close(fd);
+
+    // If a read error occured, complain
+    if (length < 0) throw runtime_error("Can't read " + filename);
+
+    // Hand the caller the digest
+    return digest.finish();
+}
+//=================================================================================================
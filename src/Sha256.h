@@ -0,0 +1,44 @@
+//=================================================================================================
+// Sha256.h - Defines a SHA-256 message digest
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+class Sha256
+{
+public:
+
+    // Default constructor - starts a new digest
+    Sha256() {reset();}
+
+    // Starts a new digest
+    void        reset();
+
+    // Adds data to the digest
+    void        update(const void* data, size_t length);
+
+    // Finishes the digest and returns it as a string of 64 hex digits
+    std::string finish();
+
+    // Returns the SHA-256 digest of a file as hex digits.  Throws std::runtime_error on failure
+    static std::string ofFile(std::string filename);
+
+protected:
+
+    // Processes one 64-byte block of data
+    void        transform(const uint8_t* block);
+
+    // The current hash state
+    uint32_t    state_[8];
+
+    // Data waiting to be processed
+    uint8_t     buffer_[64];
+
+    // The number of bytes in buffer_
+    size_t      bufferLength_;
+
+    // The total number of bytes that have been added to the digest
+    uint64_t    totalLength_;
+};
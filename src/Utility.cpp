@@ -0,0 +1,79 @@
+//=================================================================================================
+// Utility.cpp - Implements small helper functions that are shared by every module
+//=================================================================================================
+#include <stdarg.h>
+#include <cstdio>
+#include <stdexcept>
+#include "Utility.h"
+using namespace std;
+
+//=================================================================================================
+// throwRuntime() - Throws a runtime exception
+//=================================================================================================
+void throwRuntime(const char* fmt, ...)
+{
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+
+    throw runtime_error(buffer);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// replace() - Replaces the "from" string with the "to" string if the "from" string exists
+//=================================================================================================
+void replace(string& str, string from, string to)
+{
+    size_t start_pos = str.find(from);
+    if (start_pos == std::string::npos) return;
+    str.replace(start_pos, from.length(), to);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// writeStrVecToFile() - Helper function that writes a vector of strings to a file, with a linefeed
+//                       appended to the end of each line.
+//=================================================================================================
+bool writeStrVecToFile(const vector<string>& v, string filename)
+{
+    // Create the output file
+    FILE* ofile = fopen(c(filename), "w");
+
+    // If we can't create the output file, whine to the caller
+    if (ofile == nullptr) return false;
+
+    // Write each line in the vector to the output file
+    for (auto& s : v) fprintf(ofile, "%s\n", c(s));
+
+    // We're done with the output file
+    fclose(ofile);
+
+    // And tell the caller that all is well
+    return true;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// classifyLine() - Classifies a line of Vivado output by its severity
+//=================================================================================================
+lineclass_t classifyLine(const string& line)
+{
+    // Extract the first word from the line
+    string firstWord = line.substr(0, line.find(" "));
+
+    // Vivado prefixes each diagnostic message with its severity
+    if (firstWord == "ERROR:"  ) return LC_ERROR;
+    if (firstWord == "WARNING:") return LC_WARNING;
+    if (firstWord == "INFO:"   ) return LC_INFO;
+    if (line.compare(0, 17, "CRITICAL WARNING:") == 0) return LC_CRITICAL_WARNING;
+
+    // Anything else is just informational chatter
+    return LC_OTHER;
+}
+//=================================================================================================
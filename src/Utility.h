@@ -0,0 +1,25 @@
+//=================================================================================================
+// Utility.h - Defines small helper functions that are shared by every module
+//=================================================================================================
+#pragma once
+#include <string>
+#include <vector>
+
+// Throws a std::runtime_error whose message is formatted like printf()
+[[noreturn]] void throwRuntime(const char* fmt, ...);
+
+// Shorthand way of converting a std::string to a const char*
+inline const char* c(const std::string& s) {return s.c_str();}
+
+// Replaces the "from" string with the "to" string if the "from" string exists
+void replace(std::string& str, std::string from, std::string to);
+
+// Writes a vector of strings to a file, with a linefeed appended to each.  Returns false if
+// the file can't be created
+bool writeStrVecToFile(const std::vector<std::string>& v, std::string filename);
+
+// The severity of a line of Vivado output
+enum lineclass_t {LC_OTHER, LC_INFO, LC_WARNING, LC_CRITICAL_WARNING, LC_ERROR};
+
+// Classifies a line of Vivado output by its severity
+lineclass_t classifyLine(const std::string& line);
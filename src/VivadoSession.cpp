@@ -0,0 +1,167 @@
+//=================================================================================================
+// VivadoSession.cpp - Implements a long-lived Vivado Tcl interpreter that we talk to over pipes
+//
+// Vivado is started once in "-mode tcl" with its stdin and stdout connected to pipes.   Each
+// request is wrapped in a Tcl "catch" and followed by a unique marker line so that we know
+// exactly where the output of one request ends.
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <cstdlib>
+#include <stdexcept>
+#include "VivadoSession.h"
+#include "Utility.h"
+using namespace std;
+
+// This is the marker that Vivado prints when it has finished executing a request
+static const char* DONE_MARKER = "@@LOAD_BITSTREAM_DONE@@";
+
+//=================================================================================================
+// stripPrompt() - Removes any interactive prompts (i.e., "Vivado% ") from the start of a line
+//=================================================================================================
+static const char* stripPrompt(const char* p)
+{
+    while (true)
+    {
+        // Skip over the word that would be the name of the prompt
+        const char* q = p;
+        while (isalnum(*q) || *q == '_') ++q;
+
+        // If that word isn't followed by "% ", there's no prompt here
+        if (q == p || q[0] != '%' || q[1] != ' ') return p;
+
+        // Skip over the prompt
+        p = q + 2;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// start() - Launches the Vivado Tcl interpreter
+//
+// Passed: vivado = the name of the Vivado executable
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void VivadoSession::start(string vivado)
+{
+    vector<string> output;
+
+    // If we already have an interpreter running, shut it down
+    stop();
+
+    // Run Vivado as an interactive Tcl interpreter with its stdin connected to a pipe
+    process_.spawn({vivado, "-nojournal", "-nolog", "-mode", "tcl"}, true);
+
+    // Wait for the interpreter to tell us that it's ready to accept commands
+    if (!execute("set lb_ready 1", output))
+    {
+        stop();
+        throwRuntime("Can't run %s", c(vivado));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// execute() - Sends a Tcl command to Vivado and collects the output
+//
+// Passed: command = the Tcl command to execute
+//         output  = receives the lines of output generated by the command
+//
+// Returns: true if the command completed without throwing a Tcl error
+//=================================================================================================
+bool VivadoSession::execute(string command, vector<string>& output)
+{
+    string line;
+
+    // We don't have any output yet
+    output.clear();
+
+    // If the interpreter isn't running, there's nothing to do
+    if (!isRunning()) return false;
+
+    // Wrap the command so that errors are caught, reported, and followed by our marker
+    string request = "set lb_rc [catch {" + command + "} lb_msg]; "
+                   + "if {$lb_rc} {puts \"ERROR: $lb_msg\"}; "
+                   + "puts \"\\n" + DONE_MARKER + " $lb_rc\"; flush stdout\n";
+
+    // The request has to finish before its deadline
+    process_.setTimeout(timeout_);
+
+    // Send the request to Vivado.   If we can't, Vivado has died
+    if (!process_.write(request))
+    {
+        stop();
+        output.push_back("ERROR: Vivado interpreter is not responding");
+        return false;
+    }
+
+    // Read lines of output until we see our marker
+    while (process_.readLine(line))
+    {
+        // Skip past any interactive prompts
+        const char* p = stripPrompt(line.c_str());
+
+        // If this is our marker, the status is the value that follows it
+        if (strncmp(p, DONE_MARKER, strlen(DONE_MARKER)) == 0)
+        {
+            return atoi(p + strlen(DONE_MARKER)) == 0;
+        }
+
+        // Otherwise, this is output from the command
+        output.push_back(p);
+    }
+
+    // If we get here, Vivado either exited out from under us or ran out of time
+    output.push_back(process_.timedOut() ? "ERROR: Vivado interpreter timed out"
+                                         : "ERROR: Vivado interpreter exited unexpectedly");
+    stop();
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// source() - Has the Vivado interpreter execute a Tcl script
+//
+// Passed: tclFilename = the name of the Tcl script to execute
+//         output      = receives the lines of output generated by the script
+//
+// Returns: true if the script completed and Vivado reported no errors
+//=================================================================================================
+bool VivadoSession::source(string tclFilename, vector<string>& output)
+{
+    // Have Vivado execute the script
+    bool ok = execute("source -notrace {" + tclFilename + "}", output);
+
+    // Any line of output that begins with "ERROR:" means the script failed
+    for (auto& s : output)
+    {
+        if (s.substr(0, s.find(" ")) == "ERROR:") ok = false;
+    }
+
+    // Tell the caller whether the script succeeded
+    return ok;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// stop() - Shuts down the Vivado interpreter
+//=================================================================================================
+void VivadoSession::stop()
+{
+    // If there's no interpreter running, there's nothing to do
+    if (!isRunning()) return;
+
+    // Closing Vivado's stdin tells the interpreter to exit.  Give it a few seconds to do so
+    process_.closeInput();
+    process_.setTimeout(5);
+
+    // Waiting kills the interpreter if it doesn't exit on its own
+    process_.wait();
+}
+//=================================================================================================
@@ -0,0 +1,48 @@
+//=================================================================================================
+// VivadoSession.h - Defines a long-lived Vivado Tcl interpreter that we talk to over pipes
+//=================================================================================================
+#pragma once
+#include <string>
+#include <vector>
+#include "Process.h"
+
+class VivadoSession
+{
+public:
+
+    // Default constructor
+    VivadoSession() {};
+
+    // Destructor
+    ~VivadoSession() {stop();}
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    VivadoSession (const VivadoSession&) = delete;
+    VivadoSession& operator= (const VivadoSession&) = delete;
+
+    // Launches "vivado -mode tcl" and waits for the interpreter to become ready
+    void    start(std::string vivado);
+
+    // Returns true if the Vivado interpreter is alive
+    bool    isRunning() {return process_.isRunning();}
+
+    // Sets the maximum number of seconds a single request may take.  0 means "no limit"
+    void    setTimeout(double seconds) {timeout_ = seconds;}
+
+    // Has the interpreter source a Tcl script.  Returns true if the script ran without error
+    bool    source(std::string tclFilename, std::vector<std::string>& output);
+
+    // Sends a command to Vivado and collects output until the completion marker appears
+    bool    execute(std::string command, std::vector<std::string>& output);
+
+    // Shuts down the Vivado interpreter
+    void    stop();
+
+protected:
+
+    // The Vivado interpreter process
+    Process process_;
+
+    // The maximum number of seconds a single request may take
+    double  timeout_ = 0;
+};
@@ -0,0 +1,413 @@
+//=================================================================================================
+// XdmaEngine.cpp - Implements a user-space driver for the DMA channels of a Xilinx XDMA core
+//
+// Each channel has a ring of descriptors in host memory.  A batch of transfers is written into
+// the ring as a chain of descriptors, the last of which has the "stop" bit set.   The address
+// of the first descriptor goes into the channel's scatter-gather registers and the channel's
+// "run" bit is set.   The channel runs in poll mode: it writes its completed-descriptor count
+// to a word in host memory, so waiting for the chain to finish doesn't cost a round trip
+// across the bus per check.   Interrupts are never enabled in the core's IRQ block, so no
+// driver is needed.
+//=================================================================================================
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <string.h>
+#include <sched.h>
+#include "XdmaEngine.h"
+#include "Utility.h"
+using namespace std;
+
+//=================================================================================================
+// directionName() - Returns "H2C" or "C2H"
+//=================================================================================================
+static const char* directionName(XdmaEngine::direction_t dir)
+{
+    return (dir == XdmaEngine::H2C) ? "H2C" : "C2H";
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// isBlock() - Returns true if an identifier register belongs to the expected block and channel
+//=================================================================================================
+static bool isBlock(uint32_t id, int target, int channel)
+{
+    return (id & XdmaEngine::ID_MASK) == XdmaEngine::ID_XDMA
+        && ((id >> 16) & 0xF) == (uint32_t)target
+        && ((id >>  8) & 0xF) == (uint32_t)channel;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// adjacent() - Returns the number of descriptors that directly follow a descriptor in memory
+//              and that the engine may fetch along with it
+//
+// Passed: desc  = the descriptor
+//         count = the number of descriptors in the chain, starting with this one
+//
+// The engine fetches a descriptor and its adjacent descriptors in one burst, which mustn't
+// cross a 4K boundary
+//=================================================================================================
+static uint32_t adjacent(const XdmaEngine::descriptor_t* desc, size_t count)
+{
+    size_t inPage = (4096 - ((uintptr_t)desc & 4095)) / sizeof(XdmaEngine::descriptor_t) - 1;
+    return min({count - 1, inPage, (size_t)XdmaEngine::DESC_MAX_ADJ});
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// attach() - Finds the DMA channels in an XDMA register block using the default settings
+//=================================================================================================
+void XdmaEngine::attach(const Mmio& regs, DmaPool& pool)
+{
+    attach(regs, pool, options_t());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// attach() - Finds the DMA channels in an XDMA register block and sets up their host memory
+//
+// Passed: regs = the XDMA register block (i.e., the BAR the core's DMA registers are in)
+//         pool = the pinned host memory that the rings and bounce buffers are carved from
+//         opts = settings that control the engine
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::attach(const Mmio& regs, DmaPool& pool, const options_t& opts)
+{
+    regs_ = regs;
+    pool_ = &pool;
+    opts_ = opts;
+    h2c_.clear();
+    c2h_.clear();
+
+    // Make sure the settings make sense
+    if (opts.ringSize < 1) throwRuntime("XDMA ring size must be at least 1");
+    if (opts.bounceBytes < 4096) throwRuntime("XDMA bounce buffer must be at least 4096 bytes");
+
+    // Look for each possible channel in each direction
+    for (auto dir : {H2C, C2H})
+    {
+        for (int index = 0; index < MAX_CHANNELS; ++index)
+        {
+            size_t base  = (dir == H2C ? H2C_CHANNEL : C2H_CHANNEL) + index * CHANNEL_STRIDE;
+            size_t sgdma = (dir == H2C ? H2C_SGDMA   : C2H_SGDMA  ) + index * CHANNEL_STRIDE;
+
+            // If this channel isn't present in the core, skip it
+            if (!isBlock(regs_.read32(base + CH_IDENTIFIER), dir == H2C ? ID_TARGET_H2C : ID_TARGET_C2H, index)) continue;
+            if (!isBlock(regs_.read32(sgdma + SG_IDENTIFIER), dir == H2C ? ID_TARGET_H2C_SGDMA : ID_TARGET_C2H_SGDMA, index)) continue;
+
+            // Describe the channel.  Neither its ring nor its bounce buffer needs to be
+            // physically contiguous, since both are described to the engine a page at a time
+            auto ch    = make_unique<channel_t>();
+            ch->dir    = dir;
+            ch->index  = index;
+            ch->regs   = base;
+            ch->sgdma  = sgdma;
+            ch->ring   = pool.alloc(opts.ringSize * sizeof(descriptor_t), 4096, false);
+            ch->bounce = pool.alloc(opts.bounceBytes, 4096, false);
+            ch->writeback = pool.alloc(64, 64);
+
+            // Make sure the channel is idle, and tell it where to report its progress
+            regs_.write32(base + CH_CONTROL,    0);
+            regs_.write32(base + CH_POLL_WB_LO, (uint32_t)ch->writeback.physAddr);
+            regs_.write32(base + CH_POLL_WB_HI, (uint32_t)(ch->writeback.physAddr >> 32));
+
+            // Add it to the list of channels in this direction
+            (dir == H2C ? h2c_ : c2h_).push_back(move(ch));
+        }
+    }
+
+    // If there are no channels at all, this isn't an XDMA core
+    if (h2c_.empty() && c2h_.empty()) throwRuntime("No XDMA channels found in the register block");
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// channels() - Returns the number of channels in one direction
+//=================================================================================================
+int XdmaEngine::channels(direction_t dir) const
+{
+    return (dir == H2C) ? h2c_.size() : c2h_.size();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// channel() - Returns a channel
+//
+// Can throw std::runtime_error
+//=================================================================================================
+XdmaEngine::channel_t& XdmaEngine::channel(direction_t dir, int index)
+{
+    auto& list = (dir == H2C) ? h2c_ : c2h_;
+    if (index < 0 || index >= (int)list.size()) throwRuntime("There is no XDMA %s channel %d", directionName(dir), index);
+    return *list[index];
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// run() - Performs a batch of transfers on one channel and waits for them to complete
+//
+// Passed: dir     = the direction of the transfers
+//         channel = the channel to use
+//         batch   = the transfers.  Batches larger than the ring are run a ring-full at a time
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::run(direction_t dir, int channel, const vector<transfer_t>& batch)
+{
+    channel_t& ch = this->channel(dir, channel);
+
+    // Only one thread at a time may drive a channel
+    lock_guard<mutex> guard(ch.lock);
+
+    // Perform the transfers
+    submit(ch, batch);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// submit() - Runs a batch of any size on a channel, a ring-full at a time
+//
+// The caller must hold the channel's lock
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::submit(channel_t& ch, const vector<transfer_t>& batch)
+{
+    for (size_t first = 0; first < batch.size(); first += opts_.ringSize)
+    {
+        runBatch(ch, batch.data() + first, min(batch.size() - first, (size_t)opts_.ringSize));
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runBatch() - Runs a batch of transfers that fits in a channel's ring
+//
+// Passed: ch    = the channel, which the caller holds the lock of
+//         batch = the transfers
+//         count = the number of transfers, no more than opts_.ringSize
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::runBatch(channel_t& ch, const transfer_t* batch, size_t count)
+{
+    auto* desc = (descriptor_t*)ch.ring.virtAddr;
+
+    // Build a chain of descriptors in the ring, one per transfer
+    for (size_t i = 0; i < count; ++i)
+    {
+        const transfer_t& t = batch[i];
+        bool last = (i == count - 1);
+
+        // The engine can't do an empty transfer, or one longer than 256 MB
+        if (t.length == 0 || t.length > DESC_MAX_LENGTH) throwRuntime("Invalid XDMA transfer length %u", t.length);
+
+        // The control word tells the engine how many descriptors after the next one it can
+        // fetch in the same burst, and whether this is the end of the chain
+        desc[i].control  = DESC_MAGIC;
+        desc[i].control |= last ? (DESC_STOP | DESC_COMPLETED | DESC_EOP) : adjacent(&desc[i + 1], count - i - 1) << DESC_ADJ_SHIFT;
+        desc[i].length   = t.length;
+        desc[i].srcAddr  = (ch.dir == H2C) ? t.hostAddr : t.cardAddr;
+        desc[i].dstAddr  = (ch.dir == H2C) ? t.cardAddr : t.hostAddr;
+        desc[i].nextAddr = last ? 0 : pool_->physAddr(&desc[i + 1]);
+    }
+
+    // Clear the word that the engine reports its progress in
+    volatile uint32_t* writeback = (volatile uint32_t*)ch.writeback.virtAddr;
+    *writeback = 0;
+
+    // Make sure the descriptors are in memory before we tell the engine about them
+    atomic_thread_fence(memory_order_release);
+
+    // Point the channel at the first descriptor
+    uint64_t first = ch.ring.physAddr;
+    regs_.write32(ch.sgdma + SG_DESC_LO,  (uint32_t)first);
+    regs_.write32(ch.sgdma + SG_DESC_HI,  (uint32_t)(first >> 32));
+    regs_.write32(ch.sgdma + SG_DESC_ADJ, adjacent(desc, count));
+
+    // Clear any stale status, then start the channel
+    regs_.read32(ch.regs + CH_STATUS_RC);
+    regs_.write32(ch.regs + CH_CONTROL_W1S, CONTROL_RUN | CONTROL_POLL_WB | CONTROL_IE_ALL);
+
+    // Wait for the engine to complete every descriptor, report an error, or run out of time
+    auto     deadline = chrono::steady_clock::now() + chrono::milliseconds(opts_.timeoutMs);
+    uint32_t progress;
+    while (true)
+    {
+        progress = *writeback;
+        if (progress & WB_ERROR) break;
+        if ((progress & WB_COUNT_MASK) >= count) break;
+        if (chrono::steady_clock::now() >= deadline) break;
+        sched_yield();
+    }
+
+    // Make sure we don't read the data the engine wrote before it was finished
+    atomic_thread_fence(memory_order_acquire);
+
+    // Stop the channel, and find out why it stopped
+    regs_.write32(ch.regs + CH_CONTROL_W1C, CONTROL_RUN);
+    uint32_t status    = regs_.read32(ch.regs + CH_STATUS_RC);
+    uint32_t completed = progress & WB_COUNT_MASK;
+
+    // If the engine reported an error, complain
+    if ((progress & WB_ERROR) || (status & STATUS_ERRORS))
+    {
+        throwRuntime("XDMA %s channel %d stopped with status 0x%08X after %u of %zu descriptors",
+                     directionName(ch.dir), ch.index, status, completed, count);
+    }
+
+    // If the engine didn't finish in time, complain
+    if (completed < count)
+    {
+        throwRuntime("XDMA %s channel %d timed out after %d ms with %u of %zu descriptors complete",
+                     directionName(ch.dir), ch.index, opts_.timeoutMs, completed, count);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// copySlice() - Copies one slice of an upload() or download() through a channel's bounce buffer
+//
+// Passed: ch       = the channel
+//         host     = the ordinary host memory to copy from (H2C) or to (C2H)
+//         cardAddr = the card's address of the other side
+//         length   = the number of bytes to copy
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::copySlice(channel_t& ch, uint8_t* host, uint64_t cardAddr, size_t length)
+{
+    size_t pageBytes = pool_->pageBytes();
+
+    // Only one thread at a time may drive a channel
+    lock_guard<mutex> guard(ch.lock);
+
+    // Move the data a bounce buffer at a time
+    for (size_t done = 0; done < length;)
+    {
+        size_t count = min(length - done, ch.bounce.size);
+        vector<transfer_t> batch;
+
+        // If we're uploading, stage the data in the bounce buffer
+        if (ch.dir == H2C) memcpy(ch.bounce.virtAddr, host + done, count);
+
+        // Describe the bounce buffer with one descriptor per physically contiguous run
+        for (size_t offset = 0; offset < count;)
+        {
+            uint8_t* ptr  = ch.bounce.virtAddr + offset;
+            uint64_t phys = pool_->physAddr(ptr);
+            size_t   run  = min(count - offset, pageBytes - (ptr - pool_->baseAddr()) % pageBytes);
+
+            // A 1 GB page holds more than one descriptor can describe, so we split it on 4K
+            // boundaries
+            run = min(run, (size_t)(DESC_MAX_LENGTH & ~4095));
+
+            // Extend the previous descriptor if this run follows it
+            if (!batch.empty() && batch.back().hostAddr + batch.back().length == phys
+                               && batch.back().length + run <= DESC_MAX_LENGTH)
+                batch.back().length += run;
+            else
+                batch.push_back({phys, cardAddr + done + offset, (uint32_t)run});
+
+            offset += run;
+        }
+
+        // Move the data
+        submit(ch, batch);
+
+        // If we're downloading, fetch the data out of the bounce buffer
+        if (ch.dir == C2H) memcpy(host + done, ch.bounce.virtAddr, count);
+
+        done += count;
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// copy() - Copies host memory to or from the card over every channel in one direction
+//
+// The buffer is split into one slice per channel, and each slice is copied by its own thread
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::copy(direction_t dir, uint8_t* host, uint64_t cardAddr, size_t length)
+{
+    auto&          list = (dir == H2C) ? h2c_ : c2h_;
+    vector<thread> worker;
+    vector<string> error(list.size());
+
+    // If there's nothing to do, don't do it
+    if (length == 0) return;
+
+    // If there are no channels in this direction, we can't do anything
+    if (list.empty()) throwRuntime("There are no XDMA %s channels", directionName(dir));
+
+    // Each channel gets an equal, 4K aligned slice of the buffer
+    size_t slice = ((length + list.size() - 1) / list.size() + 4095) & ~(size_t)4095;
+
+    // Copy each slice in its own thread
+    for (size_t i = 0; i < list.size() && i * slice < length; ++i)
+    {
+        size_t offset = i * slice;
+        size_t count  = min(slice, length - offset);
+        worker.emplace_back([&, i, offset, count]()
+        {
+            try
+            {
+                copySlice(*list[i], host + offset, cardAddr + offset, count);
+            }
+            catch(const std::runtime_error& e)
+            {
+                error[i] = e.what();
+            }
+        });
+    }
+
+    // Wait for every slice to be copied
+    for (auto& w : worker) w.join();
+
+    // If any channel failed, tell the caller
+    string message;
+    for (auto& e : error) if (!e.empty()) message += (message.empty() ? "" : "; ") + e;
+    if (!message.empty()) throwRuntime("%s", c(message));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// upload() - Copies ordinary host memory to the card
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::upload(const void* src, uint64_t cardAddr, size_t length)
+{
+    copy(H2C, (uint8_t*)src, cardAddr, length);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// download() - Copies memory on the card to ordinary host memory
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void XdmaEngine::download(uint64_t cardAddr, void* dst, size_t length)
+{
+    copy(C2H, (uint8_t*)dst, cardAddr, length);
+}
+//=================================================================================================
@@ -0,0 +1,202 @@
+//=================================================================================================
+// XdmaEngine.h - Defines a user-space driver for the DMA channels of a Xilinx XDMA core
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include "Mmio.h"
+#include "DmaPool.h"
+
+class XdmaEngine
+{
+public:
+
+    // The direction of a transfer
+    enum direction_t
+    {
+        H2C,                            // Host to card
+        C2H                             // Card to host
+    };
+
+    // Offsets of the blocks within the XDMA register BAR.  Each block has one 256-byte set of
+    // registers per channel
+    enum
+    {
+        H2C_CHANNEL    = 0x0000,
+        C2H_CHANNEL    = 0x1000,
+        H2C_SGDMA      = 0x4000,
+        C2H_SGDMA      = 0x5000,
+        CHANNEL_STRIDE = 0x0100,
+        MAX_CHANNELS   = 4
+    };
+
+    // Offsets of the registers of a channel
+    enum
+    {
+        CH_IDENTIFIER  = 0x00,
+        CH_CONTROL     = 0x04,
+        CH_CONTROL_W1S = 0x08,          // Writing a 1 sets that bit of the control register
+        CH_CONTROL_W1C = 0x0C,          // Writing a 1 clears that bit of the control register
+        CH_STATUS      = 0x40,
+        CH_STATUS_RC   = 0x44,          // The status register, cleared by reading it
+        CH_COMPLETED   = 0x48,          // The number of descriptors completed since "run" was set
+        CH_POLL_WB_LO  = 0x88,          // Physical address of the poll-mode writeback word
+        CH_POLL_WB_HI  = 0x8C
+    };
+
+    // Offsets of the registers of a channel's scatter-gather block
+    enum
+    {
+        SG_IDENTIFIER  = 0x00,
+        SG_DESC_LO     = 0x80,          // Physical address of the first descriptor
+        SG_DESC_HI     = 0x84,
+        SG_DESC_ADJ    = 0x88           // The number of descriptors adjacent to the first one
+    };
+
+    // Fields of the identifier registers
+    enum
+    {
+        ID_MASK        = 0xFFF00000,
+        ID_XDMA        = 0x1FC00000,
+        ID_TARGET_H2C  = 0x0,           // Bits 19:16 identify the block
+        ID_TARGET_C2H  = 0x1,
+        ID_TARGET_H2C_SGDMA = 0x4,
+        ID_TARGET_C2H_SGDMA = 0x5
+    };
+
+    // Bits in the channel control register.  The "interrupt enable" bits also make the
+    // engine stop and report the corresponding events in the status register
+    enum
+    {
+        CONTROL_RUN     = 0x00000001,
+        CONTROL_IE_ALL  = 0x00FFFE3E,
+        CONTROL_POLL_WB = 0x04000000    // Write the completed count to host memory
+    };
+
+    // Fields of the poll-mode writeback word
+    enum
+    {
+        WB_COUNT_MASK   = 0x00FFFFFF,   // The number of descriptors completed
+        WB_ERROR        = 0x80000000    // The engine stopped because of an error
+    };
+
+    // Bits in the channel status register
+    enum
+    {
+        STATUS_BUSY           = 0x00000001,
+        STATUS_DESC_STOPPED   = 0x00000002,
+        STATUS_DESC_COMPLETED = 0x00000004,
+        STATUS_ALIGN_MISMATCH = 0x00000008,
+        STATUS_MAGIC_STOPPED  = 0x00000010,
+        STATUS_INVALID_LENGTH = 0x00000020,
+        STATUS_READ_ERROR     = 0x00003E00,
+        STATUS_WRITE_ERROR    = 0x0007C000,
+        STATUS_DESC_ERROR     = 0x00F80000,
+        STATUS_ERRORS         = 0x00FFFE38
+    };
+
+    // Fields of the control word of a descriptor
+    enum
+    {
+        DESC_MAGIC      = 0xAD4B0000,
+        DESC_STOP       = 0x00000001,
+        DESC_COMPLETED  = 0x00000002,
+        DESC_EOP        = 0x00000010,
+        DESC_ADJ_SHIFT  = 8,
+        DESC_MAX_ADJ    = 63,
+        DESC_MAX_LENGTH = 0x0FFFFFFF
+    };
+
+    // A descriptor, as the engine reads it from host memory.  The engine fetches descriptors
+    // in blocks that mustn't cross a 4K boundary
+    struct descriptor_t
+    {
+        uint32_t    control;            // DESC_MAGIC | (adjacent << 8) | flags
+        uint32_t    length;             // The number of bytes to transfer
+        uint64_t    srcAddr;            // H2C: host physical address.  C2H: card address
+        uint64_t    dstAddr;            // H2C: card address.  C2H: host physical address
+        uint64_t    nextAddr;           // Physical address of the next descriptor
+    };
+
+    // One transfer between host memory and the card
+    struct transfer_t
+    {
+        uint64_t    hostAddr;           // The physical address of the host side of the transfer
+        uint64_t    cardAddr;           // The card's address of the other side
+        uint32_t    length;             // The number of bytes to transfer
+    };
+
+    // Settings that control the engine
+    struct options_t
+    {
+        int         ringSize    = 1024;     // The number of descriptors in each channel's ring
+        size_t      bounceBytes = 4 << 20;  // Size of each channel's bounce buffer for upload()/download()
+        int         timeoutMs   = 5000;     // How long a batch of descriptors may take
+    };
+
+    // Default constructor - not attached to a DMA core
+    XdmaEngine() {}
+
+    // Finds the DMA channels in the register block and carves a descriptor ring and a bounce
+    // buffer for each of them out of "pool".  Throws std::runtime_error
+    void        attach(const Mmio& regs, DmaPool& pool);
+    void        attach(const Mmio& regs, DmaPool& pool, const options_t& opts);
+
+    // The number of channels in each direction
+    int         channels(direction_t dir) const;
+
+    // Performs a batch of transfers on one channel, and waits for them to complete.  Different
+    // channels may be driven by different threads at the same time.  Throws std::runtime_error
+    void        run(direction_t dir, int channel, const std::vector<transfer_t>& batch);
+
+    // Copies ordinary host memory to and from the card, spreading the work across every
+    // channel in that direction, each driven by its own thread.  Throws std::runtime_error
+    void        upload  (const void* src, uint64_t cardAddr, size_t length);
+    void        download(uint64_t cardAddr, void* dst, size_t length);
+
+protected:
+
+    // One DMA channel, and the host memory that belongs to it
+    struct channel_t
+    {
+        direction_t      dir;
+        int              index;
+        size_t           regs;          // Offset of the channel's registers
+        size_t           sgdma;         // Offset of the channel's scatter-gather registers
+        DmaPool::chunk_t ring;          // The channel's descriptors
+        DmaPool::chunk_t bounce;        // Where upload() and download() stage data
+        DmaPool::chunk_t writeback;     // Where the engine reports its progress
+        std::mutex       lock;          // Only one thread may drive a channel at a time
+    };
+
+    // Returns a channel.  Throws std::runtime_error if it doesn't exist
+    channel_t&  channel(direction_t dir, int index);
+
+    // Runs a batch of any size on a channel, a ring-full at a time
+    void        submit(channel_t& ch, const std::vector<transfer_t>& batch);
+
+    // Runs a batch of no more than ringSize transfers on a channel
+    void        runBatch(channel_t& ch, const transfer_t* batch, size_t count);
+
+    // Copies one slice of an upload() or download() through a channel's bounce buffer
+    void        copySlice(channel_t& ch, uint8_t* host, uint64_t cardAddr, size_t length);
+
+    // Copies host memory to or from the card over every channel in one direction
+    void        copy(direction_t dir, uint8_t* host, uint64_t cardAddr, size_t length);
+
+    // The XDMA register block
+    Mmio        regs_;
+
+    // The pool that holds the descriptor rings and bounce buffers
+    DmaPool*    pool_ = nullptr;
+
+    // Our settings
+    options_t   opts_;
+
+    // The channels we found, in each direction
+    std::vector<std::unique_ptr<channel_t>> h2c_, c2h_;
+};
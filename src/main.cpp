@@ -1,12 +1,33 @@
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
-#include <cstdarg>
 #include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include "config_file.h"
 #include "PciDevice.h"
+#include "PciBus.h"
+#include "Mmio.h"
+#include "MmioTrace.h"
+#include "MmioBenchmark.h"
+#include "DmaPool.h"
+#include "XdmaEngine.h"
+#include "RegisterScript.h"
+#include "LoadDaemon.h"
+#include "LoadCache.h"
+#include "Sha256.h"
+#include "Process.h"
+#include "Utility.h"
 
 // Bring in the std library
 using namespace std;
@@ -14,9 +35,24 @@ using namespace std;
 
 // Global variables
 bool      performHotReset = false;
+bool      runDaemon       = false;
+bool      useDaemon       = false;
+bool      forceLoad       = false;
 string    configFile      = "load_bitstream.conf";
 string    bitstream;
 string    ipAddress       = "10.11.12.2:3121";
+string    fleetFile;
+int       fleetWorkers    = 4;
+bool      listDevices     = false;
+bool      benchmarkMode   = false;
+bool      benchmarkJson   = false;
+int       benchmarkBar    = 0;
+size_t    benchmarkMemfdMB= 0;
+size_t    benchmarkOffset = 0;
+size_t    benchmarkLength = 0;
+bool      benchmarkWrite  = false;
+string    traceFile;
+string    decodeFile;
 PciDevice PCI;
 
 // These values are read in from the config file durint init()
@@ -24,19 +60,59 @@ struct
 {
     string          tmpDir;
     string          vivado;
+    double          vivadoTimeout;
     string          pciDevice;
     vector<string>  programmingScript;
+    string          daemonSocket;
+    vector<string>  daemonStartupScript;
+    vector<string>  daemonConnectScript;
+    vector<string>  daemonProgrammingScript;
+    bool            skipIfLoaded;
+    string          loadCache;
+    int32_t         fingerprintBar;
+    uint32_t        fingerprintOffset;
+    PciDevice::resetopts_t resetOpts;
+    PciDevice::mapopts_t   mapOpts;
+    vector<string>  dmaUpload;
+    int32_t         dmaBar;
+    uint32_t        dmaPoolMB;
+    bool            dmaHugePages;
+    RegisterScript  postLoadScript;
 } config;
 
+// In fleet mode, this describes one board to be programmed and the outcome
+struct fleetjob_t
+{
+    string  ipAddress;
+    string  bitstream;
+    string  pciDevice;
+    bool    ok;
+    bool    skipped;
+    string  error;
+    double  loadSeconds;
+    double  resetSeconds;
+    string  hash;
+};
+
 //=================================================================================================
 //                                Forward Declarations
 //=================================================================================================
 void execute();
+void serveDaemon();
 void parseCommandLine(int argc, const char** argv);
 void readConfigFile(string filename);
-void loadBitstream();
+void runFleet();
+void runBenchmark();
+void runListDevices();
+void uploadVectors();
+void runPostLoadScript();
+void saveTrace();
+void loadBitstream(const vector<string>& script, string tmpName);
 void hotReset(string device);
-void performMacroSubstitutions(vector<string>& v);
+void reportReset(const PciDevice::resetresult_t& result);
+void performMacroSubstitutions(vector<string>& v, string file, string ip);
+bool alreadyLoaded(string file, string ip, string pciDevice, string* pHash);
+void recordLoad(string ip, string hash, string pciDevice);
 //=================================================================================================
 
 
@@ -58,9 +134,13 @@ int main(int argc, const char** argv)
     catch(const std::runtime_error& e)
     {
         std::cerr << e.what() << '\n';
+        saveTrace();
         exit(1);
     }
 
+    // If we've been asked to, save the record of register accesses
+    saveTrace();
+
     // If we get here, all is well    
     return 0;
 }
@@ -72,6 +152,20 @@ int main(int argc, const char** argv)
 //=================================================================================================
 void execute()
 {
+    // Decoding a trace file needs neither root nor a config file
+    if (!decodeFile.empty())
+    {
+        MmioTrace::decode(decodeFile);
+        return;
+    }
+
+    // Benchmarking an in-memory stand-in for a BAR needs neither root nor a config file
+    if (benchmarkMode && benchmarkMemfdMB)
+    {
+        runBenchmark();
+        return;
+    }
+
     // This is the equivalent of "sudo" 
     setuid(0);
 
@@ -81,118 +175,149 @@ void execute()
     // Read the configuration file
     readConfigFile(configFile);
 
-    // Perform macro substitutions on the programming script
-    performMacroSubstitutions(config.programmingScript);
+    // If we've been asked to run as a daemon, do so.  This never returns
+    if (runDaemon) serveDaemon();
 
-    // Load the bitstream into the FPGA
-    loadBitstream();
-
-    // If the user requested a hot-reset, re-enumerate the PCI bus
-    if (performHotReset) PCI.hotReset(config.pciDevice);
-}
-//=================================================================================================
+    // If we've been asked to list the PCI devices, do so
+    if (listDevices)
+    {
+        runListDevices();
+        return;
+    }
 
+    // If we've been asked to benchmark the PCI device, do so
+    if (benchmarkMode)
+    {
+        runBenchmark();
+        return;
+    }
 
+    // If we've been asked to program a whole fleet of boards, do so
+    if (!fleetFile.empty())
+    {
+        runFleet();
+        return;
+    }
 
+    // If the FPGA already holds this bitstream, neither loading it nor resetting the FPGA is
+    // needed.  Its registers are still initialized and its test vectors are still sent
+    string hash;
+    bool   skipLoad = alreadyLoaded(bitstream, ipAddress, config.pciDevice, &hash);
+    if (skipLoad) printf("%s is already loaded, skipping load\n", bitstream.c_str());
 
+    // If there's a daemon running, have it load the bitstream into the FPGA
+    else if (useDaemon)
+        LoadDaemon::request(config.daemonSocket, std::filesystem::absolute(bitstream).string(), ipAddress);
 
-//==========================================================================================================
-// throwRuntime() - Throws a runtime exception
-//==========================================================================================================
-static void throwRuntime(const char* fmt, ...)
-{
-    char buffer[1024];
-    va_list ap;
-    va_start(ap, fmt);
-    vsprintf(buffer, fmt, ap);
-    va_end(ap);
+    // Otherwise, run Vivado ourselves to load the bitstream
+    else
+    {
+        // Perform macro substitutions on the programming script
+        performMacroSubstitutions(config.programmingScript, bitstream, ipAddress);
 
-    throw runtime_error(buffer);
-}
-//=========================================================================================================
+        // Load the bitstream into the FPGA
+        loadBitstream(config.programmingScript, "load_bitstream");
+    }
 
+    // If the user requested a hot-reset, re-enumerate the PCI bus
+    if (performHotReset && !skipLoad)
+    {
+        for (auto& result : PciDevice::hotResetAll(config.pciDevice, config.resetOpts)) reportReset(result);
+    }
 
-//==========================================================================================================
-// c() - Shorthand way of converting a std::string to a const char*
-//==========================================================================================================
-const char* c(string& s) {return s.c_str();}
-//==========================================================================================================
+    // If there are registers to initialize, initialize them
+    if (!config.postLoadScript.empty()) runPostLoadScript();
 
+    // If there are test vectors to send to the card, send them
+    if (!config.dmaUpload.empty()) uploadVectors();
 
-//==========================================================================================================
-// chomp() - Removes any carriage-return or linefeed from the end of a buffer
-//==========================================================================================================
-static void chomp(char* buffer)
-{
-    char* p;
-    p = strchr(buffer, 10);
-    if (p) *p = 0;
-    p = strchr(buffer, 13);
-    if (p) *p = 0;
+    // Remember what we loaded so that the next identical request can be skipped
+    if (!skipLoad) recordLoad(ipAddress, hash, config.pciDevice);
 }
-//==========================================================================================================
+//=================================================================================================
+
+
+
 
 
 //=================================================================================================
-// shell() - Executes a shell command and returns the output as a vector of strings
+// runVivado() - Runs a TCL script in Vivado batch mode, streaming the output as it arrives
+//
+// Passed: tclFilename    = the name of the TCL script that Vivado should execute
+//         resultFilename = the name of the file where Vivado's output should be logged
+//
+// Returns: The first ERROR line that Vivado emitted, or an empty string if there was none
+//
+// Each line of output is written to the result file as soon as it arrives.  On the first
+// ERROR line, the entire Vivado process group is killed rather than waiting for Vivado to
+// finish tearing itself down.
+//
+// Can throw std::runtime_error if Vivado times out, is killed, or exits with a non-zero status
 //=================================================================================================
-static vector<string> shell(const char* fmt, ...)
+static string runVivado(string tclFilename, string resultFilename)
 {
-    vector<string> result;
-    va_list        ap;
-    char           command[1024];
-    char           buffer[1024];
+    string error;
 
-    // Format the command
-    va_start(ap, fmt);
-    vsprintf(command, fmt, ap);
-    va_end(ap);
+    // Create the file where Vivado's output gets logged
+    FILE* ofile = fopen(c(resultFilename), "we");
 
-    // Run the command
-    FILE* fp = popen(command, "r");
+    // This gets called with each line of Vivado output as it arrives
+    auto onLine = [&](const string& line)
+    {
+        // Log this line immediately
+        if (ofile)
+        {
+            fprintf(ofile, "%s\n", line.c_str());
+            fflush(ofile);
+        }
+
+        // If this is a fatal error, there's no point in letting Vivado continue
+        if (classifyLine(line) == LC_ERROR)
+        {
+            error = line;
+            return false;
+        }
 
-    // If we couldn't do that, give up
-    if (fp == nullptr) return result;
+        // Otherwise, keep going
+        return true;
+    };
 
-    // Fetch every line of the output and push it to our vector of strings
-    while (fgets(buffer, sizeof buffer, fp))
+    // Run Vivado
+    Process::result_t result;
+    try
+    {
+        result = Process::run({config.vivado, "-nojournal", "-nolog", "-mode", "batch", "-source", tclFilename},
+                              config.vivadoTimeout, onLine);
+    }
+    catch(const std::runtime_error& e)
     {
-        chomp(buffer);
-        result.push_back(buffer);
+        if (ofile) fclose(ofile);
+        throw;
     }
 
-    // When the program finishes, close the FILE*
-    fclose(fp);
+    // Record how long Vivado ran and what resources it consumed
+    if (ofile)
+    {
+        fprintf(ofile, "load_bitstream: wall %.1fs, cpu %.1fs user + %.1fs system, peak rss %ld KB\n",
+                result.wallSeconds, result.userSeconds, result.systemSeconds, result.peakRssKB);
+        fclose(ofile);
+    }
 
-    // And hand the output of the program (1 string per line) to the caller
-    return result;
-}
-//=================================================================================================
+    // If Vivado ran out of time, say so
+    if (result.timedOut) throwRuntime("%s timed out after %.0f seconds", c(config.vivado), result.wallSeconds);
 
+    // If we killed Vivado because of an ERROR line, the caller reports that line
+    if (!error.empty()) return error;
 
+    // Otherwise, Vivado has to have exited cleanly for the load to count
+    if (result.signal != 0) throwRuntime("%s was killed by signal %d", c(config.vivado), result.signal);
+    if (result.exitCode != 0) throwRuntime("%s exited with status %d", c(config.vivado), result.exitCode);
 
+    // Tell the caller that there was no error
+    return error;
+}
 //=================================================================================================
-// writeStrVecToFile() - Helper function that writes a vector of strings to a file, with a linefeed 
-//                       appended to the end of each line.
-//=================================================================================================
-static bool writeStrVecToFile(vector<string>& v, string filename)
-{
-    // Create the output file
-    FILE* ofile = fopen(c(filename), "w");
-    
-    // If we can't create the output file, whine to the caller
-    if (ofile == nullptr) return false;    
 
-    // Write each line in the vector to the output file
-    for (string& s : v) fprintf(ofile, "%s\n", c(s));
-
-    // We're done with the output file
-    fclose(ofile);
-
-    // And tell the caller that all is well
-    return true;
-}
-//==========================================================================================================
 
 
 //=================================================================================================
@@ -201,11 +326,27 @@ static bool writeStrVecToFile(vector<string>& v, string filename)
 // On Exit: bitstream       = Name of the bitstream file
 //          performHotReset = true, if we should do a PCI hot_reset after loading bitstream
 //          configFile      = Name of the configuration file
+//          runDaemon       = true, if we should run as a daemon that services load requests
+//          useDaemon       = true, if a running daemon should load the bitstream for us
+//          forceLoad       = true, if we should load the bitstream even if it's already loaded
+//          fleetFile       = Name of the file containing a list of boards to program
+//          fleetWorkers    = The number of boards to program concurrently
+//          listDevices     = true, if we should list every PCI device matching pci_device
+//          benchmarkMode   = true, if we should benchmark MMIO access to the PCI device
+//          benchmarkBar    = The BAR to benchmark
+//          benchmarkJson   = true, if benchmark results should be written as JSON
+//          benchmarkMemfdMB= If non-zero, benchmark a memfd of this many megabytes instead
+//          benchmarkOffset = The start of the region of the BAR the benchmark may touch
+//          benchmarkLength = The length of that region, or 0 for the rest of the BAR
+//          benchmarkWrite  = true, if the benchmark may overwrite that region
+//          traceFile       = If not empty, the file to save the trace of register accesses to
+//          decodeFile      = If not empty, the trace file to print
 //=================================================================================================
 void parseCommandLine(int argc, const char** argv)
 {
     int idx = 1;
     vector<string> param;
+    bool haveOffset = false, haveLength = false;
 
     // So long as we have parameters to parse...
     while (idx < argc)
@@ -217,6 +358,80 @@ void parseCommandLine(int argc, const char** argv)
         if (arg ==  "-hot_reset")
             performHotReset = true;
 
+        // Is this the "-daemon" switch?
+        else if (arg == "-daemon")
+            runDaemon = true;
+
+        // Is this the "-via_daemon" switch?
+        else if (arg == "-via_daemon")
+            useDaemon = true;
+
+        // Is this the "-force" switch?
+        else if (arg == "-force")
+            forceLoad = true;
+
+        // Is the user specifying a fleet job-file?
+        else if (arg == "-fleet" && argv[idx])
+            fleetFile = argv[idx++];
+
+        // Is the user specifying how many boards to program concurrently?
+        else if (arg == "-workers" && argv[idx])
+            fleetWorkers = atoi(argv[idx++]);
+
+        // Is this the "-list" switch?
+        else if (arg == "-list")
+            listDevices = true;
+
+        // Is this the "-benchmark" switch?
+        else if (arg == "-benchmark")
+            benchmarkMode = true;
+
+        // Is the user specifying which BAR to benchmark?
+        else if (arg == "-bar" && argv[idx])
+            benchmarkBar = atoi(argv[idx++]);
+
+        // Is the user specifying the region of the BAR to benchmark?
+        else if (arg == "-offset" && argv[idx])
+        {
+            benchmarkOffset = strtoull(argv[idx++], nullptr, 0);
+            haveOffset      = true;
+        }
+        else if (arg == "-length" && argv[idx])
+        {
+            benchmarkLength = strtoull(argv[idx++], nullptr, 0);
+            haveLength      = true;
+        }
+
+        // Is the user allowing the benchmark to overwrite that region?
+        else if (arg == "-write")
+            benchmarkWrite = true;
+
+        // Is this the "-json" switch?
+        else if (arg == "-json")
+            benchmarkJson = true;
+
+        // Is the user asking to benchmark a memfd instead of the PCI device?
+        else if (arg == "-memfd" && argv[idx])
+        {
+            benchmarkMode    = true;
+            benchmarkMemfdMB = atoi(argv[idx++]);
+        }
+
+        // Is the user asking for a trace of the register accesses?
+        else if (arg == "-mmio_trace" && argv[idx])
+        {
+            if (!MmioTrace::compiledIn())
+            {
+                printf("-mmio_trace requires a build with MMIO tracing (cmake -DMMIO_TRACE=ON)\n");
+                exit(1);
+            }
+            traceFile = argv[idx++];
+        }
+
+        // Is the user asking to print a trace file?
+        else if (arg == "-decode_trace" && argv[idx])
+            decodeFile = argv[idx++];
+
         // Is the user specifying a config file?
         else if (arg == "-config" && argv[idx])
             configFile = argv[idx++];
@@ -233,11 +448,26 @@ void parseCommandLine(int argc, const char** argv)
         }
     }
 
+    // Writing to a BAR is only allowed within a region the user has spelled out
+    if (benchmarkWrite && !benchmarkMemfdMB && !(haveOffset && haveLength && benchmarkLength))
+    {
+        printf("-write requires the region it may overwrite: -offset <offset> -length <bytes>\n");
+        exit(1);
+    }
+
+    // A daemon, a fleet, a benchmark, or decoding a trace doesn't need a bitstream filename
+    if (runDaemon || !fleetFile.empty() || benchmarkMode || listDevices || !decodeFile.empty()) return;
+
     // If there's no filename on the command line, just show the usage
     if (param.empty())
     {
         printf("usage:\n");
-        printf("load_bitstream <filename> [-hot_reset] [-config <filename>]\n");
+        printf("load_bitstream <filename> [ip_address] [-hot_reset] [-force] [-via_daemon] [-mmio_trace <trace_file>] [-config <filename>]\n");
+        printf("load_bitstream -fleet <job_file> [-workers <count>] [-hot_reset] [-force] [-via_daemon] [-config <filename>]\n");
+        printf("load_bitstream -daemon [-config <filename>]\n");
+        printf("load_bitstream -list [-config <filename>]\n");
+        printf("load_bitstream -benchmark [-bar <n>] [-offset <offset>] [-length <bytes>] [-write] [-json] [-hot_reset] [-memfd <megabytes>] [-config <filename>]\n");
+        printf("load_bitstream -decode_trace <trace_file>\n");
         exit(1);
     }
 
@@ -251,6 +481,38 @@ void parseCommandLine(int argc, const char** argv)
 
 
 
+//=================================================================================================
+// readTuningProfile() - Reads the [pcie_tuning] section of the configuration file
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static void readTuningProfile(CConfigFile& cf, PcieTuning::profile_t& profile)
+{
+    bool flag;
+
+    // The tuning settings live in their own section
+    cf.set_current_section("pcie_tuning");
+
+    // Fetch the maximum payload and read-request sizes
+    if (cf.exists("max_payload_size"     )) cf.get("max_payload_size",      &profile.maxPayload);
+    if (cf.exists("max_read_request_size")) cf.get("max_read_request_size", &profile.maxReadRequest);
+
+    // Find out whether relaxed ordering and extended tags should be enabled or disabled
+    if (cf.exists("relaxed_ordering")) {cf.get("relaxed_ordering", &flag); profile.relaxedOrdering = flag;}
+    if (cf.exists("extended_tags"   )) {cf.get("extended_tags",    &flag); profile.extendedTags    = flag;}
+
+    // Find out whether ASPM should be disabled
+    if (cf.exists("disable_aspm")) cf.get("disable_aspm", &profile.disableAspm);
+
+    // Go back to looking for keys in the global section
+    cf.set_current_section("");
+
+    // Make sure the values are legal
+    PcieTuning::validate(profile);
+}
+//=================================================================================================
+
+
 //=================================================================================================
 // readConfigFile() - Reads in the configuration file
 //=================================================================================================
@@ -268,24 +530,161 @@ void readConfigFile(string filename)
     // Fetch the name of the Vivado executable
     cf.get("vivado", &config.vivado);
 
+    // Fetch the maximum number of seconds that Vivado may run
+    config.vivadoTimeout = 0;
+    if (cf.exists("vivado_timeout")) cf.get("vivado_timeout", &config.vivadoTimeout);
+
     // Fetch the PCI vendorID:deviceID of the FPGA card
-    if (performHotReset) cf.get("pci_device", &config.pciDevice);
+    if (performHotReset || benchmarkMode || listDevices || cf.exists("pci_device") || cf.exists("dma_upload") || cf.exists("post_load_script")) cf.get("pci_device", &config.pciDevice);
+
+    // Find out whether a hot-reset should poll for link-up rather than sleep a fixed time
+    if (cf.exists("adaptive_reset")) cf.get("adaptive_reset", &config.resetOpts.adaptive);
+
+    // Fetch the link speed (in GT/s) and width the device should train at after a hot-reset
+    if (cf.exists("link_target_speed")) cf.get("link_target_speed", &config.resetOpts.targetSpeed);
+    if (cf.exists("link_target_width")) cf.get("link_target_width", &config.resetOpts.targetWidth);
+
+    // Find out whether configuration registers are restored after a hot-reset
+    if (cf.exists("restore_config")) cf.get("restore_config", &config.resetOpts.restoreConfig);
+
+    // Fetch the reset methods to try, in order of preference
+    if (cf.exists("reset_method"))
+    {
+        vector<string> methods;
+        cf.get("reset_method", &methods);
+        config.resetOpts.methods.clear();
+        for (auto& method : methods) config.resetOpts.methods.push_back(PciDevice::parseResetMethod(method));
+    }
+
+    // Find out whether the kernel's reset methods ("flr" or "bus") were asked for
+    bool kernelMethod = false;
+    for (auto method : config.resetOpts.methods)
+    {
+        if (method != PciDevice::RESET_MANUAL) kernelMethod = true;
+    }
+
+    // Find out whether the device is removed and rescanned.  The kernel's methods only work if
+    // it isn't, so unless we're told otherwise, asking for one of them leaves the device in place
+    config.resetOpts.removeDevice = !kernelMethod;
+    if (cf.exists("reset_remove_device")) cf.get("reset_remove_device", &config.resetOpts.removeDevice);
+
+    // If the kernel's methods were asked for but can't be used, say so
+    if (kernelMethod && config.resetOpts.removeDevice && (performHotReset || !fleetFile.empty()))
+    {
+        fprintf(stderr, "WARNING: reset_method \"flr\" and \"bus\" are ignored while reset_remove_device is true\n");
+    }
+
+    // Fetch the number of times a degraded link should be retrained
+    if (cf.exists("link_retrain_attempts")) cf.get("link_retrain_attempts", &config.resetOpts.retrainAttempts);
+
+    // Fetch the PCIe performance settings to apply after a hot-reset
+    readTuningProfile(cf, config.resetOpts.tuning);
+
+    // Find out whether we should skip loading a bitstream that's already loaded
+    config.skipIfLoaded = false;
+    if (cf.exists("skip_if_loaded")) cf.get("skip_if_loaded", &config.skipIfLoaded);
+
+    // Fetch the name of the file that records what's loaded in each FPGA
+    config.loadCache = config.tmpDir + "/load_bitstream.cache";
+    if (cf.exists("load_cache")) cf.get("load_cache", &config.loadCache);
+
+    // Fetch the BAR and offset of the register that fingerprints the loaded design
+    config.fingerprintBar = -1;
+    if (cf.exists("fingerprint_register")) cf.get("fingerprint_register", "iI", &config.fingerprintBar, &config.fingerprintOffset);
+
+    // The cache alone can't tell that a board was power-cycled or loaded by something else, so
+    // we won't skip a load unless the FPGA itself can confirm what it holds
+    if (config.skipIfLoaded && config.fingerprintBar < 0)
+    {
+        fprintf(stderr, "WARNING: skip_if_loaded is ignored because no fingerprint_register is configured\n");
+        config.skipIfLoaded = false;
+    }
+
+    // Find out whether BARs are mapped through sysfs or /dev/mem
+    if (cf.exists("bar_mapping"))
+    {
+        string method;
+        cf.get("bar_mapping", &method);
+        if      (method == "sysfs" ) config.mapOpts.method = PciDevice::MAP_SYSFS;
+        else if (method == "devmem") config.mapOpts.method = PciDevice::MAP_DEVMEM;
+        else throw runtime_error("Unknown bar_mapping '" + method + "'");
+    }
+
+    // Fetch the cache policy of each BAR
+    if (cf.exists("bar_cache"))
+    {
+        vector<string> policies;
+        cf.get("bar_cache", &policies);
+        for (auto& policy : policies) config.mapOpts.cache.push_back(PciDevice::parseCachePolicy(policy));
+    }
+
+    // Find out whether BAR mappings should be pre-faulted and aligned for huge pages
+    if (cf.exists("bar_populate"  )) cf.get("bar_populate",   &config.mapOpts.populate);
+    if (cf.exists("bar_huge_align")) cf.get("bar_huge_align", &config.mapOpts.hugeAlign);
+
+    // Find out whether we should move to the device's NUMA node before touching its BARs
+    if (cf.exists("numa_bind")) cf.get("numa_bind", &config.mapOpts.numaBind);
+
+    // Fetch the list of test-vector files to DMA to the card, each followed by its card address
+    if (cf.exists("dma_upload")) cf.get("dma_upload", &config.dmaUpload);
+    if (config.dmaUpload.size() % 2) throw runtime_error("dma_upload must list a card address after each file");
+
+    // Fetch the BAR of the XDMA core's registers, and how much pinned memory the DMA may use
+    config.dmaBar       = 1;
+    config.dmaPoolMB    = 64;
+    config.dmaHugePages = true;
+    if (cf.exists("dma_bar"      )) cf.get("dma_bar",       &config.dmaBar);
+    if (cf.exists("dma_pool_mb"  )) cf.get("dma_pool_mb",   &config.dmaPoolMB);
+    if (cf.exists("dma_hugepages")) cf.get("dma_hugepages", &config.dmaHugePages);
 
     // Fetch the TCL script that we will use to program the bitstream
     cf.get_script_vector("programming_script", &config.programmingScript);
 
+    // Compile the register accesses to perform after a load, so mistakes show up before we load
+    if (cf.exists("post_load_script"))
+    {
+        CConfigScript script;
+        cf.get("post_load_script", &script);
+        config.postLoadScript.compile(script, "post_load_script");
+    }
+
+    // The daemon settings are only required when we're using a daemon
+    if (!runDaemon && !useDaemon) return;
+
+    // Fetch the name of the UNIX socket the daemon listens on
+    config.daemonSocket = config.tmpDir + "/load_bitstream.sock";
+    if (cf.exists("daemon_socket")) cf.get("daemon_socket", &config.daemonSocket);
+
+    // Fetch the TCL scripts that the daemon uses
+    if (runDaemon)
+    {
+        cf.get_script_vector("daemon_startup_script",     &config.daemonStartupScript);
+        cf.get_script_vector("daemon_connect_script",     &config.daemonConnectScript);
+        cf.get_script_vector("daemon_programming_script", &config.daemonProgrammingScript);
+    }
 }
 //=================================================================================================
 
 
 //=================================================================================================
-// replace() - Replaces the "from" string with the "to" string if the "from" string exists
+// serveDaemon() - Runs as a daemon that keeps Vivado open and loads bitstreams on request
 //=================================================================================================
-void replace(string& str, string from, string to)
+void serveDaemon()
 {
-    size_t start_pos = str.find(from);
-    if (start_pos == std::string::npos) return;
-    str.replace(start_pos, from.length(), to);
+    LoadDaemon::config_t dc;
+
+    // Hand the daemon its configuration
+    dc.vivado            = config.vivado;
+    dc.tmpDir            = config.tmpDir;
+    dc.socketName        = config.daemonSocket;
+    dc.timeout           = config.vivadoTimeout;
+    dc.startupScript     = config.daemonStartupScript;
+    dc.connectScript     = config.daemonConnectScript;
+    dc.programmingScript = config.daemonProgrammingScript;
+
+    // Create the daemon and let it service requests forever
+    LoadDaemon daemon(dc);
+    daemon.run();
 }
 //=================================================================================================
 
@@ -295,12 +694,12 @@ void replace(string& str, string from, string to)
 //
 // A "macro" is any string in the form "%some_keyword%"
 //=================================================================================================
-void performMacroSubstitutions(vector<string>& v)
+void performMacroSubstitutions(vector<string>& v, string file, string ip)
 {
     for (auto& line : v)
     {
-        replace(line, "\%file\%", bitstream);
-        replace(line, "\%ip_address\%", ipAddress);
+        replace(line, "\%file\%", file);
+        replace(line, "\%ip_address\%", ip);
     }
 }
 //=================================================================================================
@@ -309,43 +708,749 @@ void performMacroSubstitutions(vector<string>& v)
 
 //=================================================================================================
 // loadBitstream - Programs the bitstream into the FPGA
+//
+// Passed: script  = the TCL script (with macros already substituted) that loads the bitstream
+//         tmpName = the base name of the temporary files that we create in tmp_dir
 //=================================================================================================
-void loadBitstream()
+void loadBitstream(const vector<string>& script, string tmpName)
 {
     // Create the filename of the TCL script we want Vivado to execute
-    string tclFilename = config.tmpDir + "/load_bitstream.tcl";
+    string tclFilename = config.tmpDir + "/" + tmpName + ".tcl";
     
     // Create the filename where we want to store the script output
-    string resultFilename = config.tmpDir + "/load_bitstream.result";
+    string resultFilename = config.tmpDir + "/" + tmpName + ".result";
 
     // Write the master-bitstream TCL script to disk
-    if (!writeStrVecToFile(config.programmingScript, tclFilename)) 
+    if (!writeStrVecToFile(script, tclFilename)) 
     {
         throwRuntime("Can't write %s", c(tclFilename));
     }
 
-    // Use Vivado to load the bitstream into the FPGA via JTAG
-    vector<string> result = shell("%s 2>&1 -nojournal -nolog -mode batch -source %s", c(config.vivado), c(tclFilename));
+    // Use Vivado to load the bitstream into the FPGA via JTAG, logging the output as we go
+    string error = runVivado(tclFilename, resultFilename);
+
+    // If Vivado reported an error, report the failure
+    if (!error.empty()) throwRuntime("Vivado reports '%s'", c(error));
+}
+//=================================================================================================
+
 
-    // If there was no output from that, it means we couldn't find Vivado
-    if (result.size() < 3)
+
+
+//=================================================================================================
+// checkFleetDevices() - Makes sure that no two boards in the fleet resolve to the same PCI device
+//
+// Passed: jobs     = the jobs in the fleet file
+//         filename = the name of the fleet file, for error messages
+//
+// A job that doesn't name a PCI device uses pci_device from the configuration file, which
+// (without a selector) is the first matching card.  If several jobs did that, every one of
+// them would read its fingerprint from, and hot-reset, the same card.
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static void checkFleetDevices(const vector<fleetjob_t>& jobs, string filename)
+{
+    vector<pair<string, string>> claimed;
+    PciBus                       bus;
+
+    // The PCI devices are only touched to hot-reset the boards or to read their fingerprints
+    if (!performHotReset && !config.skipIfLoaded) return;
+
+    // Find out what's on the bus
+    bus.scan();
+
+    // Find the devices each job selects, and make sure no other job has already selected them
+    for (auto& job : jobs)
     {
-        throwRuntime("Can't run %s", c(config.vivado));
+        if (job.pciDevice.empty()) continue;
+        for (auto& device : bus.select(job.pciDevice))
+        {
+            for (auto& owner : claimed) if (owner.first == device.bdf)
+            {
+                throwRuntime("%s and %s in %s both select PCI device %s.  Give each board its own"
+                             " vendorID:deviceID@selector", c(owner.second), c(job.ipAddress),
+                             c(filename), c(device.bdf));
+            }
+            claimed.push_back({device.bdf, job.ipAddress});
+        }
     }
+}
+//=================================================================================================
 
-    // Write the Vivado output to a file for later inspection
-    writeStrVecToFile(result, resultFilename);
 
-    // Loop through each line of the Vivado output
-    for (auto& s : result)
+//=================================================================================================
+// readFleetFile() - Reads the list of boards to be programmed
+//
+// Each non-blank, non-comment line is: <ip_address> <bitstream> [pci_device]
+//
+// Can throw std::runtime_error
+//=================================================================================================
+static vector<fleetjob_t> readFleetFile(string filename)
+{
+    vector<fleetjob_t> result;
+    string             line;
+
+    // Open the job file
+    ifstream file(filename);
+
+    // If we can't, complain
+    if (!file.is_open()) throwRuntime("Can't open %s", c(filename));
+
+    // Loop through each line of the file
+    while (getline(file, line))
     {
-        // Extract the first word from the line
-        std::string firstWord = s.substr(0, s.find(" "));     
+        fleetjob_t job = {"", "", config.pciDevice, false, false, "", 0, 0, ""};
+
+        // Skip blank lines and comments
+        istringstream fields(line);
+        if (!(fields >> job.ipAddress) || job.ipAddress[0] == '#') continue;
 
-        // If the first word is "ERROR:", report the failure
-        if (firstWord == "ERROR:") throwRuntime("Vivado reports '%s'", c(s));
+        // Every job must name a bitstream
+        if (!(fields >> job.bitstream)) throwRuntime("No bitstream given for %s in %s", c(job.ipAddress), c(filename));
+
+        // The PCI device is optional
+        fields >> job.pciDevice;
+
+        // Add this job to the list
+        result.push_back(job);
     }
+
+    // Make sure that each board has a PCI device of its own
+    checkFleetDevices(result, filename);
+
+    // Hand the caller the list of jobs
+    return result;
 }
 //=================================================================================================
 
 
+//=================================================================================================
+// runFleetJob() - Programs a single board from the fleet
+//
+// Passed: job      = the job to perform.  On exit, the status and timing fields are filled in
+//         workerID = the index of the worker running this job, used to create unique temp files
+//
+// If a hot-reset was requested, it's performed later by resetFleet(), for every board at once.
+// A board that already holds its bitstream skips just the load and the reset; fleet mode never
+// runs post_load_script or dma_upload, so there's nothing else for a skip to bypass
+//=================================================================================================
+static void runFleetJob(fleetjob_t& job, int workerID)
+{
+    // Each worker gets its own temp-file namespace
+    string tmpName = "load_bitstream." + to_string(getpid()) + "." + to_string(workerID);
+
+    try
+    {
+        // If the FPGA already holds this bitstream, there's nothing to do
+        if (alreadyLoaded(job.bitstream, job.ipAddress, job.pciDevice, &job.hash))
+        {
+            job.ok = job.skipped = true;
+            return;
+        }
+
+        auto t0 = chrono::steady_clock::now();
+
+        // Load the bitstream into the FPGA, either via a daemon or by running Vivado
+        if (useDaemon)
+            LoadDaemon::request(config.daemonSocket, filesystem::absolute(job.bitstream).string(), job.ipAddress);
+        else
+        {
+            vector<string> script = config.programmingScript;
+            performMacroSubstitutions(script, job.bitstream, job.ipAddress);
+            loadBitstream(script, tmpName);
+        }
+
+        job.loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+        // Remember what we loaded so that the next identical request can be skipped.  If the
+        // board is going to be reset, its fingerprint can't be read until afterwards
+        if (!performHotReset) recordLoad(job.ipAddress, job.hash, job.pciDevice);
+
+        // If we get here, all is well
+        job.ok = true;
+    }
+
+    // If anything went wrong, record the reason.  This runs on a worker thread, so nothing may
+    // escape from here: an uncaught exception would terminate the whole fleet run
+    catch(const std::exception& e)
+    {
+        job.error = e.what();
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// resetFleet() - Hot-resets every board that was just loaded, as a single batch
+//
+// Passed: jobs = the jobs that were run.  The status and reset time of each are filled in
+//
+// The devices that each job's pci_device selects are gathered up and reset together, so that
+// devices behind different bridges are reset concurrently and the bus is rescanned only once.
+// If the batch fails, every job in it is marked as failed.
+//=================================================================================================
+static void resetFleet(vector<fleetjob_t>& jobs)
+{
+    vector<PciBus::device_t> devices;
+    vector<vector<string>>   jobDevices(jobs.size());
+    PciBus                   bus;
+
+    // Find out what's on the bus
+    bus.scan();
+
+    // Find the devices of each board that was loaded
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto& job = jobs[i];
+
+        // Boards that failed to load, or didn't need loading, aren't reset
+        if (!job.ok || job.skipped) continue;
+
+        try
+        {
+            if (job.pciDevice.empty()) throwRuntime("No pci_device specified");
+            auto selected = bus.select(job.pciDevice);
+            if (selected.empty()) throwRuntime("Can't locate device %s", c(job.pciDevice));
+
+            // Add each device to the batch, unless another job already added it
+            for (auto& device : selected)
+            {
+                jobDevices[i].push_back(device.bdf);
+                bool duplicate = false;
+                for (auto& d : devices) if (d.bdf == device.bdf) duplicate = true;
+                if (!duplicate) devices.push_back(device);
+            }
+        }
+        catch(const std::runtime_error& e)
+        {
+            job.ok    = false;
+            job.error = e.what();
+        }
+    }
+
+    // If there's nothing to reset, we're done
+    if (devices.empty()) return;
+
+    // Reset every device at once
+    vector<PciDevice::resetresult_t> results;
+    try
+    {
+        results = PciDevice::hotReset(devices, config.resetOpts);
+    }
+    catch(const std::runtime_error& e)
+    {
+        for (size_t i = 0; i < jobs.size(); ++i) if (!jobDevices[i].empty())
+        {
+            jobs[i].ok    = false;
+            jobs[i].error = string("hot-reset failed: ") + e.what();
+        }
+        return;
+    }
+
+    // Tell the user how each reset went
+    for (auto& result : results) reportReset(result);
+
+    // A job's reset took as long as the slowest of its devices
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (jobDevices[i].empty()) continue;
+        for (auto& result : results)
+        {
+            if (find(jobDevices[i].begin(), jobDevices[i].end(), result.bdf) == jobDevices[i].end()) continue;
+            jobs[i].resetSeconds = max(jobs[i].resetSeconds, result.totalMs / 1000);
+        }
+
+        // Now that the board has been re-enumerated, remember what we loaded into it
+        recordLoad(jobs[i].ipAddress, jobs[i].hash, jobs[i].pciDevice);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runFleet() - Programs every board in the fleet file using a pool of concurrent workers
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void runFleet()
+{
+    atomic<size_t>  nextJob(0);
+    vector<thread>  workers;
+    int             failures = 0;
+
+    // Fetch the list of boards that we're going to program
+    vector<fleetjob_t> jobs = readFleetFile(fleetFile);
+
+    // We never need more workers than we have jobs
+    int workerCount = min((size_t)max(fleetWorkers, 1), jobs.size());
+
+    auto t0 = chrono::steady_clock::now();
+
+    // Each worker pulls jobs from the list until there are none left
+    for (int id = 0; id < workerCount; ++id) workers.emplace_back([&, id]()
+    {
+        size_t index;
+        while ((index = nextJob++) < jobs.size()) runFleetJob(jobs[index], id);
+    });
+
+    // Wait for all of the workers to finish
+    for (auto& worker : workers) worker.join();
+
+    // If the user requested a hot-reset, reset every board that was loaded
+    if (performHotReset) resetFleet(jobs);
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    // Report the status of each board
+    for (auto& job : jobs)
+    {
+        printf("%-24s %-6s load=%7.1fs reset=%5.1fs %s\n", c(job.ipAddress),
+               job.skipped ? "SKIP" : job.ok ? "OK" : "FAILED",
+               job.loadSeconds, job.resetSeconds, c(job.error));
+        if (!job.ok) ++failures;
+    }
+
+    // And a summary of the whole fleet
+    printf("%zu boards programmed in %.1f seconds, %d failed\n", jobs.size(), elapsed, failures);
+
+    // If any board failed, make sure the caller finds out
+    if (failures) throwRuntime("%d of %zu boards failed", failures, jobs.size());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// readFingerprint() - Reads the register that fingerprints the design loaded in the FPGA
+//
+// Passed: pciDevice = the vendorID:deviceID of the FPGA
+//
+// Returns: "-" if no fingerprint register is configured, an empty string if the register
+//          can't be read, otherwise the value of the register as hex digits
+//=================================================================================================
+static string readFingerprint(string pciDevice)
+{
+    char hex[16];
+
+    // If there's no fingerprint register, tell the caller
+    if (config.fingerprintBar < 0 || pciDevice.empty()) return "-";
+
+    try
+    {
+        PciDevice device;
+
+        // This runs on the main thread (or a fleet worker) just before Vivado is launched, and
+        // Vivado would inherit a NUMA binding, so we don't bind to the device's node here
+        PciDevice::mapopts_t opts = config.mapOpts;
+        opts.numaBind = false;
+
+        // Map the PCI device into user-space
+        device.open(pciDevice, opts);
+
+        // Fetch the BAR that holds the fingerprint register
+        auto bar = device.findBar(config.fingerprintBar);
+
+        // Make sure the register actually exists
+        if (bar == nullptr) return "";
+        if ((uint64_t)config.fingerprintOffset + 4 > bar->size) return "";
+
+        // Read the fingerprint register.  Only this BAR gets mapped
+        Mmio     registers(device, config.fingerprintBar);
+        uint32_t value = registers.read32(config.fingerprintOffset);
+
+        // A value of all 1's means the device isn't responding
+        if (value == 0xFFFFFFFF) return "";
+
+        // Hand the caller the fingerprint
+        sprintf(hex, "%08x", value);
+        return hex;
+    }
+
+    // If the device can't be found or mapped, we don't have a fingerprint
+    catch(const std::runtime_error& e)
+    {
+        return "";
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// boardKey() - Returns the key that identifies a board in the load cache
+//
+// Passed: ip        = the IP address of the JTAG hardware-server
+//         pciDevice = the vendorID:deviceID[@selector] of the FPGA
+//
+// Returns: "<ip>/<bdf>" if pciDevice selects exactly one device, otherwise just the IP address
+//
+// A hardware-server may have several boards behind it, and the same card may be reached through
+// different hardware-servers, so neither one identifies the board on its own
+//=================================================================================================
+static string boardKey(string ip, string pciDevice)
+{
+    // Without a PCI device, the hardware-server is all we have to go on
+    if (pciDevice.empty()) return ip;
+
+    try
+    {
+        PciBus bus;
+
+        // Find the device that the specification selects
+        bus.scan();
+        auto selected = bus.select(pciDevice);
+
+        // If it selects exactly one, that's our board
+        if (selected.size() == 1) return ip + "/" + selected[0].bdf;
+    }
+
+    // If the device can't be found, the hardware-server will have to do
+    catch(const std::runtime_error& e)
+    {
+        return ip;
+    }
+
+    // If the specification selects more than one device, the hardware-server will have to do
+    return ip;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// alreadyLoaded() - Checks to see if an FPGA already holds the specified bitstream
+//
+// Passed: file      = the name of the bitstream file
+//         ip        = the IP address of the JTAG hardware-server
+//         pciDevice = the vendorID:deviceID of the FPGA, used to read its fingerprint register
+//         pHash     = receives the SHA-256 of the bitstream, or "" if skipping is disabled
+//
+// Returns: true if the bitstream is already loaded and doesn't need to be loaded again
+//=================================================================================================
+bool alreadyLoaded(string file, string ip, string pciDevice, string* pHash)
+{
+    // Assume for the moment that we won't be keeping track of what's loaded
+    pHash->clear();
+
+    // If we aren't skipping loads of bitstreams that are already loaded, we're done
+    if (!config.skipIfLoaded) return false;
+
+    // Compute the hash of the bitstream file
+    *pHash = Sha256::ofFile(file);
+
+    // We'll need the cache that records what's loaded in each board, and the board's key in it
+    LoadCache cache(config.loadCache);
+    string    key = boardKey(ip, pciDevice);
+
+    // Unless the user is forcing a load, find out if the board already holds this bitstream
+    if (!forceLoad)
+    {
+        string fingerprint = readFingerprint(pciDevice);
+        if (!fingerprint.empty() && fingerprint != "-" && cache.isLoaded(key, *pHash, fingerprint)) return true;
+    }
+
+    // We're about to load the board, so we no longer know what it holds
+    cache.forget(key);
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// recordLoad() - Records that a bitstream was successfully loaded into a board
+//
+// Passed: ip        = the IP address of the JTAG hardware-server
+//         hash      = the SHA-256 of the bitstream that was loaded.  If empty, we do nothing
+//         pciDevice = the vendorID:deviceID of the FPGA, used to read its fingerprint register
+//=================================================================================================
+void recordLoad(string ip, string hash, string pciDevice)
+{
+    // If we're not keeping track of what's loaded, there's nothing to do
+    if (hash.empty()) return;
+
+    LoadCache cache(config.loadCache);
+    string    key = boardKey(ip, pciDevice);
+
+    // Read the fingerprint of the newly loaded design
+    string fingerprint = readFingerprint(pciDevice);
+
+    // Without a fingerprint, a later run can't confirm that the board still holds this
+    // bitstream, so we don't claim to know what it holds
+    if (fingerprint.empty() || fingerprint == "-")
+    {
+        cache.forget(key);
+        return;
+    }
+
+    // Record the fingerprint along with the hash of the bitstream
+    cache.record(key, hash, fingerprint);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// reportReset() - Displays the outcome of a hot-reset
+//=================================================================================================
+void reportReset(const PciDevice::resetresult_t& result)
+{
+    printf("Hot reset of %s complete in %.0f ms", result.bdf.c_str(), result.totalMs);
+    printf(" (%s reset took %.1f ms)", result.method.c_str(), result.resetMs);
+    if (result.linkUpMs >= 0) printf(" (link up in %.1f ms)", result.linkUpMs);
+    printf("\n");
+    printf("Device %04x:%04x re-enumerated in %.1f ms with %d BAR%s assigned\n",
+           result.vendorID, result.deviceID, result.enumeratedMs, result.barCount,
+           result.barCount == 1 ? "" : "s");
+
+    // Display the configuration registers that the reset clobbered and that we restored
+    for (auto& s : result.configChanged) printf("  restored %s\n", s.c_str());
+
+    // If any of them couldn't be restored, make sure someone notices
+    for (auto& s : result.configUnrestored) fprintf(stderr, "WARNING: %s config register not restored (saved -> read back): %s\n", result.bdf.c_str(), s.c_str());
+
+    // Display the performance settings we changed, and any we couldn't apply
+    for (auto& s : result.tuning.changes) printf("  tuned %s\n", s.c_str());
+    for (auto& s : result.tuning.warnings) fprintf(stderr, "WARNING: %s: %s\n", result.bdf.c_str(), s.c_str());
+
+    // If the kernel doesn't report the link speed, there's nothing more to say
+    if (result.linkSpeed == 0) return;
+
+    // Display the speed and width the link trained at
+    printf("Link trained at %g GT/s x%d", result.linkSpeed, result.linkWidth);
+    if (result.retrains) printf(" after %d retrain%s", result.retrains, result.retrains == 1 ? "" : "s");
+    printf("\n");
+
+    // If the link is slower or narrower than it should be, make sure someone notices
+    if (result.linkDegraded)
+    {
+        fprintf(stderr, "WARNING: link to %s is degraded: %g GT/s x%d, expected %g GT/s x%d\n", result.bdf.c_str(),
+                result.linkSpeed, result.linkWidth, result.targetSpeed, result.targetWidth);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runBenchmark() - Measures the latency and bandwidth of MMIO access to the PCI device
+//
+// If benchmarkMemfdMB is non-zero, a memfd of that size stands in for the BAR, so that the
+// benchmark can be exercised on a machine without the card
+//
+// The BAR is only read unless "-write" was given, along with the region that may be overwritten.
+// There's nothing behind a memfd to damage, so it's always written to
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void runBenchmark()
+{
+    PciDevice               device;
+    Mmio                    io;
+    string                  target;
+    MmioBenchmark::options_t opts;
+
+    // If we're benchmarking a memfd, create and map it
+    if (benchmarkMemfdMB)
+    {
+        size_t size = benchmarkMemfdMB << 20;
+        int fd = memfd_create("load_bitstream_benchmark", MFD_CLOEXEC);
+        if (fd < 0) throwRuntime("Can't create a memfd");
+        if (ftruncate(fd, size) < 0)
+        {
+            close(fd);
+            throwRuntime("Can't size the memfd to %zu MB", benchmarkMemfdMB);
+        }
+        void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) throwRuntime("Can't map the memfd");
+        io.attach((uint8_t*)ptr, size);
+        target = "memfd";
+    }
+
+    // Otherwise, map the requested BAR of the PCI device
+    else
+    {
+        // If we've been asked to, hot-reset the device first, so we benchmark the fresh link
+        if (performHotReset) reportReset(PciDevice::hotReset(config.pciDevice, config.resetOpts));
+
+        // Map the BAR we're going to benchmark
+        device.open(config.pciDevice, config.mapOpts);
+        io.attach(device, benchmarkBar);
+        target = std::filesystem::path(device.deviceDir()).filename().string() + " BAR " + to_string(benchmarkBar);
+
+        // If we're running on the device's NUMA node, say so
+        if (config.mapOpts.numaBind && device.numaNode() >= 0) target += " from NUMA node " + to_string(device.numaNode());
+    }
+
+    // Benchmark the requested region, writing to it only if we've been told we may
+    opts.offset = benchmarkOffset;
+    opts.length = benchmarkLength;
+    opts.writes = benchmarkWrite || benchmarkMemfdMB;
+
+    // Before writing to a device, tell the user exactly what's about to be overwritten
+    size_t overwrite = MmioBenchmark::bytesWritten(io, opts);
+    if (overwrite && !benchmarkMemfdMB)
+    {
+        fprintf(stderr, "WARNING: the benchmark will overwrite %zu bytes of %s at 0x%zx thru 0x%zx\n",
+                overwrite, c(target), opts.offset, opts.offset + overwrite - 1);
+    }
+
+    // Run the benchmark
+    auto result = MmioBenchmark::run(io, target, opts);
+
+    // Report the results
+    if (benchmarkJson)
+        printf("%s\n", MmioBenchmark::toJson(result).c_str());
+    else
+        MmioBenchmark::print(result);
+
+    // If we created a memfd mapping, we're done with it
+    if (benchmarkMemfdMB) munmap(io.baseAddr(), io.size());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runListDevices() - Lists every PCI device with the configured vendorID:deviceID
+//
+// The index, BDF, and serial number displayed are the values that can be used after the "@"
+// in pci_device (or in a fleet job file) to select a particular card
+//=================================================================================================
+void runListDevices()
+{
+    PciBus bus;
+
+    // Strip any selector off the configured device, and select every matching device instead
+    string id = config.pciDevice.substr(0, config.pciDevice.find('@'));
+    bus.scan();
+    auto devices = bus.select(id + "@*");
+
+    // If there aren't any, say so
+    if (devices.empty())
+    {
+        printf("No %s devices found\n", id.c_str());
+        return;
+    }
+
+    // Display a line for each device
+    printf("Index  BDF            Port           NUMA  Serial\n");
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+        auto& d = devices[i];
+        printf("%5zu  %-13s  %-13s  %4d  %s\n", i, d.bdf.c_str(), d.port.empty() ? "-" : d.port.c_str(),
+               d.numaNode, d.serial.empty() ? "-" : d.serial.c_str());
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// uploadVectors() - DMAs the test-vector files listed in "dma_upload" into the card's memory
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void uploadVectors()
+{
+    PciDevice  device;
+    DmaPool    pool;
+    XdmaEngine engine;
+
+    // Map the BAR that holds the registers of the XDMA core
+    device.open(config.pciDevice, config.mapOpts);
+    Mmio registers(device, config.dmaBar);
+
+    // The descriptors hold physical addresses, so an IOMMU mustn't be translating them
+    DmaPool::requireDirectDma(device.deviceDir());
+
+    // Reserve the pinned memory for the descriptor rings and bounce buffers, and find the channels
+    pool.create((size_t)config.dmaPoolMB << 20, config.dmaHugePages ? DmaPool::PAGE_2M : DmaPool::PAGE_4K);
+    engine.attach(registers, pool);
+
+    // Upload each file to its address on the card
+    for (size_t i = 0; i < config.dmaUpload.size(); i += 2)
+    {
+        string&  filename = config.dmaUpload[i];
+        uint64_t cardAddr = strtoull(c(config.dmaUpload[i + 1]), nullptr, 0);
+        struct stat sb;
+
+        // Map the file into memory
+        int fd = open(c(filename), O_RDONLY);
+        if (fd < 0) throwRuntime("Can't open %s", c(filename));
+        if (fstat(fd, &sb) < 0 || sb.st_size == 0)
+        {
+            close(fd);
+            throwRuntime("%s is empty or unreadable", c(filename));
+        }
+        void* data = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) throwRuntime("Can't map %s", c(filename));
+
+        // Send it to the card
+        auto start = chrono::steady_clock::now();
+        try
+        {
+            engine.upload(data, cardAddr, sb.st_size);
+        }
+        catch(const std::runtime_error&)
+        {
+            munmap(data, sb.st_size);
+            throw;
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        munmap(data, sb.st_size);
+
+        // Tell the user how it went
+        printf("Uploaded %s (%lld bytes) to 0x%llx in %.1f ms (%.0f MB/s) over %d channel%s\n",
+               filename.c_str(), (long long)sb.st_size, (unsigned long long)cardAddr, ms,
+               ms > 0 ? sb.st_size / ms / 1000 : 0, engine.channels(XdmaEngine::H2C),
+               engine.channels(XdmaEngine::H2C) == 1 ? "" : "s");
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// runPostLoadScript() - Initializes the registers of a freshly loaded design
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void runPostLoadScript()
+{
+    PciDevice device;
+
+    // Open the device and run the compiled script against its BARs
+    device.open(config.pciDevice, config.mapOpts);
+    auto stats = config.postLoadScript.run(device);
+
+    // Tell the user how it went
+    printf("post_load_script: %d instructions (%d writes, %d reads, %d polls) in %.3f ms\n",
+           stats.instructions, stats.writes, stats.reads, stats.polls, stats.elapsedMs);
+
+    // If the script waited on the device, say how long it waited
+    if (stats.polls)
+    {
+        printf("post_load_script: waited %.3f ms for the device to be ready (%d register reads)\n",
+               stats.pollWaitMs, stats.pollReads);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// saveTrace() - If the user asked for one, saves the trace of register accesses to a file
+//=================================================================================================
+void saveTrace()
+{
+    // If there's no trace to save, there's nothing to do
+    if (traceFile.empty()) return;
+
+    // Save it, and tell the user where it went
+    try
+    {
+        MmioTrace::dump(traceFile);
+        printf("MMIO trace saved to %s\n", c(traceFile));
+    }
+
+    // A trace we can't save isn't worth failing over
+    catch(const std::runtime_error& e)
+    {
+        std::cerr << e.what() << '\n';
+    }
+}
+//=================================================================================================
@@ -0,0 +1,49 @@
+//=================================================================================================
+// Check.h - A minimal harness for the test programs
+//
+// CHECK() reports a failed condition and keeps going, so one run shows every failure.
+// checkResult() is what main() returns: 0 if everything passed, 1 if anything failed.
+//=================================================================================================
+#pragma once
+#include <stdio.h>
+
+// The exit code that tells ctest a test was skipped
+#define SKIP_TEST 77
+
+// The number of checks that have failed so far
+static int checkFailures = 0;
+
+// Reports "cond" if it's false
+#define CHECK(cond)                                                                   \
+    do                                                                                \
+    {                                                                                 \
+        if (!(cond))                                                                  \
+        {                                                                             \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);  \
+            ++checkFailures;                                                          \
+        }                                                                             \
+    } while (0)
+
+// Checks that "expr" throws a std::exception
+#define CHECK_THROWS(expr)                                                            \
+    do                                                                                \
+    {                                                                                 \
+        bool threw = false;                                                           \
+        try {expr;} catch (const std::exception&) {threw = true;}                     \
+        if (!threw)                                                                   \
+        {                                                                             \
+            fprintf(stderr, "%s:%d: didn't throw: %s\n", __FILE__, __LINE__, #expr);  \
+            ++checkFailures;                                                          \
+        }                                                                             \
+    } while (0)
+
+//=================================================================================================
+// checkResult() - Prints a summary, and returns the exit code for main()
+//=================================================================================================
+static inline int checkResult(const char* testName)
+{
+    if (checkFailures) fprintf(stderr, "%s: %d check(s) failed\n", testName, checkFailures);
+    else printf("%s: all checks passed\n", testName);
+    return checkFailures ? 1 : 0;
+}
+//=================================================================================================
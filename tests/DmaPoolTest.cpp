@@ -0,0 +1,207 @@
+//=================================================================================================
+// DmaPoolTest.cpp - Exercises DmaPool on ordinary 4K pages, and its check for an IOMMU
+//
+// The pool needs root to read physical addresses from /proc/self/pagemap.  Without it, only the
+// IOMMU check is run, and the test reports itself as skipped if that passes.
+//=================================================================================================
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include "DmaPool.h"
+#include "Check.h"
+using namespace std;
+
+// A convenient shortcut to std::filesystem
+namespace fs = std::filesystem;
+
+//=================================================================================================
+// isPhysicallyContiguous() - Checks a chunk against the kernel's page map, page by page
+//=================================================================================================
+static bool isPhysicallyContiguous(const DmaPool::chunk_t& chunk)
+{
+    size_t pageSize = getpagesize();
+
+    // Every page of the chunk has to be where the chunk's physical address says it is
+    for (size_t offset = 0; offset < chunk.size; offset += pageSize)
+    {
+        if (DmaPool::virtToPhys(chunk.virtAddr + offset) != chunk.physAddr + offset) return false;
+    }
+
+    // And so does the last byte
+    return DmaPool::virtToPhys(chunk.virtAddr + chunk.size - 1) == chunk.physAddr + chunk.size - 1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testAddresses() - Checks that the pool's addresses agree with the kernel's page map
+//=================================================================================================
+static void testAddresses(DmaPool& pool)
+{
+    uint8_t* base = pool.baseAddr();
+
+    // The pool is a whole number of 4K pages, and nothing has been allocated yet
+    CHECK(pool.pageBytes() == (size_t)getpagesize());
+    CHECK(pool.size() % pool.pageBytes() == 0);
+    CHECK(pool.used() == 0 && pool.available() == pool.size());
+
+    // Translations preserve the offset within the page, in both directions
+    CHECK(pool.physAddr(base + 123) == DmaPool::virtToPhys(base + 123));
+    CHECK(pool.physAddr(base + 123) % pool.pageBytes() == 123);
+    CHECK(pool.virtAddr(pool.physAddr(base + 5000)) == base + 5000);
+
+    // Addresses outside of the pool aren't translated
+    CHECK_THROWS(pool.physAddr(base + pool.size()));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// firstAdjacentPage() - Returns the index of the first page of the pool whose successor is the
+//                       next physical page, or -1 if there isn't one
+//=================================================================================================
+static long firstAdjacentPage(DmaPool& pool)
+{
+    size_t pageBytes = pool.pageBytes();
+
+    for (size_t offset = 0; offset + pageBytes < pool.size(); offset += pageBytes)
+    {
+        uint64_t here = DmaPool::virtToPhys(pool.baseAddr() + offset);
+        uint64_t next = DmaPool::virtToPhys(pool.baseAddr() + offset + pageBytes);
+        if (next == here + pageBytes) return offset / pageBytes;
+    }
+
+    return -1;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testAlloc() - Checks alignment, contiguity and the accounting of allocations
+//
+// Ordinary pages may or may not be physically adjacent, so the contiguity checks compare what
+// the pool does with what the kernel's page map says it should do
+//=================================================================================================
+static void testAlloc(DmaPool& pool)
+{
+    size_t pageBytes = pool.pageBytes();
+
+    // A small chunk is aligned as asked, and its addresses agree with each other
+    auto small = pool.alloc(100, 256);
+    CHECK((uintptr_t)small.virtAddr % 256 == 0);
+    CHECK(small.physAddr % 256 == 0);
+    CHECK(small.physAddr == pool.physAddr(small.virtAddr));
+    CHECK(small.size == 100);
+
+    // A chunk that doesn't need to be contiguous starts at the next aligned spot after the last
+    size_t next  = (pool.used() + 63) & ~(size_t)63;
+    auto   loose = pool.alloc(64 * 1024, 64, false);
+    CHECK(loose.virtAddr == pool.baseAddr() + next);
+    CHECK(pool.used() == next + 64 * 1024);
+
+    // A contiguous chunk that would straddle the first two pages stays put only if they're
+    // physically adjacent, and otherwise moves to the start of the second page
+    pool.reset();
+    pool.alloc(pageBytes - 64, 64, false);
+    bool adjacent = DmaPool::virtToPhys(pool.baseAddr() + pageBytes) == DmaPool::virtToPhys(pool.baseAddr()) + pageBytes;
+    auto straddle = pool.alloc(128, 64);
+    CHECK(straddle.virtAddr == pool.baseAddr() + (adjacent ? pageBytes - 64 : pageBytes));
+    CHECK(isPhysicallyContiguous(straddle));
+
+    // A two-page chunk lands on the first pair of adjacent pages, or can't be had at all
+    pool.reset();
+    long first = firstAdjacentPage(pool);
+    if (first < 0)
+        CHECK_THROWS(pool.alloc(2 * pageBytes, pageBytes));
+    else
+    {
+        auto pair = pool.alloc(2 * pageBytes, pageBytes);
+        CHECK(pair.virtAddr == pool.baseAddr() + first * pageBytes);
+        CHECK(isPhysicallyContiguous(pair));
+    }
+
+    // Requests that can't be satisfied are errors
+    CHECK_THROWS(pool.alloc(0));
+    CHECK_THROWS(pool.alloc(64, 48));
+    CHECK_THROWS(pool.alloc(pool.available() + 1, 64, false));
+
+    // Resetting the pool makes all of it available again
+    pool.reset();
+    CHECK(pool.used() == 0);
+    CHECK(pool.alloc(64).virtAddr == pool.baseAddr());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testIommu() - Checks that DMA is refused when an IOMMU would translate the device's addresses
+//=================================================================================================
+static void testIommu()
+{
+    char path[] = "/tmp/dma_pool.XXXXXX";
+
+    // Build a device directory and an IOMMU class directory in a temporary directory
+    if (mkdtemp(path) == nullptr) throw runtime_error("Can't create a temporary directory");
+    string root      = path;
+    string iommuDir  = root + "/iommu";
+    string deviceDir = root + "/device";
+    fs::create_directories(iommuDir);
+    fs::create_directories(deviceDir);
+
+    // This sets the type of the device's IOMMU group
+    auto setType = [&](string type)
+    {
+        fs::create_directories(deviceDir + "/iommu_group");
+        ofstream(deviceDir + "/iommu_group/type") << type << "\n";
+    };
+
+    // With no IOMMU enabled, physical addresses are bus addresses
+    DmaPool::requireDirectDma(deviceDir, iommuDir);
+    DmaPool::requireDirectDma(deviceDir, root + "/missing");
+
+    // With one enabled, the device's group has to be in identity mode
+    fs::create_directories(iommuDir + "/dmar0");
+    CHECK_THROWS(DmaPool::requireDirectDma(deviceDir, iommuDir));
+    setType("DMA-FQ");
+    CHECK_THROWS(DmaPool::requireDirectDma(deviceDir, iommuDir));
+    setType("identity");
+    DmaPool::requireDirectDma(deviceDir, iommuDir);
+
+    // Clean up
+    fs::remove_all(root);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// main() - Runs the tests
+//=================================================================================================
+int main()
+{
+    try
+    {
+        testIommu();
+
+        // Reading physical addresses needs root
+        if (geteuid() != 0)
+        {
+            printf("DmaPoolTest: pool tests skipped, must be run as root\n");
+            return checkFailures ? 1 : SKIP_TEST;
+        }
+
+        DmaPool pool(4 << 20, DmaPool::PAGE_4K);
+        testAddresses(pool);
+        testAlloc(pool);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "DmaPoolTest: %s\n", e.what());
+        return 1;
+    }
+
+    return checkResult("DmaPoolTest");
+}
+//=================================================================================================
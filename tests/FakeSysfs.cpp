@@ -0,0 +1,205 @@
+//=================================================================================================
+// FakeSysfs.cpp - Implements a throw-away copy of the parts of /sys/bus/pci that the code under
+//                 test reads
+//
+// The layout follows the kernel's: each device is a directory in the device hierarchy
+// (devices/pci0000:00/<bridge>/<endpoint>), and bus/pci/devices holds a symlink to each one.
+// Configuration space is a regular 4 KB file, which PciConfig accepts in place of the real one.
+//=================================================================================================
+#include <stdlib.h>
+#include <stdio.h>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include "FakeSysfs.h"
+#include "Utility.h"
+using namespace std;
+
+// A convenient shortcut to std::filesystem
+namespace fs = std::filesystem;
+
+//=================================================================================================
+// writeFile() - Creates a file with the specified contents
+//=================================================================================================
+static void writeFile(string filename, string contents)
+{
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) throwRuntime("Can't create %s", c(filename));
+    file << contents;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Constructor - Creates an empty tree in a new temporary directory
+//
+// Can throw std::runtime_error
+//=================================================================================================
+FakeSysfs::FakeSysfs()
+{
+    char path[] = "/tmp/fake_sysfs.XXXXXX";
+
+    // Create the temporary directory
+    if (mkdtemp(path) == nullptr) throwRuntime("Can't create a temporary directory");
+    root_ = path;
+
+    // Create the directories of the device hierarchy and the bus
+    fs::create_directories(root_ + "/devices/pci0000:00");
+    fs::create_directories(devicesDir());
+
+    // The bus-wide rescan file
+    writeFile(root_ + "/bus/pci/rescan", "");
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Deletes the tree
+//=================================================================================================
+FakeSysfs::~FakeSysfs()
+{
+    error_code ec;
+    fs::remove_all(root_, ec);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addDevice() - Creates a device directory with a zeroed configuration space, and links it
+//               into devicesDir()
+//
+// Passed: bdf       = the BDF of the device
+//         parentDir = the directory in the device hierarchy that the device goes under
+//         vendorID  = the vendor ID of the device
+//         deviceID  = the device ID of the device
+//
+// Returns: the directory of the device in the device hierarchy
+//=================================================================================================
+string FakeSysfs::addDevice(string bdf, string parentDir, int vendorID, int deviceID)
+{
+    char text[16];
+
+    // Create the device's directory
+    string dir = parentDir + "/" + bdf;
+    fs::create_directories(dir);
+
+    // The vendor and device ID files, in the kernel's format
+    sprintf(text, "0x%04x\n", vendorID);
+    writeFile(dir + "/vendor", text);
+    sprintf(text, "0x%04x\n", deviceID);
+    writeFile(dir + "/device", text);
+
+    // The device isn't attached to a particular NUMA node
+    writeFile(dir + "/numa_node", "-1\n");
+
+    // The files that a hot-reset writes to
+    writeFile(dir + "/remove", "");
+    writeFile(dir + "/rescan", "");
+
+    // Configuration space starts out zeroed
+    writeFile(dir + "/config", string(4096, '\0'));
+
+    // Link the device into the bus's list of devices
+    fs::create_symlink(fs::relative(dir, devicesDir()), deviceDir(bdf));
+
+    // Fill in the vendor and device IDs
+    poke(bdf, 0x00, {(uint8_t)vendorID, (uint8_t)(vendorID >> 8), (uint8_t)deviceID, (uint8_t)(deviceID >> 8)});
+
+    // Hand the caller the directory of the device
+    return dir;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addBridge() - Adds a PCIe root port on the root bus, with its link up at 8 GT/s x16
+//
+// Returns: the sysfs directory of the bridge
+//=================================================================================================
+string FakeSysfs::addBridge(string bdf)
+{
+    addDevice(bdf, root_ + "/devices/pci0000:00", 0x8086, 0x1234);
+
+    // A type 1 header with a capability list
+    poke(bdf, 0x06, {0x10, 0x00});
+    poke(bdf, 0x0E, {0x01});
+    poke(bdf, 0x34, {0x40});
+
+    // A PCI Express capability (a root port) at 0x40
+    poke(bdf, 0x40, {0x10, 0x00, 0x42, 0x00});
+
+    // Link capabilities: 8 GT/s x16, reports Data Link Layer Link Active
+    poke(bdf, 0x4C, {0x03, 0x01, 0x10, 0x00});
+
+    // Link status: 8 GT/s x16, Data Link Layer Link Active
+    poke(bdf, 0x52, {0x03, 0x21});
+
+    // Hand the caller the sysfs directory of the bridge
+    return deviceDir(bdf);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// addEndpoint() - Adds an endpoint behind a bridge
+//
+// Passed: bdf      = the BDF of the endpoint
+//         bridge   = the BDF of the bridge it's attached to
+//         vendorID = the vendor ID of the endpoint
+//         deviceID = the device ID of the endpoint
+//         serial   = its Device Serial Number, or 0 if it doesn't have one
+//
+// Returns: the sysfs directory of the endpoint
+//=================================================================================================
+string FakeSysfs::addEndpoint(string bdf, string bridge, int vendorID, int deviceID, uint64_t serial)
+{
+    addDevice(bdf, fs::canonical(deviceDir(bridge)).string(), vendorID, deviceID);
+
+    // A type 0 header with a capability list
+    poke(bdf, 0x06, {0x10, 0x00});
+    poke(bdf, 0x34, {0x40});
+
+    // A PCI Express capability (an endpoint) at 0x40, with the same link as the bridge
+    poke(bdf, 0x40, {0x10, 0x00, 0x02, 0x00});
+    poke(bdf, 0x4C, {0x03, 0x01, 0x10, 0x00});
+    poke(bdf, 0x52, {0x03, 0x01});
+
+    // A 16 MB, 32-bit memory BAR 0 at 0xF0000000
+    poke(bdf, 0x10, {0x00, 0x00, 0x00, 0xF0});
+    writeFile(deviceDir(bdf) + "/resource",
+              "0x00000000f0000000 0x00000000f0ffffff 0x0000000000040200\n");
+    writeFile(deviceDir(bdf) + "/resource0", "");
+    fs::resize_file(deviceDir(bdf) + "/resource0", 16 << 20);
+
+    // The Device Serial Number extended capability at 0x100
+    if (serial)
+    {
+        vector<uint8_t> dsn = {0x03, 0x00, 0x01, 0x00};
+        for (int i = 0; i < 8; ++i) dsn.push_back((uint8_t)(serial >> (8 * i)));
+        poke(bdf, 0x100, dsn);
+    }
+
+    // Hand the caller the sysfs directory of the endpoint
+    return deviceDir(bdf);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// poke() - Overwrites bytes of a device's configuration space
+//
+// Can throw std::runtime_error
+//=================================================================================================
+void FakeSysfs::poke(string bdf, int offset, const vector<uint8_t>& bytes)
+{
+    string filename = deviceDir(bdf) + "/config";
+
+    // Open the configuration space without truncating it
+    fstream file(filename, ios::in | ios::out | ios::binary);
+    if (!file.is_open()) throwRuntime("Can't open %s", c(filename));
+
+    // And overwrite the bytes
+    file.seekp(offset);
+    file.write((const char*)bytes.data(), bytes.size());
+}
+//=================================================================================================
@@ -0,0 +1,47 @@
+//=================================================================================================
+// FakeSysfs.h - Defines a throw-away copy of the parts of /sys/bus/pci that the code under
+//               test reads, built in a temporary directory
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class FakeSysfs
+{
+public:
+
+    // Constructor.  Creates an empty tree in a new temporary directory
+    FakeSysfs();
+
+    // Destructor.  Deletes the tree
+    ~FakeSysfs();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    FakeSysfs (const FakeSysfs&) = delete;
+    FakeSysfs& operator= (const FakeSysfs&) = delete;
+
+    // Adds a PCIe bridge on the root bus, with its link up.  Returns its device directory
+    std::string addBridge(std::string bdf);
+
+    // Adds an endpoint behind a bridge, with a 16 MB BAR 0, and a Device Serial Number
+    // capability if "serial" isn't 0.  Returns its device directory
+    std::string addEndpoint(std::string bdf, std::string bridge, int vendorID, int deviceID, uint64_t serial = 0);
+
+    // Overwrites bytes of a device's configuration space
+    void        poke(std::string bdf, int offset, const std::vector<uint8_t>& bytes);
+
+    // The directory that plays the part of /sys/bus/pci/devices
+    std::string devicesDir() {return root_ + "/bus/pci/devices";}
+
+    // The sysfs directory of a device
+    std::string deviceDir(std::string bdf) {return devicesDir() + "/" + bdf;}
+
+protected:
+
+    // Creates a device directory with a zeroed configuration space, and links it into devicesDir()
+    std::string addDevice(std::string bdf, std::string parentDir, int vendorID, int deviceID);
+
+    // The temporary directory that holds the tree
+    std::string root_;
+};
@@ -0,0 +1,189 @@
+//=================================================================================================
+// PciBusTest.cpp - Exercises PciBus enumeration, device selection and batch hot-resets against a
+//                  fake sysfs tree
+//=================================================================================================
+#include <stdexcept>
+#include "PciBus.h"
+#include "PciConfig.h"
+#include "PciDevice.h"
+#include "FakeSysfs.h"
+#include "Check.h"
+using namespace std;
+
+// The serial numbers of the cards.  The first one has no hex letters in it
+static const uint64_t SERIAL0 = 0x0000000000000123ULL;
+static const uint64_t SERIAL  = 0x000A35FFFE010203ULL;
+
+//=================================================================================================
+// selects() - Returns the BDFs chosen by a device specification, separated by spaces
+//=================================================================================================
+static string selects(PciBus& bus, string spec)
+{
+    string result;
+    for (auto& device : bus.select(spec)) result += (result.empty() ? "" : " ") + device.bdf;
+    return result;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// selectFails() - Returns true if a device specification throws std::runtime_error
+//=================================================================================================
+static bool selectFails(PciBus& bus, string spec)
+{
+    try
+    {
+        bus.select(spec);
+    }
+    catch(const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testScan() - Checks that the devices, and the bridges they're attached to, are found
+//=================================================================================================
+static void testScan(FakeSysfs& sys)
+{
+    PciBus bus(sys.devicesDir());
+    bus.scan();
+
+    // Two bridges and two cards
+    CHECK(bus.devices().size() == 4);
+
+    // The cards are found by ID, in BDF order, each with its own bridge
+    auto cards = bus.find("10ee:903f");
+    CHECK(cards.size() == 2);
+    if (cards.size() == 2)
+    {
+        CHECK(cards[0].bdf == "0000:01:00.0" && cards[0].port == "0000:00:01.0");
+        CHECK(cards[1].bdf == "0000:02:00.0" && cards[1].port == "0000:00:02.0");
+    }
+
+    // Bridges on the root bus aren't attached to anything
+    auto bridge = bus.findBDF("0000:00:01.0");
+    CHECK(bridge != nullptr && bridge->port.empty());
+
+    // IDs that aren't present find nothing
+    CHECK(bus.find("10ee:9999").empty());
+    CHECK(bus.findBDF("0000:03:00.0") == nullptr);
+
+    // The bus-wide rescan file is one level above the device list
+    CHECK(bus.busDir() + "/devices" == sys.devicesDir());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testSelect() - Checks each kind of selector
+//=================================================================================================
+static void testSelect(FakeSysfs& sys)
+{
+    PciBus bus(sys.devicesDir());
+    bus.scan();
+
+    // With no selector, the first card; with "*", all of them
+    CHECK(selects(bus, "10ee:903f") == "0000:01:00.0");
+    CHECK(selects(bus, "10ee:903f@*") == "0000:01:00.0 0000:02:00.0");
+
+    // Indices, BDFs with and without the domain, and serial numbers in either format
+    CHECK(selects(bus, "10ee:903f@1") == "0000:02:00.0");
+    CHECK(selects(bus, "10ee:903f@01:00.0") == "0000:01:00.0");
+    CHECK(selects(bus, "10ee:903f@0000:02:00.0") == "0000:02:00.0");
+    CHECK(selects(bus, "10ee:903f@00-0a-35-ff-fe-01-02-03") == "0000:02:00.0");
+    CHECK(selects(bus, "10ee:903f@000A35FFFE010203") == "0000:02:00.0");
+
+    // An all-digit item that isn't an in-range index can still be a serial number
+    CHECK(selects(bus, "10ee:903f@0000000000000123") == "0000:01:00.0");
+    CHECK(selects(bus, "10ee:903f@00-00-00-00-00-00-01-23") == "0000:01:00.0");
+
+    // Devices are returned in the order they were selected, once each
+    CHECK(selects(bus, "10ee:903f@1,0") == "0000:02:00.0 0000:01:00.0");
+    CHECK(selects(bus, "10ee:903f@0,01:00.0") == "0000:01:00.0");
+
+    // The serial number is filled in
+    auto selected = bus.select("10ee:903f@1");
+    CHECK(selected.size() == 1 && selected[0].serial == "00-0a-35-ff-fe-01-02-03");
+
+    // Selectors that match nothing are errors, including an index too big to convert
+    CHECK(selectFails(bus, "10ee:903f@2"));
+    CHECK(selectFails(bus, "10ee:903f@03:00.0"));
+    CHECK(selectFails(bus, "10ee:903f@99999999999999999999999"));
+
+    // An ID that isn't present selects nothing, but isn't an error
+    CHECK(selects(bus, "10ee:9999") == "");
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testHotReset() - Resets both cards as a batch, leaving them in place
+//=================================================================================================
+static void testHotReset(FakeSysfs& sys)
+{
+    PciDevice::resetopts_t opts;
+
+    // Toggle secondary-bus-reset ourselves, and restore the BARs rather than rescanning
+    opts.methods       = {PciDevice::RESET_MANUAL};
+    opts.removeDevice  = false;
+    opts.holdMs        = 0;
+    opts.settleMs      = 0;
+
+    auto results = PciDevice::hotResetAll("10ee:903f@*", opts, sys.devicesDir());
+
+    // Each card was reset through its own bridge
+    CHECK(results.size() == 2);
+    for (auto& result : results)
+    {
+        CHECK(result.method == "manual");
+        CHECK(result.vendorID == 0x10ee && result.deviceID == 0x903f);
+    }
+    if (results.size() == 2)
+    {
+        CHECK(results[0].bdf == "0000:01:00.0" && results[0].port == "0000:00:01.0");
+        CHECK(results[1].bdf == "0000:02:00.0" && results[1].port == "0000:00:02.0");
+    }
+
+    // Resetting a single device needs a specification that picks just one
+    CHECK_THROWS(PciDevice::hotReset("10ee:903f@*", opts, sys.devicesDir()));
+
+    // Secondary-bus-reset has been released, and the card has been re-enabled
+    uint16_t enabled = PciConfig::COMMAND_MEMORY | PciConfig::COMMAND_MASTER | PciConfig::COMMAND_SERR;
+    PciConfig bridge(sys.deviceDir("0000:00:01.0"));
+    PciConfig card(sys.deviceDir("0000:01:00.0"));
+    CHECK((bridge.read16(PciConfig::BRIDGE_CONTROL) & PciConfig::BRIDGE_CONTROL_BUS_RESET) == 0);
+    CHECK((card.read16(PciConfig::COMMAND) & enabled) == enabled);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// main() - Builds a tree with two cards, each behind its own bridge, and runs the tests
+//=================================================================================================
+int main()
+{
+    try
+    {
+        FakeSysfs sys;
+        sys.addBridge("0000:00:01.0");
+        sys.addBridge("0000:00:02.0");
+        sys.addEndpoint("0000:01:00.0", "0000:00:01.0", 0x10ee, 0x903f, SERIAL0);
+        sys.addEndpoint("0000:02:00.0", "0000:00:02.0", 0x10ee, 0x903f, SERIAL);
+
+        testScan(sys);
+        testSelect(sys);
+        testHotReset(sys);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "PciBusTest: %s\n", e.what());
+        return 1;
+    }
+
+    return checkResult("PciBusTest");
+}
+//=================================================================================================
@@ -0,0 +1,194 @@
+//=================================================================================================
+// PciConfigTest.cpp - Exercises PciConfig against a configuration space held in a regular file
+//=================================================================================================
+#include <unistd.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "PciConfig.h"
+#include "Check.h"
+using namespace std;
+
+// The offsets of the capabilities in the test configuration space
+static const int PM_CAP   = 0x40;           // Power Management, first in the list
+static const int PCIE_CAP = 0x60;           // PCI Express, second in the list
+static const int AER_CAP  = 0x100;          // Advanced Error Reporting, first extended capability
+static const int DSN_CAP  = 0x148;          // Device Serial Number, second extended capability
+
+//=================================================================================================
+// poke() - Writes bytes into the configuration space file without going through PciConfig
+//=================================================================================================
+static void poke(int fd, int offset, const vector<uint8_t>& bytes)
+{
+    if (pwrite(fd, bytes.data(), bytes.size(), offset) != (ssize_t)bytes.size())
+    {
+        throw runtime_error("Can't write the test configuration space");
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// buildConfigSpace() - Creates a 4 KB configuration space with two standard and two extended
+//                      capabilities
+//
+// Returns: the name of the file
+//=================================================================================================
+static string buildConfigSpace()
+{
+    char filename[] = "/tmp/pci_config.XXXXXX";
+
+    // Create an empty 4 KB file
+    int fd = mkstemp(filename);
+    if (fd < 0 || ftruncate(fd, 4096) < 0) throw runtime_error("Can't create a test configuration space");
+
+    // The IDs, and a status register that says there's a capability list
+    poke(fd, 0x00, {0xEE, 0x10, 0x3F, 0x90});
+    poke(fd, 0x06, {0x10, 0x00});
+
+    // The capability list: Power Management, then PCI Express.  The low bits of each pointer
+    // are reserved, and must be ignored
+    poke(fd, 0x34, {PM_CAP | 0x03});
+    poke(fd, PM_CAP,   {0x01, PCIE_CAP | 0x01});
+    poke(fd, PCIE_CAP, {0x10, 0x00, 0x02, 0x00});
+
+    // The extended list: AER (version 2), then DSN (version 1)
+    poke(fd, AER_CAP, {0x01, 0x00, (uint8_t)(0x02 | (DSN_CAP & 0xF) << 4), (uint8_t)(DSN_CAP >> 4)});
+    poke(fd, DSN_CAP, {0x03, 0x00, 0x01, 0x00, 0x03, 0x02, 0x01, 0xFE, 0xFF, 0x35, 0x0A, 0x00});
+
+    close(fd);
+    return filename;
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testAccess() - Checks register reads and writes of each width
+//=================================================================================================
+static void testAccess(PciConfig& config)
+{
+    // Registers are little-endian
+    CHECK(config.read16(PciConfig::VENDOR_ID) == 0x10EE);
+    CHECK(config.read16(PciConfig::DEVICE_ID) == 0x903F);
+    CHECK(config.read32(PciConfig::VENDOR_ID) == 0x903F10EE);
+    CHECK(config.read8 (PciConfig::VENDOR_ID) == 0xEE);
+
+    // What's written is what's read back
+    config.write32(0x200, 0x12345678);
+    CHECK(config.read32(0x200) == 0x12345678);
+    CHECK(config.read16(0x202) == 0x1234);
+    config.write16(0x202, 0xABCD);
+    config.write8 (0x200, 0x99);
+    CHECK(config.read32(0x200) == 0xABCD5699);
+
+    // Read-modify-write only touches the masked bits
+    config.modify16(0x200, 0x0000, 0x00F0);
+    CHECK(config.read16(0x200) == 0x5609);
+    config.modify32(0x200, 0xFFFFFFFF, 0xF000000F);
+    CHECK(config.read32(0x200) == 0xFBCD560F);
+
+    // A read that runs past the end of configuration space is an error
+    CHECK_THROWS(config.read32(4094));
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testCapabilities() - Checks that both capability lists are walked
+//=================================================================================================
+static void testCapabilities(PciConfig& config)
+{
+    // The standard list, including the capability that isn't first
+    CHECK(config.findCapability(0x01) == PM_CAP);
+    CHECK(config.findCapability(PciConfig::CAP_ID_PCIE) == PCIE_CAP);
+    CHECK(config.findCapability(0x05) == 0);
+
+    // The extended list
+    CHECK(config.findExtCapability(0x0001) == AER_CAP);
+    CHECK(config.findExtCapability(PciConfig::EXT_CAP_ID_DSN) == DSN_CAP);
+    CHECK(config.findExtCapability(0x000B) == 0);
+    CHECK(config.read32(DSN_CAP + PciConfig::DSN_SERIAL_LOW)  == 0xFE010203);
+    CHECK(config.read32(DSN_CAP + PciConfig::DSN_SERIAL_HIGH) == 0x000A35FF);
+
+    // A list that points back at itself ends rather than looping forever
+    uint8_t next = config.read8(PCIE_CAP + 1);
+    config.write8(PCIE_CAP + 1, PM_CAP);
+    CHECK(config.findCapability(0x05) == 0);
+    config.write8(PCIE_CAP + 1, next);
+
+    // Without the capability-list bit in the status register, there's no list at all
+    config.write16(PciConfig::STATUS, 0);
+    CHECK(config.findCapability(PciConfig::CAP_ID_PCIE) == 0);
+    config.write16(PciConfig::STATUS, PciConfig::STATUS_CAP_LIST);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testSnapshot() - Checks that a snapshot finds the PCIe registers, and round-trips
+//=================================================================================================
+static void testSnapshot(PciConfig& config)
+{
+    // Give the registers some settings
+    config.write32(PciConfig::BAR0, 0xF0000000);
+    config.write16(PCIE_CAP + PciConfig::PCIE_DEVICE_CONTROL, 0x2930);
+    config.write16(PciConfig::COMMAND, PciConfig::COMMAND_MEMORY | PciConfig::COMMAND_MASTER);
+    auto before = config.save();
+
+    // The PCIe registers are found through the capability list, and COMMAND is saved last
+    bool found = false;
+    for (auto& reg : before) if (reg.name == "DEVCTL" && reg.offset == PCIE_CAP + PciConfig::PCIE_DEVICE_CONTROL) found = true;
+    CHECK(found);
+    CHECK(!before.empty() && before.back().name == "COMMAND");
+
+    // Clobber them, the way a reset would
+    config.write32(PciConfig::BAR0, 0);
+    config.write16(PCIE_CAP + PciConfig::PCIE_DEVICE_CONTROL, 0x2810);
+    config.write16(PciConfig::COMMAND, 0);
+
+    // The differences are described
+    auto changes = PciConfig::diff(before, config.save());
+    CHECK(changes.size() == 3);
+    CHECK(changes.size() == 3 && changes[1] == "DEVCTL 0x2930 -> 0x2810");
+
+    // Restoring without the BARs leaves them alone
+    config.restore(before, false);
+    CHECK(config.read32(PciConfig::BAR0) == 0);
+    CHECK(config.read16(PCIE_CAP + PciConfig::PCIE_DEVICE_CONTROL) == 0x2930);
+    CHECK(config.read16(PciConfig::COMMAND) == (PciConfig::COMMAND_MEMORY | PciConfig::COMMAND_MASTER));
+
+    // And with them, everything is back the way it was
+    config.restore(before, true);
+    CHECK(PciConfig::diff(before, config.save()).empty());
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// main() - Builds a configuration space file, and runs the tests against it
+//=================================================================================================
+int main()
+{
+    string filename;
+
+    try
+    {
+        filename = buildConfigSpace();
+        PciConfig config(filename);
+
+        testAccess(config);
+        testCapabilities(config);
+        testSnapshot(config);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "PciConfigTest: %s\n", e.what());
+        if (!filename.empty()) unlink(filename.c_str());
+        return 1;
+    }
+
+    unlink(filename.c_str());
+    return checkResult("PciConfigTest");
+}
+//=================================================================================================
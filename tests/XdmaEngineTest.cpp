@@ -0,0 +1,132 @@
+//=================================================================================================
+// XdmaEngineTest.cpp - Drives XdmaEngine against XdmaSimulator
+//
+// The descriptors, bounce buffers and host buffers come from a DmaPool of ordinary 4K pages, so
+// this needs root (to read physical addresses from /proc/self/pagemap) but not hugepages or a card.
+//=================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+#include "XdmaEngine.h"
+#include "XdmaSimulator.h"
+#include "Check.h"
+using namespace std;
+
+// The size of the simulated card's memory
+static const size_t CARD_BYTES = 16 << 20;
+
+
+//=================================================================================================
+// testRoundTrip() - Uploads a buffer bigger than the bounce buffer, and reads it back
+//=================================================================================================
+static void testRoundTrip(XdmaEngine& engine, XdmaSimulator& sim)
+{
+    // An odd length, so that the last descriptor is a partial one
+    vector<uint8_t> source((3 << 20) + 123), result(source.size());
+
+    // A pattern that doesn't repeat on any power-of-two boundary
+    for (size_t i = 0; i < source.size(); ++i) source[i] = i * 7 + (i >> 13);
+
+    // Send it to the card and bring it back
+    engine.upload(source.data(), 0x1000, source.size());
+    engine.download(0x1000, result.data(), result.size());
+
+    // Both the card's memory and what came back should match what we sent
+    CHECK(memcmp(sim.cardMemory() + 0x1000, source.data(), source.size()) == 0);
+    CHECK(result == source);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testBatch() - Runs a batch with more descriptors than the ring holds
+//=================================================================================================
+static void testBatch(XdmaEngine& engine, XdmaSimulator& sim, DmaPool& pool)
+{
+    vector<XdmaEngine::transfer_t> batch;
+
+    // Two pages of host memory with different contents
+    auto buffer = pool.alloc(8192, 4096);
+    memset(buffer.virtAddr, 0x5A, 4096);
+    memset(buffer.virtAddr + 4096, 0xA5, 4096);
+
+    // 200 transfers, alternating between the two pages
+    for (int i = 0; i < 200; ++i)
+    {
+        batch.push_back({buffer.physAddr + (i % 2) * 4096, 0x800000 + (uint64_t)i * 4096, 4096});
+    }
+
+    // Run them on the second channel
+    engine.run(XdmaEngine::H2C, 1, batch);
+
+    // The first and last pages on the card should hold what was sent there
+    CHECK(sim.cardMemory()[0x800000] == 0x5A);
+    CHECK(sim.cardMemory()[0x800000 + 199 * 4096 + 4095] == 0xA5);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// testErrors() - Checks that bad transfers are reported, and that the engine recovers
+//=================================================================================================
+static void testErrors(XdmaEngine& engine, XdmaSimulator& sim, DmaPool& pool)
+{
+    auto buffer = pool.alloc(4096, 4096);
+
+    // A transfer that runs off the end of the card's memory
+    CHECK_THROWS(engine.run(XdmaEngine::H2C, 0, {{buffer.physAddr, CARD_BYTES - 100, 4096}}));
+
+    // A channel that doesn't exist
+    CHECK_THROWS(engine.run(XdmaEngine::C2H, 5, {{buffer.physAddr, 0, 4}}));
+
+    // The channel that had the error should still work
+    memset(buffer.virtAddr, 0, 16);
+    engine.run(XdmaEngine::H2C, 0, {{buffer.physAddr, 0x1000, 16}});
+    engine.run(XdmaEngine::C2H, 0, {{buffer.physAddr, 0x2000, 16}});
+    CHECK(memcmp(buffer.virtAddr, sim.cardMemory() + 0x2000, 16) == 0);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// main() - Sets up a simulated card with two channels each way, and runs the tests
+//=================================================================================================
+int main()
+{
+    // Reading physical addresses needs root
+    if (geteuid() != 0)
+    {
+        printf("XdmaEngineTest: skipped, must be run as root\n");
+        return SKIP_TEST;
+    }
+
+    try
+    {
+        DmaPool                pool(24 << 20, DmaPool::PAGE_4K);
+        XdmaSimulator          sim(pool, CARD_BYTES, 2, 2);
+        XdmaEngine             engine;
+        XdmaEngine::options_t  opts;
+
+        // A small ring and bounce buffer, so that transfers have to wrap around them
+        opts.ringSize    = 64;
+        opts.bounceBytes = 1 << 20;
+        engine.attach(sim.registers(), pool, opts);
+
+        // The engine should find every channel the simulator has
+        CHECK(engine.channels(XdmaEngine::H2C) == 2);
+        CHECK(engine.channels(XdmaEngine::C2H) == 2);
+
+        testRoundTrip(engine, sim);
+        testBatch(engine, sim, pool);
+        testErrors(engine, sim, pool);
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "XdmaEngineTest: %s\n", e.what());
+        return 1;
+    }
+
+    return checkResult("XdmaEngineTest");
+}
+//=================================================================================================
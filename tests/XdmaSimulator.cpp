@@ -0,0 +1,208 @@
+//=================================================================================================
+// XdmaSimulator.cpp - Implements a software model of an XDMA core
+//
+// The register block is ordinary memory.   A thread watches each channel's write-1-to-set and
+// write-1-to-clear control registers, applying and then zeroing whatever software writes to
+// them.   Each time "run" is written to the write-1-to-set register, the thread walks the
+// channel's chain of descriptors exactly as the hardware would: checking each descriptor's
+// magic number, moving the data between host memory and the card's memory, counting completed
+// descriptors, and stopping at the descriptor with the "stop" bit.   When the chain is done, the
+// count is written to the poll-mode writeback word.   Physical addresses are translated back to
+// user-space addresses through the DMA pool.
+//=================================================================================================
+#include <string.h>
+#include <unistd.h>
+#include "XdmaSimulator.h"
+using namespace std;
+
+// Version 6 of the core's identifier, as reported by real hardware
+static const uint32_t ID_VERSION = 0x06;
+
+// The lowest bit of each error field of the status register, which reports an access to an
+// address that doesn't exist
+static const uint32_t READ_ERROR  = 1 << 9;
+static const uint32_t WRITE_ERROR = 1 << 14;
+static const uint32_t DESC_ERROR  = 1 << 19;
+
+//=================================================================================================
+// Constructor - Creates the register block and the card's memory, and starts the engine thread
+//=================================================================================================
+XdmaSimulator::XdmaSimulator(const DmaPool& pool, size_t cardBytes, int h2cChannels, int c2hChannels)
+    : pool_(pool), h2cChannels_(h2cChannels), c2hChannels_(c2hChannels), regs_(0x10000 / 4), card_(cardBytes)
+{
+    using X = XdmaEngine;
+
+    // Fill in the identifier register of each channel and its scatter-gather block
+    for (int i = 0; i < h2cChannels_; ++i)
+    {
+        *reg(X::H2C_CHANNEL + i * X::CHANNEL_STRIDE) = X::ID_XDMA | (X::ID_TARGET_H2C       << 16) | (i << 8) | ID_VERSION;
+        *reg(X::H2C_SGDMA   + i * X::CHANNEL_STRIDE) = X::ID_XDMA | (X::ID_TARGET_H2C_SGDMA << 16) | (i << 8) | ID_VERSION;
+    }
+    for (int i = 0; i < c2hChannels_; ++i)
+    {
+        *reg(X::C2H_CHANNEL + i * X::CHANNEL_STRIDE) = X::ID_XDMA | (X::ID_TARGET_C2H       << 16) | (i << 8) | ID_VERSION;
+        *reg(X::C2H_SGDMA   + i * X::CHANNEL_STRIDE) = X::ID_XDMA | (X::ID_TARGET_C2H_SGDMA << 16) | (i << 8) | ID_VERSION;
+    }
+
+    // Attach an Mmio to the register block
+    mmio_.attach((uint8_t*)regs_.data(), regs_.size() * 4);
+
+    // Start the engine
+    thread_ = thread(&XdmaSimulator::serve, this);
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// Destructor - Stops the engine thread
+//=================================================================================================
+XdmaSimulator::~XdmaSimulator()
+{
+    stop_ = true;
+    thread_.join();
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// serve() - Applies writes to the control registers of every channel, and processes a
+//           channel's descriptors each time its "run" bit is set
+//=================================================================================================
+void XdmaSimulator::serve()
+{
+    using X = XdmaEngine;
+
+    while (!stop_)
+    {
+        for (auto dir : {X::H2C, X::C2H})
+        {
+            int count = (dir == X::H2C) ? h2cChannels_ : c2hChannels_;
+            for (int i = 0; i < count; ++i)
+            {
+                size_t regs  = (dir == X::H2C ? X::H2C_CHANNEL : X::C2H_CHANNEL) + i * X::CHANNEL_STRIDE;
+                size_t sgdma = (dir == X::H2C ? X::H2C_SGDMA   : X::C2H_SGDMA  ) + i * X::CHANNEL_STRIDE;
+
+                // Clear the control bits that software asked to clear
+                uint32_t clear = *reg(regs + X::CH_CONTROL_W1C);
+                if (clear)
+                {
+                    *reg(regs + X::CH_CONTROL_W1C) = 0;
+                    *reg(regs + X::CH_CONTROL) &= ~clear;
+                }
+
+                // Set the control bits that software asked to set
+                uint32_t set = *reg(regs + X::CH_CONTROL_W1S);
+                if (set)
+                {
+                    *reg(regs + X::CH_CONTROL_W1S) = 0;
+                    *reg(regs + X::CH_CONTROL) |= set;
+
+                    // If software started the channel, process its chain of descriptors
+                    if (set & X::CONTROL_RUN) process(dir, regs, sgdma);
+                }
+            }
+        }
+
+        // Give the CPU back before looking again
+        usleep(10);
+    }
+}
+//=================================================================================================
+
+
+//=================================================================================================
+// process() - Walks a channel's chain of descriptors, performing each transfer
+//
+// Passed: dir   = the direction of the channel
+//         regs  = the offset of the channel's registers
+//         sgdma = the offset of the channel's scatter-gather registers
+//=================================================================================================
+void XdmaSimulator::process(XdmaEngine::direction_t dir, size_t regs, size_t sgdma)
+{
+    using X = XdmaEngine;
+
+    uint32_t status    = X::STATUS_BUSY;
+    uint32_t completed = 0;
+
+    // Setting "run" clears the completed count and the status
+    *reg(regs + X::CH_COMPLETED) = 0;
+    *reg(regs + X::CH_STATUS)    = *reg(regs + X::CH_STATUS_RC) = status;
+
+    // Fetch the address of the first descriptor
+    uint64_t address = *reg(sgdma + X::SG_DESC_LO) | ((uint64_t)*reg(sgdma + X::SG_DESC_HI) << 32);
+
+    // Walk the chain of descriptors
+    while (true)
+    {
+        // Find the descriptor in host memory
+        auto* desc = (const X::descriptor_t*)pool_.virtAddr(address);
+        if (desc == nullptr)
+        {
+            status |= DESC_ERROR;
+            break;
+        }
+
+        // If it doesn't have the magic number, stop
+        if ((desc->control & 0xFFFF0000) != X::DESC_MAGIC)
+        {
+            status |= X::STATUS_MAGIC_STOPPED;
+            break;
+        }
+
+        // Find both sides of the transfer
+        uint64_t hostPhys = (dir == X::H2C) ? desc->srcAddr : desc->dstAddr;
+        uint64_t cardAddr = (dir == X::H2C) ? desc->dstAddr : desc->srcAddr;
+        uint8_t* host     = pool_.virtAddr(hostPhys);
+        uint32_t length   = desc->length;
+
+        // Make sure the length is legal
+        if (length == 0 || length > X::DESC_MAX_LENGTH)
+        {
+            status |= X::STATUS_INVALID_LENGTH;
+            break;
+        }
+
+        // Make sure the host side is physically contiguous and the card side exists
+        if (host == nullptr || pool_.virtAddr(hostPhys + length - 1) != host + length - 1 || cardAddr + length > card_.size())
+        {
+            status |= (dir == X::H2C) ? READ_ERROR : WRITE_ERROR;
+            break;
+        }
+
+        // Move the data
+        if (dir == X::H2C)
+            memcpy(card_.data() + cardAddr, host, length);
+        else
+            memcpy(host, card_.data() + cardAddr, length);
+
+        // Count the completed descriptor
+        *reg(regs + X::CH_COMPLETED) = ++completed;
+
+        // If this is the last descriptor in the chain, we're done
+        if (desc->control & X::DESC_STOP)
+        {
+            status |= X::STATUS_DESC_STOPPED | X::STATUS_DESC_COMPLETED;
+            break;
+        }
+
+        // Move on to the next descriptor
+        address = desc->nextAddr;
+    }
+
+    // The channel is no longer busy.  The read-to-clear copy of the status can't actually clear
+    // itself, since we can't see reads
+    *reg(regs + X::CH_STATUS) = *reg(regs + X::CH_STATUS_RC) = status & ~X::STATUS_BUSY;
+
+    // Make sure the data is in memory before software sees that we're finished
+    atomic_thread_fence(memory_order_release);
+
+    // In poll mode, report the outcome in host memory
+    if (*reg(regs + X::CH_CONTROL) & X::CONTROL_POLL_WB)
+    {
+        uint64_t wbPhys = *reg(regs + X::CH_POLL_WB_LO) | ((uint64_t)*reg(regs + X::CH_POLL_WB_HI) << 32);
+        auto*    wb     = (volatile uint32_t*)pool_.virtAddr(wbPhys);
+        bool     error  = (status & X::STATUS_ERRORS) != 0;
+        if (wb) *wb = completed | (error ? (uint32_t)X::WB_ERROR : 0u);
+    }
+}
+//=================================================================================================
@@ -0,0 +1,66 @@
+//=================================================================================================
+// XdmaSimulator.h - Defines a software model of an XDMA core, for exercising XdmaEngine
+//                   without a card
+//=================================================================================================
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "Mmio.h"
+#include "DmaPool.h"
+#include "XdmaEngine.h"
+
+class XdmaSimulator
+{
+public:
+
+    // Constructor.  Creates the register block and the card's memory, and starts a thread that
+    // plays the part of the DMA engine.   Descriptors and host buffers must be inside "pool"
+    XdmaSimulator(const DmaPool& pool, size_t cardBytes, int h2cChannels = 1, int c2hChannels = 1);
+
+    // Destructor - stops the engine thread
+    ~XdmaSimulator();
+
+    // No copy or assignment constructor - objects of this class can't be copied
+    XdmaSimulator (const XdmaSimulator&) = delete;
+    XdmaSimulator& operator= (const XdmaSimulator&) = delete;
+
+    // The simulated register block, for XdmaEngine::attach()
+    const Mmio& registers() const {return mmio_;}
+
+    // The simulated memory on the card
+    uint8_t*    cardMemory() {return card_.data();}
+    size_t      cardSize()   {return card_.size();}
+
+protected:
+
+    // The body of the engine thread
+    void        serve();
+
+    // Walks a channel's chain of descriptors, performing each transfer
+    void        process(XdmaEngine::direction_t dir, size_t regs, size_t sgdma);
+
+    // Returns a pointer to a register
+    volatile uint32_t* reg(size_t offset) {return (volatile uint32_t*)(regs_.data()) + offset / 4;}
+
+    // The pool that the descriptors and host buffers live in
+    const DmaPool&    pool_;
+
+    // The number of channels in each direction
+    int               h2cChannels_, c2hChannels_;
+
+    // The register block, and an Mmio that's attached to it
+    std::vector<uint32_t> regs_;
+    Mmio              mmio_;
+
+    // The memory on the card
+    std::vector<uint8_t> card_;
+
+    // Tells the engine thread to stop
+    std::atomic<bool> stop_{false};
+
+    // The engine thread
+    std::thread       thread_;
+};